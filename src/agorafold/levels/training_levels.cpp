@@ -1,6 +1,7 @@
 #include "levels/training_levels.h"
 #include "core/util.h"
 #include "core/resource.h"
+#include "core/resource_loader.h"
 #include "core/input.h"
 #include "level.h"
 #include "core/state.h"
@@ -38,12 +39,16 @@ ElectricMaterial::light(Vec2 ray_dir, Vec2 hit_location, RenderObject *obj)
 }
 
 TrainingLevelController::TrainingLevelController() :
-  colors()
+  colors(), map(nullptr), level(nullptr), state(nullptr)
 {
-  ResourceBundle *bundle =
-    new ResourceBundle(local_to_absolute_path("resources/training_levels.rbz"));
+  load = ResourceLoader::get()->load_bundle(
+    local_to_absolute_path("resources/training_levels.rbz"));
+}
 
-  json j = json::parse(((Text *)bundle->get_resource("data"))->get_text());
+void
+TrainingLevelController::bundle_loaded(ResourceBundle *bundle)
+{
+  json j = json::parse(bundle->get<Text>("data")->get_text());
   for (const auto &c : j["colors"].items())
   {
     Vec4 color = Vec4(c.value()["r"], c.value()["g"], c.value()["b"], 1);
@@ -94,6 +99,9 @@ TrainingLevelController::TrainingLevelController() :
 
 TrainingLevelController::~TrainingLevelController()
 {
+  // The bundle is ours once it has loaded, even if it was never used
+  if (state == nullptr && load->is_ready())
+    delete load->get_bundle();
   delete map;
   delete level;
   delete state;
@@ -102,5 +110,7 @@ TrainingLevelController::~TrainingLevelController()
 LevelState *
 TrainingLevelController::get_level_state()
 {
+  if (state == nullptr && load->is_ready())
+    bundle_loaded(load->get_bundle());
   return state;
 }
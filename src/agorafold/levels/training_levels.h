@@ -2,6 +2,7 @@
 #define TRAINING_LEVELS_H
 
 #include <map>
+#include <memory>
 #include <string>
 #include "core/linear_algebra.h"
 #include "core/graphics.h"
@@ -10,6 +11,8 @@ class Tilemap;
 class Level;
 class LevelState;
 class InputMonitor;
+class ResourceBundle;
+class BundleLoad;
 
 class ElectricMaterial : public Material
 {
@@ -35,11 +38,17 @@ class TrainingLevelController
 
   Level *level;
   LevelState *state;
+
+  std::shared_ptr<BundleLoad> load;
+
+  void
+  bundle_loaded(ResourceBundle *bundle);
 public:
   TrainingLevelController();
 
   ~TrainingLevelController();
 
+  // Null until the level's bundle has finished loading
   LevelState *
   get_level_state();
 };
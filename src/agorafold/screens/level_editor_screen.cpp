@@ -18,7 +18,7 @@ LevelEditorScreen::~LevelEditorScreen()
 void
 LevelEditorScreen::update(float time_elapsed)
 {
-  if (!paused)
+  if (!paused && level->get_level_state() != nullptr)
     level->get_level_state()->update(time_elapsed);
 }
 
@@ -27,6 +27,8 @@ LevelEditorScreen::draw_custom()
 {
   // Draw the 2D representation of the level
   LevelState *level_state = level->get_level_state();
+  if (level_state == nullptr)
+    return;
   /*
   level_state->draw_side_view_in_rect(graphics_server,
     Vec2(10, 10), Vec2(512, 512));
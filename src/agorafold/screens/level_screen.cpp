@@ -17,12 +17,17 @@ LevelScreen::~LevelScreen()
 void
 LevelScreen::update(float time_elapsed)
 {
-  level->get_level_state()->update(time_elapsed);
+  if (level->get_level_state() != nullptr)
+    level->get_level_state()->update(time_elapsed);
 }
 
 void
 LevelScreen::draw_custom()
 {
+  // Nothing to draw until the level has loaded
+  if (level->get_level_state() == nullptr)
+    return;
+
   // Draw the 2D representation of the level
   // On the left, the visualizer thing (just cuteness, not anything important)
   {
@@ -61,11 +61,11 @@ OptionsScreen::OptionsList::draw(Vec2 offset)
   float y_offset = offset.y;
 
   {
-    Image *arrow;
+    ResourceHandle<Image> arrow;
     if (open)
-      arrow = (Image *)GameState::get()->get_globals()->get_resource("arrow_close");
+      arrow = GameState::get()->get_globals()->get<Image>("arrow_close");
     else
-      arrow = (Image *)GameState::get()->get_globals()->get_resource("arrow_open");
+      arrow = GameState::get()->get_globals()->get<Image>("arrow_open");
     arrow->generate_texture();
     if (arrow_button->highlighted)
       GraphicsServer::get()->draw_texture_rect(Vec2(offset.x + 20, offset.y), Vec2(32), *arrow->get_texture());
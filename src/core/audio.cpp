@@ -30,7 +30,7 @@ AudioServer::get()
 }
 
 AudioServer::AudioServer() :
-  is_playing(false), playing(), backend(nullptr)
+  backend(nullptr), is_playing(false), playing(), music(), music_on(false)
 {
 #ifdef _WIN32
   backend = new AudioLayerWasapi();
@@ -113,6 +113,7 @@ AudioServer::buffer()
     // Do work
     std::vector<int16_t> stereo_buffer = std::vector<int16_t>(buffer_frames * 2);
 
+    std::unique_lock<std::mutex> lock = lock_mixer();
     std::vector<PlayingAudio> still_playing = std::vector<PlayingAudio>();
     for (unsigned int i = 0; i < playing.size(); ++i)
     {
@@ -123,8 +124,9 @@ AudioServer::buffer()
     }
     playing = still_playing;
 
-    if (music_on)
+    if (music_on && music.track)
       mix_to_buffer(&music, stereo_buffer, buffer_frames);
+    lock.unlock();
 
     backend->load_buffer(stereo_buffer.data(), buffer_frames);
 
@@ -155,9 +157,20 @@ AudioServer::stop()
   }
 }
 
+std::unique_lock<std::mutex>
+AudioServer::lock_mixer()
+{
+  return std::unique_lock<std::mutex>(mixer_mutex);
+}
+
 void
-AudioServer::play(AudioTrack *track)
+AudioServer::play(ResourceHandle<AudioTrack> track)
 {
+  // Samples are only ever decoded for a track that isn't playing yet, so
+  // this doesn't have to hold up the mixer
+  track->decode_samples();
+
+  std::unique_lock<std::mutex> lock = lock_mixer();
   PlayingAudio audio = {};
   audio.track = track;
   audio.offset = 0;
@@ -166,8 +179,12 @@ AudioServer::play(AudioTrack *track)
 }
 
 void
-AudioServer::set_music(AudioTrack *_music)
+AudioServer::set_music(ResourceHandle<AudioTrack> _music)
 {
+  if (_music)
+    _music->decode_samples();
+
+  std::unique_lock<std::mutex> lock = lock_mixer();
   music.track = _music;
   music.offset = 0;
   music.loop = true;
@@ -176,11 +193,13 @@ AudioServer::set_music(AudioTrack *_music)
 void
 AudioServer::start_music()
 {
+  std::unique_lock<std::mutex> lock = lock_mixer();
   music_on = true;
 }
 
 void
 AudioServer::stop_music()
 {
+  std::unique_lock<std::mutex> lock = lock_mixer();
   music_on = false;
 }
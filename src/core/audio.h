@@ -1,10 +1,11 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include <mutex>
 #include <thread>
 #include <vector>
 
-class AudioTrack;
+#include "core/resource.h"
 
 class AudioLayer
 {
@@ -34,9 +35,14 @@ class AudioServer
   bool is_playing;
   std::thread buffer_thread;
 
+  // Held by the audio thread while it mixes
+  std::mutex mixer_mutex;
+
+  /* Playing tracks are held by a handle, so that the resource cache sees
+     them as in use and leaves their samples alone. */
   struct PlayingAudio
   {
-    AudioTrack *track;
+    ResourceHandle<AudioTrack> track;
     uint32_t offset;
     bool loop;
   };
@@ -68,11 +74,16 @@ public:
   void
   stop();
 
+  // Anything that changes samples a track might be playing from has to hold
+  // this, so that it doesn't happen in the middle of mixing
+  std::unique_lock<std::mutex>
+  lock_mixer();
+
   void
-  play(AudioTrack *track);
+  play(ResourceHandle<AudioTrack> track);
 
   void
-  set_music(AudioTrack *_music);
+  set_music(ResourceHandle<AudioTrack> _music);
 
   void
   start_music();
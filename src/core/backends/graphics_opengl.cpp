@@ -1,37 +1,7 @@
 #include "core/backends/graphics_opengl.h"
 
-namespace ColorShaderSources
-{
-  const std::string vertex = R"---(
-
-#version 330 core
-layout (location = 0) in vec3 position;
-
-uniform mat3 transform;
-
-void
-main()
-{
-  gl_Position = vec4(transform * vec3(position.xy, 1.0), 1.0);
-}
-
-  )---";
-
-  const std::string fragment = R"---(
-
-#version 330 core
-out vec4 frag_color;
-
-uniform vec4 color;
-
-void
-main()
-{
-  frag_color = color;
-}
-
-  )---";
-}
+#include <algorithm>
+#include <cstring>
 
 namespace TextureShaderSources
 {
@@ -41,14 +11,18 @@ namespace TextureShaderSources
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 texture_coordinates;
 
-uniform mat3 transform;
+layout (std140) uniform ScreenData
+{
+  mat3 pixel_to_screen;
+  mat3 full_screen; // takes the unit quad to the whole screen
+};
 
 out vec2 uv;
 
 void
 main()
 {
-  gl_Position = vec4(transform * vec3(position.xy, 1.0), 1.0);
+  gl_Position = vec4(full_screen * vec3(position.xy, 1.0), 1.0);
   uv = texture_coordinates;
 }
 
@@ -72,23 +46,35 @@ main()
   )---";
 }
 
-namespace TextShaderSources
+namespace QuadShaderSources
 {
   const std::string vertex = R"---(
 
 #version 330 core
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec2 texture_coordinates;
+// Each instance is a quad, with its corners made from the vertex index
+layout (location = 0) in vec4 rect;
+layout (location = 1) in vec4 uv_rect;
+layout (location = 2) in vec4 quad_color;
+layout (location = 3) in uint quad_mode;
 
-uniform mat3 transform;
+layout (std140) uniform ScreenData
+{
+  mat3 pixel_to_screen;
+  mat3 full_screen; // takes the unit quad to the whole screen
+};
 
 out vec2 uv;
+out vec4 color;
+flat out uint mode;
 
 void
 main()
 {
-  gl_Position = vec4(transform * vec3(position.xy, 1.0), 1.0);
-  uv = texture_coordinates;
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+  gl_Position = vec4(pixel_to_screen * vec3(rect.xy + (corner * rect.zw), 1.0), 1.0);
+  uv = uv_rect.xy + (vec2(corner.x, 1.0 - corner.y) * uv_rect.zw);
+  color = quad_color;
+  mode = quad_mode;
 }
 
   )---";
@@ -99,20 +85,29 @@ main()
 out vec4 frag_color;
 
 in vec2 uv;
+in vec4 color;
+flat in uint mode;
 
-uniform vec4 color;
-uniform sampler2D sdf;
+uniform sampler2D sampler;
 
 #define HALF_SMOOTHING (1.0 / 32.0)
 #define LOWER_STEP (0.5 - (HALF_SMOOTHING))
 #define UPPER_STEP (0.5 + (HALF_SMOOTHING))
 
+// Modes match GraphicsLayerOpenGL::QuadMode
 void
 main()
 {
-  float distance = texture(sdf, uv).r;
-  float alpha = smoothstep(LOWER_STEP, UPPER_STEP, distance);
-  frag_color = vec4(color.rgb, alpha);
+  if (mode == 0u)
+    frag_color = color;
+  else if (mode == 1u)
+    frag_color = texture(sampler, uv);
+  else
+  {
+    float distance = texture(sampler, uv).r;
+    float alpha = smoothstep(LOWER_STEP, UPPER_STEP, distance);
+    frag_color = vec4(color.rgb, alpha);
+  }
 }
 
   )---";
@@ -128,7 +123,12 @@ layout (location = 1) in vec2 texture_coordinates;
 layout (location = 2) in vec3 normal;
 
 uniform mat4 model;
-uniform mat4 view_proj;
+
+layout (std140) uniform ViewData
+{
+  mat4 view_proj;
+  vec3 camera_pos;
+};
 
 out vec3 world_pos;
 out vec3 world_normal;
@@ -177,14 +177,18 @@ namespace LightingShaderSources
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 texture_coordinates;
 
-uniform mat3 transform;
+layout (std140) uniform ScreenData
+{
+  mat3 pixel_to_screen;
+  mat3 full_screen; // takes the unit quad to the whole screen
+};
 
 out vec2 uv;
 
 void
 main()
 {
-  gl_Position = vec4(transform * vec3(position.xy, 1.0), 1.0);
+  gl_Position = vec4(full_screen * vec3(position.xy, 1.0), 1.0);
   uv = texture_coordinates;
 }
 
@@ -204,7 +208,11 @@ uniform sampler2D albedo_tex;
 uniform vec3 light_dir;
 uniform vec3 light_color;
 
-uniform vec3 camera_pos;
+layout (std140) uniform ViewData
+{
+  mat4 view_proj;
+  vec3 camera_pos;
+};
 
 void
 main()
@@ -241,7 +249,11 @@ uniform sampler2D albedo_tex;
 uniform vec3 light_pos;
 uniform vec3 light_color;
 
-uniform vec3 camera_pos;
+layout (std140) uniform ViewData
+{
+  mat4 view_proj;
+  vec3 camera_pos;
+};
 
 void
 main()
@@ -281,7 +293,11 @@ uniform vec3 light_dir;
 uniform float light_angle; // the cosine of the angle of the light cone.
 uniform vec3 light_color;
 
-uniform vec3 camera_pos;
+layout (std140) uniform ViewData
+{
+  mat4 view_proj;
+  vec3 camera_pos;
+};
 
 void
 main()
@@ -334,47 +350,144 @@ main()
   )---";
 }
 
+// How many pixels a LOD's error may cover before a finer one is drawn
+static const float lod_pixel_error = 1.0f;
+
+// std140 lays each column of a mat3 out like a vec4
+static void
+write_std140(const Mat3 &m, float *out)
+{
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    out[(4 * i) + 0] = m[i].x;
+    out[(4 * i) + 1] = m[i].y;
+    out[(4 * i) + 2] = m[i].z;
+    out[(4 * i) + 3] = 0.0f;
+  }
+}
+
+// The loader only covers core OpenGL 3.3, which has RGTC but not S3TC or BPTC
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+// Returns 0 when the driver can't sample the format
+static GLenum
+get_compressed_internal_format(TextureFormat format, unsigned int channels)
+{
+  if (format == TextureFormatBC4)
+    return GL_COMPRESSED_RED_RGTC1;
+
+  if (format == TextureFormatBC1 || format == TextureFormatBC3)
+  {
+    if (!glfwExtensionSupported("GL_EXT_texture_compression_s3tc"))
+      return 0;
+    if (format == TextureFormatBC3)
+      return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    return (channels == 2 || channels == 4) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+      : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  }
+
+  if (format == TextureFormatBC7)
+  {
+    if (!glfwExtensionSupported("GL_ARB_texture_compression_bptc"))
+      return 0;
+    return GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+
+  return 0;
+}
+
 static void
 window_resize_callback(GLFWwindow *window, int width, int height)
 {
   GraphicsServer::get()->window_resize(Vec2(width, height));
 }
 
-GraphicsLayerOpenGL::TextureBinding::TextureBinding(Texture *_texture)
-  : BoundTexture(_texture)
+GraphicsLayerOpenGL::TextureBinding::TextureBinding(GraphicsLayerOpenGL *_layer,
+  Texture *_texture)
+  : BoundTexture(_texture), layer(_layer)
 {
   unsigned int width = _texture->get_width();
   unsigned int height = _texture->get_height();
   unsigned int channels = _texture->get_channels();
+  TextureFormat format = _texture->get_format();
+  uint32_t levels = _texture->get_levels();
   const unsigned char *data = _texture->get_data();
+  mipmapped = levels > 1;
 
   glGenTextures(1, &texture);
   glBindTexture(GL_TEXTURE_2D, texture);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+    mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  GLenum pixel_format = 0;
   if (channels == 1)
-  {
-    glTexImage2D(GL_TEXTURE_2D, 0, /**/ GL_RED /**/, width, height, 0,
-      /**/ GL_RED /**/, GL_UNSIGNED_BYTE, data);
-  }
+    pixel_format = GL_RED;
   else if (channels == 3)
+    pixel_format = GL_RGB;
+  else if (channels == 4)
+    pixel_format = GL_RGBA;
+
+  /* Compressed images are uploaded as they are when the driver can sample
+     their format. Otherwise they are decoded here and uploaded like any
+     other image. */
+  GLenum internal_format = 0;
+  if (is_compressed_format(format) && data != nullptr)
+    internal_format = get_compressed_internal_format(format, channels);
+
+  std::vector<unsigned char> decoded = std::vector<unsigned char>();
+  for (uint32_t level = 0; level < levels; ++level)
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, /**/ GL_RGB /**/, width, height, 0,
-      /**/ GL_RGB /**/, GL_UNSIGNED_BYTE, data);
+    unsigned int level_width = std::max(width >> level, 1u);
+    unsigned int level_height = std::max(height >> level, 1u);
+    const unsigned char *level_data = nullptr;
+    if (data != nullptr)
+      level_data = &data[get_texture_data_size(format, width, height, channels, level)];
+
+    if (internal_format != 0)
+    {
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, level_width,
+        level_height, 0, GLsizei(get_texture_data_size(format, level_width,
+          level_height, channels)), level_data);
+      continue;
+    }
+
+    if (is_compressed_format(format) && level_data != nullptr)
+    {
+      decoded.resize(size_t(level_width) * level_height * channels);
+      decompress_texture(level_data, format, level_width, level_height, channels,
+        decoded.data());
+      level_data = decoded.data();
+    }
+
+    if (pixel_format != 0)
+      glTexImage2D(GL_TEXTURE_2D, level, pixel_format, level_width, level_height,
+        0, pixel_format, GL_UNSIGNED_BYTE, level_data);
   }
-  else if (channels == 4)
+
+  // Compressed textures can't have mipmaps generated for them
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  if (levels == 1 && internal_format == 0)
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, /**/ GL_RGBA /**/, width, height, 0,
-      /**/ GL_RGBA /**/, GL_UNSIGNED_BYTE, data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    glGenerateMipmap(GL_TEXTURE_2D);
   }
-  glGenerateMipmap(GL_TEXTURE_2D);
 }
 
 GraphicsLayerOpenGL::TextureBinding::~TextureBinding()
 {
+  if (layer->quad_batch_texture == this)
+    layer->flush_quads();
   glDeleteTextures(1, &texture);
 }
 
@@ -389,13 +502,42 @@ GraphicsLayerOpenGL::TextureBinding::set_filtering(Texture::Filtering _filtering
   }
   else if (_filtering == Texture::Filtering::Linear)
   {
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+      mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   }
 
   filtering = _filtering;
 }
 
+void
+GraphicsLayerOpenGL::TextureBinding::update_region(uint32_t x, uint32_t y,
+  uint32_t width, uint32_t height, const unsigned char *pixels)
+{
+  const Texture *tex = get_texture();
+  if (is_compressed_format(tex->get_format()))
+    return;
+
+  GLenum pixel_format = 0;
+  if (tex->get_channels() == 1)
+    pixel_format = GL_RED;
+  else if (tex->get_channels() == 3)
+    pixel_format = GL_RGB;
+  else if (tex->get_channels() == 4)
+    pixel_format = GL_RGBA;
+  else
+    return;
+
+  // Quads still waiting to be drawn may want what's there now
+  if (layer->quad_batch_texture == this)
+    layer->flush_quads();
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, pixel_format,
+    GL_UNSIGNED_BYTE, pixels);
+}
+
 void
 GraphicsLayerOpenGL::TextureBinding::make_active() const
 {
@@ -540,6 +682,8 @@ GraphicsLayerOpenGL::RenderTarget::resize(int width, int height)
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
 }
 
+GLuint GraphicsLayerOpenGL::Shader::active_program = 0;
+
 GraphicsLayerOpenGL::Shader::Shader(const std::string &vertex_shader_source,
   const std::string &fragment_shader_source)
 {
@@ -566,97 +710,142 @@ GraphicsLayerOpenGL::Shader::Shader(const std::string &vertex_shader_source,
 
   glDeleteShader(vertex_shader);
   glDeleteShader(fragment_shader);
+
+  /* Find every uniform once, so that setting one never looks it up by
+     name. Uniforms in blocks have no location of their own. */
+  GLint uniform_count = 0;
+  GLint max_name_length = 0;
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniform_count);
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
+  std::vector<char> name = std::vector<char>(std::max(max_name_length, 1));
+  for (GLint i = 0; i < uniform_count; ++i)
+  {
+    GLsizei length = 0;
+    GLint size = 0;
+    Uniform uniform = Uniform();
+    glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), &length,
+      &size, &uniform.type, name.data());
+    uniform.location = glGetUniformLocation(program, name.data());
+    if (uniform.location >= 0)
+      uniforms[std::string(name.data(), length)] = uniform;
+  }
+  material_color = get_uniform("color");
+
+  GLuint screen_block = glGetUniformBlockIndex(program, "ScreenData");
+  if (screen_block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, screen_block, UniformBlockScreen);
+  GLuint view_block = glGetUniformBlockIndex(program, "ViewData");
+  if (view_block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, view_block, UniformBlockView);
+
+  // Samplers stay on the same texture unit for good
+  use();
+  for (const std::pair<const std::string, Uniform> &uniform : uniforms)
+  {
+    if (uniform.second.type != GL_SAMPLER_2D)
+      continue;
+    GLint unit = 0;
+    if (uniform.first == "normal_tex")
+      unit = 1;
+    else if (uniform.first == "albedo_tex")
+      unit = 2;
+    glUniform1i(uniform.second.location, unit);
+  }
 }
 
 GraphicsLayerOpenGL::Shader::~Shader()
 {
+  if (active_program == program)
+    active_program = 0;
   glDeleteProgram(program);
 }
 
 void
 GraphicsLayerOpenGL::Shader::use()
 {
+  if (active_program == program)
+    return;
   glUseProgram(program);
+  active_program = program;
+}
+
+GraphicsLayerOpenGL::Shader::Uniform
+GraphicsLayerOpenGL::Shader::get_uniform(const std::string &name) const
+{
+  std::unordered_map<std::string, Uniform>::const_iterator found
+    = uniforms.find(name);
+  if (found == uniforms.end())
+    return Uniform{ -1, 0 };
+  return found->second;
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(float x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_uniform(float x, Uniform uniform)
 {
-  glUseProgram(program);
-  glUniform1fv(glGetUniformLocation(program, name.c_str()), 1, &x);
+  use();
+  glUniform1fv(uniform.location, 1, &x);
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(Vec2 x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_uniform(Vec2 x, Uniform uniform)
 {
-  glUseProgram(program);
-  glUniform2fv(glGetUniformLocation(program, name.c_str()), 1, (float *)(&x));
+  use();
+  glUniform2fv(uniform.location, 1, (float *)(&x));
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(Vec3 x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_uniform(Vec3 x, Uniform uniform)
 {
-  glUseProgram(program);
-  glUniform3fv(glGetUniformLocation(program, name.c_str()), 1, (float *)(&x));
+  use();
+  glUniform3fv(uniform.location, 1, (float *)(&x));
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(Vec4 x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_uniform(Vec4 x, Uniform uniform)
 {
-  glUseProgram(program);
-  glUniform4fv(glGetUniformLocation(program, name.c_str()), 1, (float *)(&x));
+  use();
+  glUniform4fv(uniform.location, 1, (float *)(&x));
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(Mat3 x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_uniform(Mat3 x, Uniform uniform)
 {
-  glUseProgram(program);
-  glUniformMatrix3fv(glGetUniformLocation(program, name.c_str()),
-    1, GL_FALSE, (float *)(&x));
+  use();
+  glUniformMatrix3fv(uniform.location, 1, GL_FALSE, (float *)(&x));
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(Mat4 x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_uniform(Mat4 x, Uniform uniform)
 {
-  glUseProgram(program);
-  glUniformMatrix4fv(glGetUniformLocation(program, name.c_str()),
-    1, GL_FALSE, (float *)(&x));
+  use();
+  glUniformMatrix4fv(uniform.location, 1, GL_FALSE, (float *)(&x));
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(const TextureBinding *x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_texture(const TextureBinding *x)
 {
-  glUseProgram(program);
   glActiveTexture(GL_TEXTURE0);
   x->make_active();
-  glUniform1i(glGetUniformLocation(program, name.c_str()), 0);
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(const RenderTarget *x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_texture(const RenderTarget *x)
 {
-  glUseProgram(program);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, x->target_texture);
-  glUniform1i(glGetUniformLocation(program, name.c_str()), 0);
 }
 
 void
-GraphicsLayerOpenGL::Shader::bind_uniform(const GBuffer *x, std::string name)
+GraphicsLayerOpenGL::Shader::bind_gbuffer(const GBuffer *x)
 {
-  glUseProgram(program);
-
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, x->position);
-  glUniform1i(glGetUniformLocation(program, "position"), 0);
 
   glActiveTexture(GL_TEXTURE1);
   glBindTexture(GL_TEXTURE_2D, x->normal);
-  glUniform1i(glGetUniformLocation(program, "normal_tex"), 1);
 
   glActiveTexture(GL_TEXTURE2);
   glBindTexture(GL_TEXTURE_2D, x->albedo);
-  glUniform1i(glGetUniformLocation(program, "albedo_tex"), 2);
 }
 
 GraphicsLayerOpenGL::MeshBinding::MeshBinding(Mesh *_mesh,
@@ -677,22 +866,56 @@ GraphicsLayerOpenGL::MeshBinding::MeshBinding(Mesh *_mesh,
     nullptr, GL_DYNAMIC_DRAW);
 #endif
 
+  // Both vertex formats go to the GPU as they are, with the packed one
+  // unpacked by the attribute formats
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, mesh->vertices.size() * sizeof(Vertex),
-    mesh->vertices.data(), GL_STATIC_DRAW);
+  if (mesh->is_packed())
+  {
+    glBufferData(GL_ARRAY_BUFFER, mesh->get_packed_vertices().size_bytes(),
+      mesh->get_packed_vertices().data(), GL_STATIC_DRAW);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indices.size() * sizeof(unsigned int),
-    mesh->indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+      (void *)offsetof(PackedVertex, position));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+      (void *)offsetof(PackedVertex, texture_coordinates));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex),
+      (void *)offsetof(PackedVertex, normal));
+    glEnableVertexAttribArray(2);
+  }
+  else
+  {
+    glBufferData(GL_ARRAY_BUFFER, mesh->get_vertices().size_bytes(),
+      mesh->get_vertices().data(), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+    glEnableVertexAttribArray(0);
 
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-  glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)sizeof(Vec3));
+    glEnableVertexAttribArray(1);
 
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)sizeof(Vec3));
-  glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
+  }
 
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
-  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  if (mesh->get_short_indices().size() > 0)
+  {
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->get_short_indices().size_bytes(),
+      mesh->get_short_indices().data(), GL_STATIC_DRAW);
+    index_type = GL_UNSIGNED_SHORT;
+    index_size = sizeof(uint16_t);
+  }
+  else
+  {
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->get_indices().size_bytes(),
+      mesh->get_indices().data(), GL_STATIC_DRAW);
+    index_type = GL_UNSIGNED_INT;
+    index_size = sizeof(GLuint);
+  }
 
 #if 0
   /* We need to bind the 4x4 instance transform as four separate 4 vectors. */
@@ -725,29 +948,41 @@ GraphicsLayerOpenGL::MeshBinding::~MeshBinding()
 }
 
 void
-GraphicsLayerOpenGL::MeshBinding::draw(Shader *shader)
+GraphicsLayerOpenGL::MeshBinding::draw(Shader *shader, uint32_t lod)
 {
   shader->use();
   glBindVertexArray(vao);
 
   if (mesh->materials.size() == 0)
   {
-    shader->bind_uniform(Vec3(1), "color");
-    glDrawElements(GL_TRIANGLES, mesh->indices.size(), GL_UNSIGNED_INT, 0);
+    shader->bind_uniform(Vec3(1), shader->material_color);
+    glDrawElements(GL_TRIANGLES, mesh->get_index_count(), index_type, 0);
   }
   else
   {
     glDepthFunc(GL_LESS);
 
-    // Loop through materials, drawing each as a contiguous block of faces
-    uint32_t offset = 0;
-    for (uint32_t i = 0; i < mesh->materials.size(); ++i)
+    /* Ranges are sorted by material, so ranges that share a material and
+       follow each other in the index buffer are drawn in one call. */
+    const std::vector<MaterialData> &ranges = mesh->get_lod_materials(lod);
+    uint32_t i = 0;
+    while (i < ranges.size())
     {
-      if (mesh->materials[i].vertices == 0)
+      const MaterialData &first = ranges[i];
+      uint32_t end = first.first_index + first.index_count;
+      for (i = i + 1; i < ranges.size(); ++i)
+      {
+        const MaterialData &next = ranges[i];
+        if (next.material != first.material || next.first_index != end)
+          break;
+        end += next.index_count;
+      }
+
+      if (end == first.first_index)
         continue;
-      shader->bind_uniform(mesh->materials[i].diffuse_color, "color");
-      glDrawElements(GL_TRIANGLES, mesh->materials[i].vertices, GL_UNSIGNED_INT, (void *)(sizeof(GLuint) * offset));
-      offset += mesh->materials[i].vertices;
+      shader->bind_uniform(first.diffuse_color, shader->material_color);
+      glDrawElements(GL_TRIANGLES, end - first.first_index, index_type,
+        (void *)(uintptr_t(index_size) * first.first_index));
     }
   }
 }
@@ -801,12 +1036,45 @@ GraphicsLayerOpenGL::GraphicsLayerOpenGL()
   ambient_light_shader = new Shader(LightingShaderSources::vertex,
     LightingShaderSources::ambient_fragment);
 
-  color_shader = new Shader(ColorShaderSources::vertex,
-    ColorShaderSources::fragment);
   texture_shader = new Shader(TextureShaderSources::vertex,
     TextureShaderSources::fragment);
-  text_shader = new Shader(TextShaderSources::vertex,
-    TextShaderSources::fragment);
+  quad_shader = new Shader(QuadShaderSources::vertex,
+    QuadShaderSources::fragment);
+
+  model_uniform = model_shader->get_uniform("model");
+  directional_light_dir_uniform = directional_light_shader->get_uniform("light_dir");
+  directional_light_color_uniform = directional_light_shader->get_uniform("light_color");
+  ambient_light_color_uniform = ambient_light_shader->get_uniform("light_color");
+
+  /* Two mat3s for the screen, and a mat4 and a vec3 for the view, laid out
+     as std140 */
+  glGenBuffers(1, &screen_uniforms);
+  glBindBuffer(GL_UNIFORM_BUFFER, screen_uniforms);
+  glBufferData(GL_UNIFORM_BUFFER, 24 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, UniformBlockScreen, screen_uniforms);
+
+  glGenBuffers(1, &view_uniforms);
+  glBindBuffer(GL_UNIFORM_BUFFER, view_uniforms);
+  glBufferData(GL_UNIFORM_BUFFER, 20 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, UniformBlockView, view_uniforms);
+
+  /* The corners of the quad come from the vertex index, so the only
+     attributes are the per instance ones. They're pointed at the buffer
+     when a batch is drawn. */
+  quad_batch_texture = nullptr;
+  glGenVertexArrays(1, &quad_vao);
+  glGenBuffers(1, &quad_buffer);
+  quad_buffer_size = 256 * 1024;
+  quad_buffer_offset = 0;
+
+  glBindVertexArray(quad_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, quad_buffer);
+  glBufferData(GL_ARRAY_BUFFER, quad_buffer_size, nullptr, GL_STREAM_DRAW);
+  for (GLuint attribute = 0; attribute < 4; ++attribute)
+  {
+    glEnableVertexAttribArray(attribute);
+    glVertexAttribDivisor(attribute, 1);
+  }
 }
 
 GraphicsLayerOpenGL::~GraphicsLayerOpenGL()
@@ -819,9 +1087,14 @@ GraphicsLayerOpenGL::~GraphicsLayerOpenGL()
   delete spot_light_shader;
   delete ambient_light_shader;
 
-  delete color_shader;
   delete texture_shader;
-  delete text_shader;
+  delete quad_shader;
+
+  glDeleteBuffers(1, &quad_buffer);
+  glDeleteVertexArrays(1, &quad_vao);
+
+  glDeleteBuffers(1, &screen_uniforms);
+  glDeleteBuffers(1, &view_uniforms);
 
   glfwTerminate();
 }
@@ -851,7 +1124,7 @@ GraphicsLayerOpenGL::set_graphics_server(GraphicsServer *_graphics_server)
 BoundTexture *
 GraphicsLayerOpenGL::bind_texture(Texture *tex)
 {
-  TextureBinding *binding = new TextureBinding(tex);
+  TextureBinding *binding = new TextureBinding(this, tex);
   return binding;
 }
 
@@ -871,51 +1144,118 @@ GraphicsLayerOpenGL::begin_render()
   glViewport(0, 0, int(viewport_size.x), int(viewport_size.y));
   glClearColor(0, 0, 0, 1);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // The window may have changed size since the last frame
+  float screen_data[24] = {};
+  Mat3 pixel_to_screen = graphics_server->get_pixel_to_screen_transform();
+  write_std140(pixel_to_screen, &screen_data[0]);
+  write_std140(pixel_to_screen * Mat3::scale(graphics_server->get_framebuffer_size()),
+    &screen_data[12]);
+  glBindBuffer(GL_UNIFORM_BUFFER, screen_uniforms);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(screen_data), screen_data);
 }
 
 void
-GraphicsLayerOpenGL::draw_color_rect(Vec2 origin, Vec2 size, Vec4 color)
+GraphicsLayerOpenGL::end_render()
+{
+  flush_quads();
+}
+
+void
+GraphicsLayerOpenGL::add_quad(Vec2 origin, Vec2 size, Vec4 uv_rect,
+  Vec4 color, QuadMode mode, const TextureBinding *texture)
+{
+  if (texture != nullptr)
+  {
+    if (quad_batch_texture != nullptr && quad_batch_texture != texture)
+      flush_quads();
+    quad_batch_texture = texture;
+  }
+
+  QuadInstance quad = QuadInstance();
+  quad.origin = origin;
+  quad.size = size;
+  quad.uv_rect = uv_rect;
+  quad.color = color;
+  quad.mode = mode;
+  quad_batch.push_back(quad);
+}
+
+void
+GraphicsLayerOpenGL::flush_quads()
 {
+  if (quad_batch.empty())
+    return;
+
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  color_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(origin)
-    * Mat3::scale(size), "transform");
-  color_shader->bind_uniform(color, "color");
-  ((MeshBinding *)graphics_server->get_quad())->draw(color_shader);
+  if (quad_batch_texture != nullptr)
+    quad_shader->bind_texture(quad_batch_texture);
+
+  /* Each batch goes after the last one in the buffer, so there's nothing
+     to wait for before writing it. When the buffer is full it's orphaned,
+     and the driver hands out new storage while earlier draws finish. */
+  size_t size = quad_batch.size() * sizeof(QuadInstance);
+  glBindBuffer(GL_ARRAY_BUFFER, quad_buffer);
+  if (quad_buffer_offset + size > quad_buffer_size)
+  {
+    quad_buffer_size = std::max(quad_buffer_size, size);
+    glBufferData(GL_ARRAY_BUFFER, quad_buffer_size, nullptr, GL_STREAM_DRAW);
+    quad_buffer_offset = 0;
+  }
+  void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, quad_buffer_offset, size,
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  memcpy(mapped, quad_batch.data(), size);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+
+  // The origin and size are read together
+  glBindVertexArray(quad_vao);
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(QuadInstance),
+    (void *)(quad_buffer_offset + offsetof(QuadInstance, origin)));
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(QuadInstance),
+    (void *)(quad_buffer_offset + offsetof(QuadInstance, uv_rect)));
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(QuadInstance),
+    (void *)(quad_buffer_offset + offsetof(QuadInstance, color)));
+  glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(QuadInstance),
+    (void *)(quad_buffer_offset + offsetof(QuadInstance, mode)));
+
+  quad_shader->use();
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(quad_batch.size()));
+
+  quad_buffer_offset += size;
+  quad_batch.clear();
+  quad_batch_texture = nullptr;
+}
+
+void
+GraphicsLayerOpenGL::draw_color_rect(Vec2 origin, Vec2 size, Vec4 color)
+{
+  add_quad(origin, size, Vec4(), color, QuadModeColor, nullptr);
 }
 
 void
 GraphicsLayerOpenGL::draw_texture_rect(Vec2 origin, Vec2 size,
     const BoundTexture &texture)
 {
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  texture_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(origin)
-    * Mat3::scale(size), "transform");
-  texture_shader->bind_uniform((TextureBinding *)(&texture),
-    "sampler");
-  ((MeshBinding *)graphics_server->get_quad())->draw(texture_shader);
+  add_quad(origin, size, Vec4(0, 0, 1, 1), Vec4(1), QuadModeTexture,
+    (const TextureBinding *)(&texture));
 }
 
 void
-GraphicsLayerOpenGL::draw_character(Vec2 origin, Vec2 size, Vec4 color,
+GraphicsLayerOpenGL::draw_glyph_run(const std::vector<GlyphInstance> &glyphs,
   const BoundTexture &sdf)
 {
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  text_shader->bind_uniform(color, "color");
-  text_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(origin)
-    * Mat3::scale(size), "transform");
-  text_shader->bind_uniform((TextureBinding *)(&sdf), "sdf");
-  ((MeshBinding *)graphics_server->get_quad())->draw(text_shader);
+  for (const GlyphInstance &glyph : glyphs)
+  {
+    add_quad(glyph.origin, glyph.size, glyph.uv_rect, glyph.color,
+      QuadModeSDF, (const TextureBinding *)(&sdf));
+  }
 }
 
 void
 GraphicsLayerOpenGL::clear_mask()
 {
+  flush_quads();
   glClear(GL_STENCIL_BUFFER_BIT);
   glDisable(GL_STENCIL_TEST);
 }
@@ -923,18 +1263,14 @@ GraphicsLayerOpenGL::clear_mask()
 void
 GraphicsLayerOpenGL::mask_rect(Vec2 origin, Vec2 size)
 {
+  flush_quads();
   glEnable(GL_STENCIL_TEST);
   glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
   glStencilMask(0xFF);
   glStencilFunc(GL_ALWAYS, 1, 0xFF);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  color_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(origin)
-    * Mat3::scale(size), "transform");
-  color_shader->bind_uniform(Vec4(0), "color");
-  ((MeshBinding *)graphics_server->get_quad())->draw(color_shader);
+  add_quad(origin, size, Vec4(), Vec4(0), QuadModeColor, nullptr);
+  flush_quads();
 
   glStencilMask(0x00);
   glStencilFunc(GL_EQUAL, 1, 0xFF);
@@ -943,8 +1279,9 @@ GraphicsLayerOpenGL::mask_rect(Vec2 origin, Vec2 size)
 void
 GraphicsLayerOpenGL::draw_3d(const Render3DRequest &scene_request)
 {
+  flush_quads();
+
   Vec2 viewport_size = graphics_server->get_framebuffer_size(false);
-  Vec2 viewport_size_scaled = graphics_server->get_framebuffer_size();
 
   /* Setup the gbuffer and bind it */
   gbuffer->make_active();
@@ -954,13 +1291,41 @@ GraphicsLayerOpenGL::draw_3d(const Render3DRequest &scene_request)
   glEnable(GL_DEPTH_TEST);
 
   /* Render geometry */
-  model_shader->bind_uniform(scene_request.scene->get_camera()->get_view_projection_matrix(),
-    "view_proj");
+  const Camera *camera = scene_request.scene->get_camera();
+  {
+    // std140 pads the camera position out to a vec4
+    float view_data[20] = {};
+    Mat4 view_proj = camera->get_view_projection_matrix();
+    Vec3 camera_position = camera->get_position();
+    memcpy(&view_data[0], &view_proj, sizeof(Mat4));
+    memcpy(&view_data[16], &camera_position, sizeof(Vec3));
+    glBindBuffer(GL_UNIFORM_BUFFER, view_uniforms);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(view_data), view_data);
+  }
+
+  // Pixels covered by something one unit across, one unit from the camera
+  float pixels_per_unit = (viewport_size.y * 0.5f) / std::tan(camera->get_fovy() * 0.5f);
 
   for (const SceneObject *obj : scene_request.scene->get_objects())
   {
-    model_shader->bind_uniform(obj->transform, "model");
-    ((MeshBinding *)obj->mesh)->draw(model_shader);
+    /* Use the coarsest LOD whose error stays under a pixel on screen, going
+       by the object's origin and the largest scale in its transform */
+    const Mesh *mesh = obj->mesh->mesh;
+    uint32_t lod = 0;
+    if (mesh->lods.size() > 0)
+    {
+      float scale = 0.0f;
+      for (unsigned int i = 0; i < 3; ++i)
+        scale = std::max(scale, obj->transform[i].xyz().norm());
+      float distance = (obj->transform[3].xyz() - camera->get_position()).norm();
+      if (scale > 0.0f)
+        lod = mesh->select_lod((lod_pixel_error * distance) / (scale * pixels_per_unit));
+    }
+
+    // Packed positions are relative to the bounds of their mesh
+    model_shader->bind_uniform(obj->transform * mesh->get_position_transform(),
+      model_uniform);
+    ((MeshBinding *)obj->mesh)->draw(model_shader, lod);
   }
 
   glDisable(GL_DEPTH_TEST);
@@ -976,44 +1341,37 @@ GraphicsLayerOpenGL::draw_3d(const Render3DRequest &scene_request)
 
   for (const DirectionalLight *light : scene_request.scene->get_lights())
   {
-    directional_light_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-      * Mat3::translate(Vec2(0, 0))
-      * Mat3::scale(viewport_size_scaled), "transform");
-    directional_light_shader->bind_uniform(gbuffer, "x");
-    directional_light_shader->bind_uniform(light->direction, "light_dir");
-    directional_light_shader->bind_uniform(light->color, "light_color");
-    directional_light_shader->bind_uniform(scene_request.scene->get_camera()->get_position(),
-      "camera_pos");
+    directional_light_shader->bind_gbuffer(gbuffer);
+    directional_light_shader->bind_uniform(light->direction,
+      directional_light_dir_uniform);
+    directional_light_shader->bind_uniform(light->color,
+      directional_light_color_uniform);
     ((MeshBinding *)graphics_server->get_quad())->draw(directional_light_shader);
   }
 
-  ambient_light_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(Vec2(0, 0))
-    * Mat3::scale(viewport_size_scaled), "transform");
-  ambient_light_shader->bind_uniform(gbuffer, "x");
-  ambient_light_shader->bind_uniform(scene_request.scene->get_ambient_color(), "light_color");
+  ambient_light_shader->bind_gbuffer(gbuffer);
+  ambient_light_shader->bind_uniform(scene_request.scene->get_ambient_color(),
+    ambient_light_color_uniform);
   ((MeshBinding *)graphics_server->get_quad())->draw(ambient_light_shader);
 
 #if 0
-  point_light_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(Vec2(0, 0))
-    * Mat3::scale(viewport_size_scaled), "transform");
-  point_light_shader->bind_uniform(gbuffer, "x");
-  point_light_shader->bind_uniform(Vec3(0, 5, 0), "light_pos");
-  point_light_shader->bind_uniform(Vec3(1, 1, 1), "light_color");
-  point_light_shader->bind_uniform(c.position, "camera_pos");
+  point_light_shader->bind_gbuffer(gbuffer);
+  point_light_shader->bind_uniform(Vec3(0, 5, 0),
+    point_light_shader->get_uniform("light_pos"));
+  point_light_shader->bind_uniform(Vec3(1, 1, 1),
+    point_light_shader->get_uniform("light_color"));
   ((MeshBinding *)graphics_server->get_quad())->draw(point_light_shader);
 
   /*
-  spot_light_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(Vec2(0, 0))
-    * Mat3::scale(Vec2(1280, 720)), "transform");
-  spot_light_shader->bind_uniform(gbuffer, "x");
-  spot_light_shader->bind_uniform(Vec3(-5, 0, 0), "light_pos");
-  spot_light_shader->bind_uniform(Vec3(1, 0, 0).normalized(), "light_dir");
-  spot_light_shader->bind_uniform(0.98, "light_angle");
-  spot_light_shader->bind_uniform(Vec3(0, 0, 1), "light_color");
-  spot_light_shader->bind_uniform(c.position, "camera_pos");
+  spot_light_shader->bind_gbuffer(gbuffer);
+  spot_light_shader->bind_uniform(Vec3(-5, 0, 0),
+    spot_light_shader->get_uniform("light_pos"));
+  spot_light_shader->bind_uniform(Vec3(1, 0, 0).normalized(),
+    spot_light_shader->get_uniform("light_dir"));
+  spot_light_shader->bind_uniform(0.98,
+    spot_light_shader->get_uniform("light_angle"));
+  spot_light_shader->bind_uniform(Vec3(0, 0, 1),
+    spot_light_shader->get_uniform("light_color"));
   ((MeshBinding *)graphics_server->get_quad())->draw(spot_light_shader);
   */
 #endif
@@ -1025,9 +1383,6 @@ GraphicsLayerOpenGL::draw_3d(const Render3DRequest &scene_request)
   glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
   glDisable(GL_BLEND);
 
-  texture_shader->bind_uniform(graphics_server->get_pixel_to_screen_transform()
-    * Mat3::translate(Vec2(0, 0))
-    * Mat3::scale(viewport_size_scaled), "transform");
-  texture_shader->bind_uniform(target_3d, "sampler");
+  texture_shader->bind_texture(target_3d);
   ((MeshBinding *)graphics_server->get_quad())->draw(texture_shader);
 }
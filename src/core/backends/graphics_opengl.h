@@ -4,6 +4,7 @@
 #include "core/graphics.h"
 #include "core/linear_algebra.h"
 #include <string>
+#include <unordered_map>
 #include <GLFW/glfw3.h>
 
 class GraphicsLayerOpenGL : public GraphicsLayer
@@ -12,15 +13,24 @@ class GraphicsLayerOpenGL : public GraphicsLayer
 
   class TextureBinding : public BoundTexture
   {
+    GraphicsLayerOpenGL *layer;
+
     GLuint texture;
+
+    // Set when the image brought its own mipmaps, which are then sampled
+    bool mipmapped;
   public:
-    TextureBinding(Texture *_texture);
+    TextureBinding(GraphicsLayerOpenGL *_layer, Texture *_texture);
 
     ~TextureBinding();
 
     void
     set_filtering(Texture::Filtering _filtering);
 
+    void
+    update_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+      const unsigned char *pixels);
+
     void
     make_active() const;
   };
@@ -61,10 +71,34 @@ class GraphicsLayerOpenGL : public GraphicsLayer
     resize(int width, int height);
   };
 
+  /* Uniform blocks hold what every shader shares, and each has its own
+     binding point. Shaders that declare a block are pointed at its binding
+     point when they are linked. */
+  enum UniformBlock
+  {
+    UniformBlockScreen = 0,
+    UniformBlockView
+  };
+
   struct Shader
   {
+    struct Uniform
+    {
+      GLint location;
+      GLenum type;
+    };
+
     GLuint program;
 
+    // Every uniform the program uses outside of a block, found when it's linked
+    std::unordered_map<std::string, Uniform> uniforms;
+
+    // Where meshes put the color of each material they draw
+    Uniform material_color;
+
+    // Saves switching to a program that is already in use
+    static GLuint active_program;
+
     Shader(const std::string &vertex_shader_source,
       const std::string &fragment_shader_source);
 
@@ -73,34 +107,41 @@ class GraphicsLayerOpenGL : public GraphicsLayer
     void
     use();
 
+    /* Looks up a uniform by name, which is only for setting up. A uniform
+       the program doesn't use has location -1, and setting it does
+       nothing. */
+    Uniform
+    get_uniform(const std::string &name) const;
+
     void
-    bind_uniform(float x, std::string name);
+    bind_uniform(float x, Uniform uniform);
 
     void
-    bind_uniform(Vec2 x, std::string name);
+    bind_uniform(Vec2 x, Uniform uniform);
 
     void
-    bind_uniform(Vec3 x, std::string name);
+    bind_uniform(Vec3 x, Uniform uniform);
 
     void
-    bind_uniform(Vec4 x, std::string name);
+    bind_uniform(Vec4 x, Uniform uniform);
 
     void
-    bind_uniform(Mat3 x, std::string name);
+    bind_uniform(Mat3 x, Uniform uniform);
 
     void
-    bind_uniform(Mat4 x, std::string name);
+    bind_uniform(Mat4 x, Uniform uniform);
 
-    // TODO: if a shader needs more than one texture at a time, allow binding
-    // multiple texture units
+    /* Samplers are given their texture units when the program is linked:
+       the G-buffer's textures take the first three, and every other
+       sampler reads from the first. */
     void
-    bind_uniform(const TextureBinding *x, std::string name);
+    bind_texture(const TextureBinding *x);
 
     void
-    bind_uniform(const RenderTarget *x, std::string name);
+    bind_texture(const RenderTarget *x);
 
     void
-    bind_uniform(const GBuffer *x, std::string name);
+    bind_gbuffer(const GBuffer *x);
   };
 
   struct MeshBinding : public BoundMesh
@@ -111,12 +152,16 @@ class GraphicsLayerOpenGL : public GraphicsLayer
 
     GLuint vao;
 
+    GLenum index_type;
+    uint32_t index_size;
+
     MeshBinding(Mesh *_mesh, uint32_t instances);
 
     ~MeshBinding();
 
+    // Level 0 is the full mesh, the rest index into its LODs
     void
-    draw(Shader *shader);
+    draw(Shader *shader, uint32_t lod = 0);
   };
 
   // Window
@@ -131,10 +176,56 @@ class GraphicsLayerOpenGL : public GraphicsLayer
   Shader *spot_light_shader;
   Shader *ambient_light_shader;
 
+  // Uniforms set for each draw, looked up once the shaders are linked
+  Shader::Uniform model_uniform;
+  Shader::Uniform directional_light_dir_uniform;
+  Shader::Uniform directional_light_color_uniform;
+  Shader::Uniform ambient_light_color_uniform;
+
+  // Filled once a frame
+  GLuint screen_uniforms;
+
+  // Filled once for each scene drawn
+  GLuint view_uniforms;
+
   // 2D
-  Shader *color_shader;
   Shader *texture_shader;
-  Shader *text_shader;
+  Shader *quad_shader;
+
+  enum QuadMode
+  {
+    QuadModeColor = 0,
+    QuadModeTexture,
+    QuadModeSDF
+  };
+
+  struct QuadInstance
+  {
+    Vec2 origin;
+    Vec2 size;
+    Vec4 uv_rect;
+    Vec4 color;
+    uint32_t mode;
+  };
+
+  /* 2D quads are saved up and drawn together, until one needs a different
+     texture, the stencil changes or the frame ends. Flat colored quads can
+     go in with any texture. */
+  std::vector<QuadInstance> quad_batch;
+  const TextureBinding *quad_batch_texture;
+
+  // Batches stream through a ring buffer, orphaned each time it fills up
+  GLuint quad_vao;
+  GLuint quad_buffer;
+  size_t quad_buffer_size;
+  size_t quad_buffer_offset;
+
+  void
+  add_quad(Vec2 origin, Vec2 size, Vec4 uv_rect, Vec4 color, QuadMode mode,
+    const TextureBinding *texture);
+
+  void
+  flush_quads();
 public:
   GraphicsLayerOpenGL();
 
@@ -158,6 +249,9 @@ public:
   void
   begin_render();
 
+  void
+  end_render();
+
   void
   draw_color_rect(Vec2 origin, Vec2 size, Vec4 color);
 
@@ -165,7 +259,7 @@ public:
   draw_texture_rect(Vec2 origin, Vec2 size, const BoundTexture &texture);
 
   void
-  draw_character(Vec2 origin, Vec2 size, Vec4 color,
+  draw_glyph_run(const std::vector<GlyphInstance> &glyphs,
     const BoundTexture &sdf);
 
   void
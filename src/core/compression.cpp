@@ -0,0 +1,358 @@
+#include "core/compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <zlib.h>
+
+namespace
+{
+
+const size_t lz_min_match = 4;
+const size_t lz_max_offset = 65535;
+const unsigned int lz_hash_bits = 16;
+
+// Dictionaries are built out of segments of this size, scored by the 8 byte
+// sequences in them
+const size_t dictionary_segment_size = 64;
+const size_t dictionary_kmer_size = 8;
+
+uint32_t
+read_u32(const unsigned char *p)
+{
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+uint32_t
+hash_sequence(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32 - lz_hash_bits);
+}
+
+// Writes the continuation bytes of a length whose nibble was 15
+bool
+write_length(size_t length, unsigned char *dst, size_t &op, size_t dst_capacity)
+{
+  while (length >= 255)
+  {
+    if (op >= dst_capacity)
+      return false;
+    dst[op++] = 255;
+    length -= 255;
+  }
+  if (op >= dst_capacity)
+    return false;
+  dst[op++] = uint8_t(length);
+  return true;
+}
+
+bool
+read_length(const unsigned char *src, size_t &ip, size_t src_size, size_t &length)
+{
+  uint8_t b;
+  do
+  {
+    if (ip >= src_size)
+      return false;
+    b = src[ip++];
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+// Writes a sequence of literals, followed by a match unless match_length is 0
+bool
+write_sequence(const unsigned char *literals, size_t literal_count,
+  size_t match_offset, size_t match_length, unsigned char *dst, size_t &op,
+  size_t dst_capacity)
+{
+  if (op >= dst_capacity)
+    return false;
+  size_t token = op++;
+
+  uint8_t literal_nibble = (literal_count >= 15) ? 15 : uint8_t(literal_count);
+  if (literal_nibble == 15 && !write_length(literal_count - 15, dst, op, dst_capacity))
+    return false;
+
+  if (literal_count > dst_capacity - op)
+    return false;
+  memcpy(&dst[op], literals, literal_count);
+  op += literal_count;
+
+  uint8_t match_nibble = 0;
+  if (match_length != 0)
+  {
+    if (dst_capacity - op < 2)
+      return false;
+    dst[op++] = uint8_t(match_offset & 0xff);
+    dst[op++] = uint8_t(match_offset >> 8);
+
+    size_t length = match_length - lz_min_match;
+    match_nibble = (length >= 15) ? 15 : uint8_t(length);
+    if (match_nibble == 15 && !write_length(length - 15, dst, op, dst_capacity))
+      return false;
+  }
+
+  dst[token] = uint8_t((literal_nibble << 4) | match_nibble);
+  return true;
+}
+
+}
+
+size_t
+lz_compress_bound(size_t size)
+{
+  return size + (size / 255) + 16;
+}
+
+size_t
+lz_compress(const unsigned char *src, size_t src_size, unsigned char *dst,
+  size_t dst_capacity)
+{
+  // Most recent position + 1 of each hashed 4 byte sequence, 0 if none
+  std::vector<uint32_t> table = std::vector<uint32_t>(size_t(1) << lz_hash_bits, 0);
+
+  size_t ip = 0;
+  size_t anchor = 0;
+  size_t op = 0;
+  while (src_size >= lz_min_match && ip <= src_size - lz_min_match)
+  {
+    uint32_t sequence = read_u32(&src[ip]);
+    uint32_t &slot = table[hash_sequence(sequence)];
+    size_t candidate = slot;
+    slot = uint32_t(ip + 1);
+
+    if (candidate == 0 || ip - (candidate - 1) > lz_max_offset
+        || read_u32(&src[candidate - 1]) != sequence)
+    {
+      // Skip ahead faster the longer we go without a match, so data that
+      // doesn't compress (like Vorbis packets) passes through quickly
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    size_t match = candidate - 1;
+    size_t length = lz_min_match;
+    while (ip + length < src_size && src[match + length] == src[ip + length])
+      ++length;
+
+    if (!write_sequence(&src[anchor], ip - anchor, ip - match, length, dst, op,
+        dst_capacity))
+      return 0;
+
+    ip += length;
+    anchor = ip;
+  }
+
+  if (!write_sequence(&src[anchor], src_size - anchor, 0, 0, dst, op, dst_capacity))
+    return 0;
+  return op;
+}
+
+bool
+lz_decompress(const unsigned char *src, size_t src_size, unsigned char *dst,
+  size_t dst_size)
+{
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < src_size)
+  {
+    uint8_t token = src[ip++];
+
+    size_t literal_count = token >> 4;
+    if (literal_count == 15 && !read_length(src, ip, src_size, literal_count))
+      return false;
+    if (literal_count > src_size - ip || literal_count > dst_size - op)
+      return false;
+    memcpy(&dst[op], &src[ip], literal_count);
+    ip += literal_count;
+    op += literal_count;
+
+    // The last sequence has no match
+    if (ip == src_size)
+      break;
+
+    if (src_size - ip < 2)
+      return false;
+    size_t offset = size_t(src[ip]) | (size_t(src[ip + 1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > op)
+      return false;
+
+    size_t length = token & 0xf;
+    if (length == 15 && !read_length(src, ip, src_size, length))
+      return false;
+    length += lz_min_match;
+    if (length > dst_size - op)
+      return false;
+
+    // Overlapping matches repeat the last offset bytes, so they have to be
+    // copied forwards one byte at a time
+    const unsigned char *match = &dst[op - offset];
+    if (offset >= length)
+    {
+      memcpy(&dst[op], match, length);
+    }
+    else
+    {
+      for (size_t i = 0; i < length; ++i)
+        dst[op + i] = match[i];
+    }
+    op += length;
+  }
+
+  return op == dst_size;
+}
+
+size_t
+deflate_with_dictionary(const unsigned char *src, size_t src_size,
+  unsigned char *dst, size_t dst_capacity, std::span<const unsigned char> dictionary)
+{
+  z_stream stream = {};
+  if (deflateInit2(&stream, 9, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    return 0;
+  deflateSetDictionary(&stream, dictionary.data(), uInt(dictionary.size()));
+
+  stream.next_in = const_cast<unsigned char *>(src);
+  stream.avail_in = uInt(src_size);
+  stream.next_out = dst;
+  stream.avail_out = uInt(dst_capacity);
+  int err = deflate(&stream, Z_FINISH);
+  size_t compressed_size = stream.total_out;
+  deflateEnd(&stream);
+
+  return (err == Z_STREAM_END) ? compressed_size : 0;
+}
+
+bool
+inflate_with_dictionary(const unsigned char *src, size_t src_size,
+  unsigned char *dst, size_t dst_size, std::span<const unsigned char> dictionary)
+{
+  z_stream stream = {};
+  if (inflateInit2(&stream, -15) != Z_OK)
+    return false;
+  if (inflateSetDictionary(&stream, dictionary.data(), uInt(dictionary.size())) != Z_OK)
+  {
+    inflateEnd(&stream);
+    return false;
+  }
+
+  stream.next_in = const_cast<unsigned char *>(src);
+  stream.avail_in = uInt(src_size);
+  stream.next_out = dst;
+  stream.avail_out = uInt(dst_size);
+  int err = inflate(&stream, Z_FINISH);
+  size_t uncompressed_size = stream.total_out;
+  inflateEnd(&stream);
+
+  return err == Z_STREAM_END && uncompressed_size == dst_size;
+}
+
+std::vector<unsigned char>
+train_dictionary(const std::vector<std::span<const unsigned char>> &samples,
+  size_t capacity)
+{
+  // Count how many samples each sequence appears in
+  std::unordered_map<uint64_t, uint32_t> frequency = std::unordered_map<uint64_t, uint32_t>();
+  for (std::span<const unsigned char> sample : samples)
+  {
+    std::unordered_set<uint64_t> seen = std::unordered_set<uint64_t>();
+    for (size_t i = 0; i + dictionary_kmer_size <= sample.size(); ++i)
+    {
+      uint64_t kmer;
+      memcpy(&kmer, &sample[i], sizeof(kmer));
+      if (seen.insert(kmer).second)
+        frequency[kmer] += 1;
+    }
+  }
+
+  struct Segment
+  {
+    std::span<const unsigned char> data;
+    uint64_t score;
+    size_t index;
+
+    bool
+    operator<(const Segment &other) const
+    {
+      if (score != other.score)
+        return score < other.score;
+      return index > other.index;
+    }
+  };
+
+  // Sequences only found in one sample are no use to anyone else, and ones
+  // that have already been picked count for nothing
+  auto score_segment = [&frequency](std::span<const unsigned char> data) {
+    std::unordered_set<uint64_t> counted = std::unordered_set<uint64_t>();
+    uint64_t score = 0;
+    for (size_t i = 0; i + dictionary_kmer_size <= data.size(); ++i)
+    {
+      uint64_t kmer;
+      memcpy(&kmer, &data[i], sizeof(kmer));
+      std::unordered_map<uint64_t, uint32_t>::const_iterator f = frequency.find(kmer);
+      if (f != frequency.end() && f->second > 1 && counted.insert(kmer).second)
+        score += f->second;
+    }
+    return score;
+  };
+
+  std::priority_queue<Segment> candidates = std::priority_queue<Segment>();
+  size_t segment_count = 0;
+  for (std::span<const unsigned char> sample : samples)
+  {
+    for (size_t begin = 0; begin < sample.size(); begin += dictionary_segment_size)
+    {
+      Segment segment = {};
+      segment.data = sample.subspan(begin,
+        std::min(dictionary_segment_size, sample.size() - begin));
+      segment.score = score_segment(segment.data);
+      segment.index = segment_count++;
+      if (segment.score > 0)
+        candidates.push(segment);
+    }
+  }
+
+  // Greedily take the best segment. Scores only go down as sequences get
+  // used, so a segment is rescored when it comes up, and put back if it
+  // isn't the best anymore.
+  std::vector<std::span<const unsigned char>> chosen = std::vector<std::span<const unsigned char>>();
+  size_t size = 0;
+  while (!candidates.empty() && size < capacity)
+  {
+    Segment segment = candidates.top();
+    candidates.pop();
+
+    segment.score = score_segment(segment.data);
+    if (segment.score == 0)
+      continue;
+    if (!candidates.empty() && segment.score < candidates.top().score)
+    {
+      candidates.push(segment);
+      continue;
+    }
+
+    segment.data = segment.data.first(std::min(segment.data.size(), capacity - size));
+    chosen.push_back(segment.data);
+    size += segment.data.size();
+    for (size_t i = 0; i + dictionary_kmer_size <= segment.data.size(); ++i)
+    {
+      uint64_t kmer;
+      memcpy(&kmer, &segment.data[i], sizeof(kmer));
+      frequency[kmer] = 0;
+    }
+  }
+
+  // Deflate reaches the end of the dictionary with the shortest distances
+  std::vector<unsigned char> dictionary = std::vector<unsigned char>();
+  dictionary.reserve(size);
+  for (size_t i = chosen.size(); i > 0; --i)
+    dictionary.insert(dictionary.end(), chosen[i - 1].begin(), chosen[i - 1].end());
+  return dictionary;
+}
@@ -0,0 +1,49 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstddef>
+#include <vector>
+#include <span>
+
+/* A byte-oriented LZ77 codec in the style of LZ4. It compresses much less than
+   deflate, but decodes several times faster since there is no entropy coding,
+   which makes it a better fit for entries that are decoded while loading.
+
+   The stream is a series of sequences, each a token byte holding the literal
+   count in the high nibble and the match length (minus 4) in the low nibble,
+   with a nibble of 15 continued by bytes until one is below 255. The literals
+   follow, then a little endian 16 bit match offset. The last sequence ends
+   after its literals. */
+
+// Largest possible compressed size for an input of the given size
+size_t
+lz_compress_bound(size_t size);
+
+// Returns the compressed size, or 0 if it didn't fit in the destination
+size_t
+lz_compress(const unsigned char *src, size_t src_size, unsigned char *dst,
+  size_t dst_capacity);
+
+// Returns false unless the input decodes to exactly dst_size bytes
+bool
+lz_decompress(const unsigned char *src, size_t src_size, unsigned char *dst,
+  size_t dst_size);
+
+/* Raw deflate primed with a preset dictionary. Small inputs that have a lot in
+   common (like many tiny icons) can then refer to the dictionary instead of
+   starting from an empty window, and there is no zlib header or checksum. */
+size_t
+deflate_with_dictionary(const unsigned char *src, size_t src_size,
+  unsigned char *dst, size_t dst_capacity, std::span<const unsigned char> dictionary);
+
+bool
+inflate_with_dictionary(const unsigned char *src, size_t src_size,
+  unsigned char *dst, size_t dst_size, std::span<const unsigned char> dictionary);
+
+// Picks the segments of the samples that are shared by the most samples, up
+// to the given size, with the most common ones last
+std::vector<unsigned char>
+train_dictionary(const std::vector<std::span<const unsigned char>> &samples,
+  size_t capacity);
+
+#endif
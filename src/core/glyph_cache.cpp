@@ -0,0 +1,82 @@
+#include "core/glyph_cache.h"
+#include "core/graphics.h"
+#include "core/resource.h"
+
+#include <algorithm>
+#include <cstring>
+
+const uint32_t GlyphCache::page_size;
+const uint32_t GlyphCache::max_pages;
+
+GlyphCache::GlyphCache(FontFace *_face) :
+  face(_face), slots_used(0), pages(), entries(), lookup(), slot_pixels()
+{
+  slot_width = std::clamp(face->get_max_block_glyph_width() + 1, 1u, page_size);
+  slot_height = std::clamp(face->get_max_block_glyph_height() + 1, 1u, page_size);
+  slots_per_row = page_size / slot_width;
+  slots_per_page = slots_per_row * (page_size / slot_height);
+  slot_pixels = std::vector<unsigned char>(size_t(slot_width) * slot_height);
+}
+
+GlyphCache::~GlyphCache()
+{
+  for (Texture *page : pages)
+    delete page;
+}
+
+const BoundTexture *
+GlyphCache::get(uint32_t codepoint, Vec4 &uv_rect)
+{
+  std::unordered_map<uint32_t, std::list<Entry>::iterator>::iterator found
+    = lookup.find(codepoint);
+  if (found != lookup.end())
+  {
+    entries.splice(entries.begin(), entries, found->second);
+    uv_rect = found->second->uv_rect;
+    return pages[found->second->page]->get_binding();
+  }
+
+  const Glyph &glyph = face->get_glyph(codepoint);
+  const unsigned char *bitmap = face->get_glyph_bitmap(codepoint);
+  if (bitmap == nullptr || glyph.bitmap_width == 0 || glyph.bitmap_height == 0)
+    return nullptr;
+
+  // Take a free slot while there are any left, then the oldest glyph's
+  Entry entry = Entry();
+  entry.codepoint = codepoint;
+  if (slots_used < max_pages * slots_per_page)
+  {
+    entry.page = slots_used / slots_per_page;
+    entry.slot = slots_used % slots_per_page;
+    slots_used += 1;
+    if (entry.page == pages.size())
+      pages.push_back(new Texture(page_size, page_size, 1, nullptr));
+  }
+  else
+  {
+    const Entry &oldest = entries.back();
+    entry.page = oldest.page;
+    entry.slot = oldest.slot;
+    lookup.erase(oldest.codepoint);
+    entries.pop_back();
+  }
+
+  uint32_t x = (entry.slot % slots_per_row) * slot_width;
+  uint32_t y = (entry.slot / slots_per_row) * slot_height;
+  std::fill(slot_pixels.begin(), slot_pixels.end(), 0);
+  for (uint32_t row = 0; row < glyph.bitmap_height; ++row)
+  {
+    memcpy(&slot_pixels[size_t(row) * slot_width],
+      &bitmap[size_t(row) * glyph.bitmap_width], glyph.bitmap_width);
+  }
+  pages[entry.page]->get_binding()->update_region(x, y, slot_width,
+    slot_height, slot_pixels.data());
+
+  entry.uv_rect = Vec4(float(x) / page_size, float(y) / page_size,
+    float(glyph.bitmap_width) / page_size, float(glyph.bitmap_height) / page_size);
+  entries.push_front(entry);
+  lookup[codepoint] = entries.begin();
+
+  uv_rect = entry.uv_rect;
+  return pages[entry.page]->get_binding();
+}
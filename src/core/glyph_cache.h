@@ -0,0 +1,59 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "core/linear_algebra.h"
+
+class FontFace;
+class Texture;
+class BoundTexture;
+
+/* Glyphs from outside a font's atlas, copied into fixed size slots on pages
+   of texture the first time they are drawn. Once every page is full, the
+   glyph drawn least recently gives up its slot. */
+class GlyphCache
+{
+  struct Entry
+  {
+    uint32_t codepoint;
+    uint32_t page;
+    uint32_t slot;
+    Vec4 uv_rect;
+  };
+
+  const static uint32_t page_size = 1024;
+  const static uint32_t max_pages = 4;
+
+  FontFace *face;
+
+  // Large enough for any glyph in the font, with a pixel of space around it
+  uint32_t slot_width;
+  uint32_t slot_height;
+  uint32_t slots_per_row;
+  uint32_t slots_per_page;
+  uint32_t slots_used;
+
+  std::vector<Texture *> pages;
+
+  // Most recently drawn first
+  std::list<Entry> entries;
+  std::unordered_map<uint32_t, std::list<Entry>::iterator> lookup;
+
+  // One slot of pixels, so that uploading a glyph also clears the last one
+  std::vector<unsigned char> slot_pixels;
+public:
+  GlyphCache(FontFace *_face);
+
+  ~GlyphCache();
+
+  /* The page holding the glyph, with the part of it the glyph covers. Null
+     when the glyph has no bitmap. */
+  const BoundTexture *
+  get(uint32_t codepoint, Vec4 &uv_rect);
+};
+
+#endif
@@ -1,19 +1,34 @@
 #include "core/graphics.h"
 #include "core/screen.h"
 #include "core/resource.h"
+#include "core/util.h"
 #include "core/backends/graphics_opengl.h"
 #include "core/backends/graphics_vulkan.h"
 
 Texture::Texture(unsigned int _width, unsigned int _height, unsigned int _channels,
   const unsigned char *_data) :
-  width(_width), height(_height), channels(_channels), data(_data)
+  Texture(_width, _height, _channels, TextureFormatRaw, 1, _data)
 {
-  GraphicsServer::get()->bind(this);
+
+}
+
+Texture::Texture(unsigned int _width, unsigned int _height, unsigned int _channels,
+  TextureFormat _format, uint32_t _levels, const unsigned char *_data) :
+  width(_width), height(_height), channels(_channels), format(_format),
+  levels(_levels), data(_data)
+{
+  binding = GraphicsServer::get()->bind(this);
 }
 
 Texture::~Texture()
 {
+  delete binding;
+}
 
+void
+Texture::release_data()
+{
+  data = nullptr;
 }
 
 unsigned int
@@ -34,12 +49,30 @@ Texture::get_channels() const
   return channels;
 }
 
+TextureFormat
+Texture::get_format() const
+{
+  return format;
+}
+
+uint32_t
+Texture::get_levels() const
+{
+  return levels;
+}
+
 const unsigned char *
 Texture::get_data() const
 {
   return data;
 }
 
+BoundTexture *
+Texture::get_binding() const
+{
+  return binding;
+}
+
 BoundTexture::BoundTexture(const Texture *_texture) :
   texture(_texture), filtering(Texture::Filtering::Linear)
 {
@@ -75,6 +108,12 @@ Camera::Camera() :
 
 }
 
+float
+Camera::get_fovy() const
+{
+  return fovy;
+}
+
 void
 Camera::set_fovy(float _fovy)
 {
@@ -191,7 +230,7 @@ GraphicsLayer::~GraphicsLayer()
 GraphicsServer * GraphicsServer::instance = nullptr;
 
 GraphicsServer::GraphicsServer() :
-  current_screen(nullptr)
+  current_screen(nullptr), glyph_run(), glyph_leftovers()
 {
   backend = new GraphicsLayerOpenGL();
   backend->set_graphics_server(this);
@@ -333,6 +372,7 @@ GraphicsServer::draw()
   if (current_screen != nullptr)
     current_screen->draw_children();
 
+  backend->end_render();
   glfwSwapBuffers(backend->get_window());
 }
 
@@ -351,44 +391,81 @@ GraphicsServer::draw_texture_rect(Vec2 origin, Vec2 size, const BoundTexture &te
 // Draws a line of text with no wrapping or alignment, with the baseline and
 // start of the line at the origin of the bounding box specified
 void
-GraphicsServer::draw_text_line(const TextRenderRequest &text_request)
-{
-  // TODO: this should be calculated by the font face object
-  float scale_factor = text_request.size / (64.0f * 64.0f);
-  float texture_padding = 8; // 'spread' value in SDF generation
-
-  //text_request.font->generate_textures();
-  FontFace *face = text_request.font->get_font();
-  Vec2 current_pos = text_request.bounding_box_origin
-    + text_request.scroll_offset;
-
-  float g_height;
-
-  if (text_request.center_vertical)
+GraphicsServer::draw_text_layout(TextLayout &layout, Vec2 origin, Vec4 color)
+{
+  layout.update();
+
+  /* Glyphs are drawn in one run per texture. Nearly everything comes from
+     the font's atlas, so glyphs from anywhere else are set aside and drawn
+     after it. */
+  BoundFont *font = layout.get_font();
+  if (font == nullptr)
+    return;
+  const BoundTexture *run_texture = font->get_bound_texture();
+  glyph_run.clear();
+  glyph_leftovers.clear();
+
+  const std::vector<TextLayout::Character> &characters = layout.get_characters();
+  for (const TextLayout::Line &line : layout.get_lines())
   {
-    const Glyph &glyph = face->get_glyph('B');
-    g_height = (scale_factor * glyph.height);
-
-    // We want the vertical center of the text to be the same as the vertical
-    // center of the bounding box.
-    current_pos.y = text_request.bounding_box_origin.y
-      + ((1.0f / 2.0f) * text_request.bounding_box_size.y)
-      - ((1.0f / 2.0f) * g_height);
+    Vec2 line_origin = origin + line.origin;
+    for (size_t i = line.first_character;
+      i < line.first_character + line.character_count; ++i)
+    {
+      const TextLayout::Character &character = characters[i];
+      GlyphInstance glyph = GlyphInstance();
+      glyph.origin = line_origin + Vec2(character.pen, 0)
+        + character.quad_origin;
+      glyph.size = character.quad_size;
+      glyph.uv_rect = character.uv_rect;
+      glyph.color = color;
+
+      const BoundTexture *tex = character.texture;
+      if (character.cached)
+        tex = font->get_glyph_texture(character.codepoint, glyph.uv_rect);
+      if (tex == nullptr)
+        continue;
+
+      if (tex == run_texture)
+        glyph_run.push_back(glyph);
+      else
+        glyph_leftovers.push_back(std::make_pair(tex, glyph));
+    }
   }
+  if (!glyph_run.empty())
+    backend->draw_glyph_run(glyph_run, *run_texture);
 
-  Vec2 cursor_offset;
-
-  if (text_request.center)
+  while (!glyph_leftovers.empty())
   {
-    float width = 0;
-    for (unsigned int i = 0; i < text_request.text.length(); ++i)
+    run_texture = glyph_leftovers.front().first;
+    glyph_run.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < glyph_leftovers.size(); ++i)
     {
-      char c = text_request.text[i];
-      const Glyph &glyph = face->get_glyph(c);
-      width += scale_factor * glyph.horizontal_advance;
+      if (glyph_leftovers[i].first == run_texture)
+        glyph_run.push_back(glyph_leftovers[i].second);
+      else
+        glyph_leftovers[kept++] = glyph_leftovers[i];
     }
-    current_pos += Vec2((1.0f / 2.0f) * (text_request.bounding_box_size.x - width), 0);
+    glyph_leftovers.resize(kept);
+    backend->draw_glyph_run(glyph_run, *run_texture);
   }
+}
+
+void
+GraphicsServer::draw_text_request(TextLayout &layout,
+  const TextRenderRequest &text_request)
+{
+  layout.set_font(text_request.font);
+  layout.set_size(text_request.size);
+  layout.set_box_size(text_request.bounding_box_size);
+  layout.set_alignment(text_request.center, text_request.center_vertical);
+  layout.set_text(text_request.text);
+  layout.update();
+
+  // Vertically centered text ignores the vertical scroll
+  Vec2 origin = text_request.bounding_box_origin + Vec2(text_request.scroll_offset.x,
+    text_request.center_vertical ? 0 : text_request.scroll_offset.y);
 
   /* Mask off the bounds provided */
   if (text_request.mask_bounds)
@@ -398,143 +475,37 @@ GraphicsServer::draw_text_line(const TextRenderRequest &text_request)
       text_request.bounding_box_size);
   }
 
-  for (unsigned int i = 0; i < text_request.text.length(); ++i)
-  {
-    char c = text_request.text[i];
-    const Glyph &glyph = face->get_glyph(c);
-    const BoundTexture *tex = text_request.font->get_bound_texture(c);
-
-    if (i == text_request.cursor_pos)
-      cursor_offset = current_pos;
-
-    // We are scaling (glyph.bitmap_height - (2 * texture_padding)) bitmap pixels
-    // to be scale_factor * glyph.height visible pixels tall
-    float size_scale = (scale_factor * glyph.height) /
-      (float(glyph.bitmap_height) - (2 * texture_padding));
-    Vec2 glyph_size = size_scale * Vec2(glyph.bitmap_width,
-      glyph.bitmap_height);
-
-    // We also have to displace the origin of the quad by (-8, -8) bitmap pixels
-    FontFace::Kerning kern = {};
-    if (i > 0)
-      kern = face->get_kerning(text_request.text[i - 1], c);
-    Vec2 adjustment = scale_factor * Vec2(glyph.horizontal_bearing_x + kern.x,
-      -glyph.height + glyph.horizontal_bearing_y + kern.y);
-    adjustment += -scale_factor * Vec2(texture_padding * (float(glyph.width) / float(glyph.bitmap_width)),
-      texture_padding * (float(glyph.height) / float(glyph.bitmap_height)));
-
-    backend->draw_character(current_pos + adjustment, glyph_size,
-      text_request.color, *tex);
-
-    current_pos += scale_factor * Vec2(glyph.horizontal_advance, 0);
-  }
-  if (text_request.cursor_pos == text_request.text.length())
-    cursor_offset = current_pos;
+  draw_text_layout(layout, origin, text_request.color);
+
   if (text_request.cursor)
-    backend->draw_color_rect(cursor_offset - Vec2(1, 0), Vec2(2, g_height),
-      text_request.cursor_color);
+    backend->draw_color_rect(origin
+      + layout.get_cursor_position(text_request.cursor_pos) - Vec2(1, 0),
+      Vec2(2, layout.get_cap_height()), text_request.cursor_color);
 
   if (text_request.mask_bounds)
     backend->clear_mask();
 }
 
 void
-GraphicsServer::draw_text(const TextRenderRequest &text_request)
+GraphicsServer::draw_text_line(const TextRenderRequest &text_request)
 {
-  // TODO: this should be calculated by the font face object
-  float scale_factor = text_request.size / (64.0f * 64.0f);
-  float texture_padding = 8; // 'spread' value in SDF generation
-
-  FontFace *face = text_request.font->get_font();
-
-  // TODO: there should be a mechanism to cache and/or precompute the calculations below
-  // In order to arrange the lines, break the string into words (separated
-  // by whitespace) and calculate the width of each word. Then greedily
-  // add words to a line until the length of the bounding box will be exceeded.
-  std::vector<std::string> lines;
-  std::vector<float> line_widths;
-
-  uint32_t cursor_line = 0;
-  uint32_t cursor_pos = 0;
-  {
-    std::string current_line = "";
-    float current_width = 0.0f;
+  // The font may still be loading
+  if (text_request.font == nullptr)
+    return;
 
-    uint32_t line_start = 0;
-    uint32_t offset = 0;
-    for (const char &c : text_request.text)
-    {
-      const Glyph &glyph = face->get_glyph(c);
-      float glyph_width = scale_factor * glyph.horizontal_advance;
-
-      if (text_request.cursor_pos == offset)
-      {
-        cursor_line = lines.size();
-        cursor_pos = offset - line_start;
-      }
-
-      if (c == '\n')
-      {
-        /* Immediately move to the next line */
-        lines.push_back(current_line);
-        line_widths.push_back(current_width);
-
-        current_line = "";
-        current_width = 0.0f;
-
-        line_start = offset;
-      }
-      else if (current_width + glyph_width > text_request.bounding_box_size.x)
-      {
-        // We can't add another word to this line, so add it to the list and start the next
-        lines.push_back(current_line);
-        line_widths.push_back(current_width);
-
-        current_line = "";
-        current_line.append(1, c);
-        current_width = glyph_width;
-
-        line_start = offset;
-      }
-      else
-      {
-        current_line.append(1, c);
-        current_width += glyph_width;
-      }
-      offset += 1;
-    }
-    if (current_line.length() > 0)
-    {
-      lines.push_back(current_line);
-      line_widths.push_back(current_width);
-    }
+  TextLayout layout = TextLayout();
+  draw_text_request(layout, text_request);
+}
 
-    if (text_request.cursor_pos == text_request.text.length())
-    {
-      cursor_line = lines.size() - 1;
-      cursor_pos = text_request.text.length() - line_start;
-    }
-  }
+void
+GraphicsServer::draw_text(const TextRenderRequest &text_request)
+{
+  if (text_request.font == nullptr)
+    return;
 
-  // Calculations are finally done, so render the lines
-  for (unsigned int i = 0; i < lines.size(); ++i)
-  {
-    TextRenderRequest req = text_request;
-    req.text = lines[i];
-    req.center = false;
-    req.cursor = (i == cursor_line) && text_request.cursor;
-    req.cursor_pos = cursor_pos;
-
-    Vec2 alignment = Vec2(0, text_request.bounding_box_size.y);
-    if (text_request.center)
-      alignment += Vec2((1.0f / 2.0f) * (text_request.bounding_box_size.x - line_widths[i]), 0);
-
-    // TODO: Be able to adjust default leading (1.2)?
-    req.bounding_box_origin = text_request.bounding_box_origin
-      + alignment
-      - Vec2(0, float(i + 1) * 1.2f * text_request.size);
-    draw_text_line(req);
-  }
+  TextLayout layout = TextLayout();
+  layout.set_wrap(true);
+  draw_text_request(layout, text_request);
 }
 
 void
@@ -8,6 +8,7 @@
 #include "core/linear_algebra.h"
 #include "FastNoiseLite.h"
 #include "core/resource.h"
+#include "core/text_layout.h"
 
 #include "core/glad/glad.h"
 
@@ -17,6 +18,8 @@ class FontFace;
 class Screen;
 struct GLFWwindow;
 
+class BoundTexture;
+
 class Texture
 {
 public:
@@ -31,13 +34,27 @@ private:
   unsigned int width;
   unsigned int height;
   unsigned int channels;
+  TextureFormat format;
+  uint32_t levels;
   const unsigned char *data;
+
+  // Created along with the texture, and freed with it
+  BoundTexture *binding;
 public:
   Texture(unsigned int _width, unsigned int _height, unsigned int _channels,
     const unsigned char *_data);
 
+  // The data holds every level, one after the other
+  Texture(unsigned int _width, unsigned int _height, unsigned int _channels,
+    TextureFormat _format, uint32_t _levels, const unsigned char *_data);
+
   ~Texture();
 
+  // Forgets the pixels once they've been uploaded, for when their owner
+  // frees them. Binding the texture again after this uploads nothing.
+  void
+  release_data();
+
   unsigned int
   get_width() const;
 
@@ -47,8 +64,17 @@ public:
   unsigned int
   get_channels() const;
 
+  TextureFormat
+  get_format() const;
+
+  uint32_t
+  get_levels() const;
+
   const unsigned char *
   get_data() const;
+
+  BoundTexture *
+  get_binding() const;
 };
 
 class BoundTexture
@@ -70,6 +96,11 @@ public:
 
   virtual void
   set_filtering(Texture::Filtering _filtering) = 0;
+
+  // Replaces a rectangle of an uncompressed texture's first level
+  virtual void
+  update_region(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+    const unsigned char *pixels) = 0;
 };
 
 struct BoundMesh
@@ -104,6 +135,9 @@ class Camera
 public:
   Camera();
 
+  float
+  get_fovy() const;
+
   void
   set_fovy(float _fovy);
 
@@ -202,6 +236,15 @@ struct Render3DRequest
   Scene3D *scene;
 };
 
+// One glyph of a run of text, drawn as an instance of a quad
+struct GlyphInstance
+{
+  Vec2 origin;
+  Vec2 size;
+  Vec4 uv_rect;
+  Vec4 color;
+};
+
 class GraphicsLayer
 {
 public:
@@ -226,14 +269,19 @@ public:
   virtual void
   begin_render() = 0;
 
+  // Everything drawn since begin_render has reached the GPU after this
+  virtual void
+  end_render() = 0;
+
   virtual void
   draw_color_rect(Vec2 origin, Vec2 size, Vec4 color) = 0;
 
   virtual void
   draw_texture_rect(Vec2 origin, Vec2 size, const BoundTexture &texture) = 0;
 
+  // Every glyph in a run is drawn from the same texture
   virtual void
-  draw_character(Vec2 origin, Vec2 size, Vec4 color,
+  draw_glyph_run(const std::vector<GlyphInstance> &glyphs,
     const BoundTexture &sdf) = 0;
 
   // TODO: When it's needed, make a more robust API for masking
@@ -281,6 +329,13 @@ class GraphicsServer
   BoundMesh *quad;
 
   Screen *current_screen;
+
+  // Kept between draws so that drawing text doesn't allocate
+  std::vector<GlyphInstance> glyph_run;
+  std::vector<std::pair<const BoundTexture *, GlyphInstance>> glyph_leftovers;
+
+  void
+  draw_text_request(TextLayout &layout, const TextRenderRequest &text_request);
 public:
   GraphicsServer();
 
@@ -334,12 +389,18 @@ public:
   void
   draw_texture_rect(Vec2 origin, Vec2 size, const BoundTexture &texture);
 
+  /* These lay the text out again on every call. Text drawn every frame
+     should keep a TextLayout and draw that instead. */
   void
   draw_text_line(const TextRenderRequest &text_request);
 
   void
   draw_text(const TextRenderRequest &text_request);
 
+  // Draws a layout with the bottom left of its box at origin
+  void
+  draw_text_layout(TextLayout &layout, Vec2 origin, Vec4 color);
+
   void
   clear_stencil_buffer();
 
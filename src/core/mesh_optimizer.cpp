@@ -0,0 +1,786 @@
+#include "core/mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+VertexCacheStats
+analyze_vertex_cache(const IndexVector &indices, size_t vertex_count,
+  unsigned int cache_size)
+{
+  VertexCacheStats stats = {};
+  if (indices.size() < 3 || vertex_count == 0)
+    return stats;
+
+  // A vertex is in the cache if fewer than cache_size misses have happened
+  // since it was loaded
+  std::vector<uint64_t> loaded_at = std::vector<uint64_t>(vertex_count, 0);
+  std::vector<bool> used = std::vector<bool>(vertex_count, false);
+  uint64_t misses = 0;
+  for (unsigned int index : indices)
+  {
+    used[index] = true;
+    if (loaded_at[index] == 0 || misses + 1 - loaded_at[index] >= cache_size)
+    {
+      misses += 1;
+      loaded_at[index] = misses;
+    }
+  }
+
+  size_t used_count = std::count(used.begin(), used.end(), true);
+  stats.acmr = float(misses) / float(indices.size() / 3);
+  stats.atvr = float(misses) / float(used_count);
+  return stats;
+}
+
+namespace
+{
+
+struct VertexKey
+{
+  const Vertex *vertex;
+
+  bool
+  operator == (const VertexKey &other) const
+  {
+    return memcmp(vertex, other.vertex, sizeof(Vertex)) == 0;
+  }
+};
+
+struct VertexKeyHash
+{
+  size_t
+  operator () (const VertexKey &key) const
+  {
+    // 64-bit FNV-1a over the bytes, so that only exact copies are merged
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(key.vertex);
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < sizeof(Vertex); ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3;
+    }
+    return size_t(hash);
+  }
+};
+
+// Tuning from Forsyth's article
+const unsigned int forsyth_cache_size = 32;
+const float forsyth_cache_decay_power = 1.5f;
+const float forsyth_last_triangle_score = 0.75f;
+const float forsyth_valence_boost_scale = 2.0f;
+const float forsyth_valence_boost_power = 0.5f;
+
+float
+forsyth_vertex_score(int cache_position, uint32_t remaining)
+{
+  // Nothing left to draw with this vertex
+  if (remaining == 0)
+    return -1.0f;
+
+  float score = 0.0f;
+  if (cache_position >= 0)
+  {
+    // The last triangle's vertices get a fixed score, so that the next
+    // triangle doesn't simply continue a strip
+    if (cache_position < 3)
+    {
+      score = forsyth_last_triangle_score;
+    }
+    else
+    {
+      float scaler = 1.0f / float(forsyth_cache_size - 3);
+      score = std::pow(1.0f - (float(cache_position - 3) * scaler),
+        forsyth_cache_decay_power);
+    }
+  }
+
+  // Vertices with few triangles left are finished off, so they don't end up
+  // as lone triangles later
+  score += forsyth_valence_boost_scale
+    * std::pow(float(remaining), -forsyth_valence_boost_power);
+  return score;
+}
+
+/* Squared distance to a set of planes, where each plane's weight is the area
+   of the triangle it came from */
+struct Quadric
+{
+  double a2, b2, c2, ab, ac, bc, ad, bd, cd, d2;
+  double weight;
+};
+
+Quadric
+plane_quadric(const Vec3 &normal, float d, double weight)
+{
+  Quadric q = Quadric();
+  q.a2 = weight * normal.x * normal.x;
+  q.b2 = weight * normal.y * normal.y;
+  q.c2 = weight * normal.z * normal.z;
+  q.ab = weight * normal.x * normal.y;
+  q.ac = weight * normal.x * normal.z;
+  q.bc = weight * normal.y * normal.z;
+  q.ad = weight * normal.x * d;
+  q.bd = weight * normal.y * d;
+  q.cd = weight * normal.z * d;
+  q.d2 = weight * d * d;
+  q.weight = weight;
+  return q;
+}
+
+void
+add_quadric(Quadric &q, const Quadric &other)
+{
+  q.a2 += other.a2;
+  q.b2 += other.b2;
+  q.c2 += other.c2;
+  q.ab += other.ab;
+  q.ac += other.ac;
+  q.bc += other.bc;
+  q.ad += other.ad;
+  q.bd += other.bd;
+  q.cd += other.cd;
+  q.d2 += other.d2;
+  q.weight += other.weight;
+}
+
+// Average squared distance from the point to the planes
+double
+quadric_error(const Quadric &q, const Vec3 &p)
+{
+  if (q.weight <= 0.0)
+    return 0.0;
+  double x = p.x;
+  double y = p.y;
+  double z = p.z;
+  double error = (q.a2 * x * x) + (q.b2 * y * y) + (q.c2 * z * z)
+    + 2.0 * ((q.ab * x * y) + (q.ac * x * z) + (q.bc * y * z)
+      + (q.ad * x) + (q.bd * y) + (q.cd * z))
+    + q.d2;
+  return std::max(error, 0.0) / q.weight;
+}
+
+struct PositionHash
+{
+  size_t
+  operator () (const Vec3 &p) const
+  {
+    uint32_t bits[3];
+    memcpy(bits, &p, sizeof(bits));
+    return size_t((bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u));
+  }
+};
+
+struct PositionEqual
+{
+  bool
+  operator () (const Vec3 &a, const Vec3 &b) const
+  {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+};
+
+struct Collapse
+{
+  unsigned int from;
+  unsigned int to;
+  float cost;
+};
+
+// Each level halves the triangles, with an error limit that doubles from
+// this fraction of the mesh's radius
+const unsigned int lod_max_levels = 4;
+const float lod_error_limit = 0.01f;
+
+}
+
+void
+weld_vertices(VertexVector &vertices, IndexVector &indices)
+{
+  std::unordered_map<VertexKey, unsigned int, VertexKeyHash> unique;
+  unique.reserve(vertices.size());
+
+  VertexVector welded = VertexVector();
+  welded.reserve(vertices.size());
+  std::vector<unsigned int> remap = std::vector<unsigned int>(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i)
+  {
+    VertexKey key = {&vertices[i]};
+    auto found = unique.find(key);
+    if (found != unique.end())
+    {
+      remap[i] = found->second;
+      continue;
+    }
+
+    remap[i] = unsigned(welded.size());
+    unique[key] = remap[i];
+    welded.push_back(vertices[i]);
+  }
+
+  for (unsigned int &index : indices)
+    index = remap[index];
+  vertices = std::move(welded);
+}
+
+void
+optimize_vertex_cache(IndexVector &indices, size_t first, size_t count,
+  size_t vertex_count)
+{
+  size_t triangle_count = count / 3;
+  if (triangle_count < 2)
+    return;
+  const unsigned int *triangles = &indices[first];
+
+  // Triangles that still have to be drawn, listed per vertex
+  std::vector<uint32_t> remaining = std::vector<uint32_t>(vertex_count, 0);
+  for (size_t i = 0; i < triangle_count * 3; ++i)
+    remaining[triangles[i]] += 1;
+
+  std::vector<uint32_t> adjacency_offset = std::vector<uint32_t>(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; ++v)
+    adjacency_offset[v + 1] = adjacency_offset[v] + remaining[v];
+
+  std::vector<uint32_t> adjacency = std::vector<uint32_t>(triangle_count * 3);
+  {
+    std::vector<uint32_t> cursor = adjacency_offset;
+    for (size_t i = 0; i < triangle_count * 3; ++i)
+      adjacency[cursor[triangles[i]]++] = uint32_t(i / 3);
+  }
+
+  std::vector<int> cache_position = std::vector<int>(vertex_count, -1);
+  std::vector<float> vertex_score = std::vector<float>(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v)
+    vertex_score[v] = forsyth_vertex_score(-1, remaining[v]);
+
+  std::vector<float> triangle_score = std::vector<float>(triangle_count);
+  int64_t best = 0;
+  for (size_t t = 0; t < triangle_count; ++t)
+  {
+    triangle_score[t] = vertex_score[triangles[t * 3]]
+      + vertex_score[triangles[(t * 3) + 1]] + vertex_score[triangles[(t * 3) + 2]];
+    if (triangle_score[t] > triangle_score[best])
+      best = int64_t(t);
+  }
+
+  std::vector<bool> emitted = std::vector<bool>(triangle_count, false);
+  std::vector<unsigned int> cache = std::vector<unsigned int>();
+  std::vector<unsigned int> next_cache = std::vector<unsigned int>();
+  IndexVector output = IndexVector();
+  output.reserve(triangle_count * 3);
+  size_t next_unemitted = 0;
+
+  while (output.size() < triangle_count * 3)
+  {
+    // When nothing in the cache has triangles left, start again from the
+    // first triangle that hasn't been drawn yet
+    if (best < 0)
+    {
+      while (emitted[next_unemitted])
+        next_unemitted += 1;
+      best = int64_t(next_unemitted);
+    }
+
+    emitted[best] = true;
+    const unsigned int *triangle = &triangles[best * 3];
+    for (unsigned int corner = 0; corner < 3; ++corner)
+    {
+      unsigned int v = triangle[corner];
+      output.push_back(v);
+
+      uint32_t *list = &adjacency[adjacency_offset[v]];
+      for (uint32_t i = 0; i < remaining[v]; ++i)
+      {
+        if (list[i] == uint32_t(best))
+        {
+          std::swap(list[i], list[remaining[v] - 1]);
+          remaining[v] -= 1;
+          break;
+        }
+      }
+    }
+
+    // The triangle's vertices move to the front of the cache
+    next_cache.clear();
+    for (unsigned int corner = 0; corner < 3; ++corner)
+    {
+      if (std::find(next_cache.begin(), next_cache.end(), triangle[corner]) == next_cache.end())
+        next_cache.push_back(triangle[corner]);
+    }
+    for (unsigned int v : cache)
+    {
+      if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end())
+        next_cache.push_back(v);
+    }
+
+    // Rescore everything that moved or fell out of the cache
+    for (size_t i = 0; i < next_cache.size(); ++i)
+      cache_position[next_cache[i]] = (i < forsyth_cache_size) ? int(i) : -1;
+    for (unsigned int v : next_cache)
+    {
+      float score = forsyth_vertex_score(cache_position[v], remaining[v]);
+      float delta = score - vertex_score[v];
+      vertex_score[v] = score;
+      for (uint32_t i = 0; i < remaining[v]; ++i)
+        triangle_score[adjacency[adjacency_offset[v] + i]] += delta;
+    }
+    if (next_cache.size() > forsyth_cache_size)
+      next_cache.resize(forsyth_cache_size);
+    std::swap(cache, next_cache);
+
+    // Only triangles using a cached vertex are candidates for the next one
+    best = -1;
+    float best_score = -1.0f;
+    for (unsigned int v : cache)
+    {
+      for (uint32_t i = 0; i < remaining[v]; ++i)
+      {
+        uint32_t t = adjacency[adjacency_offset[v] + i];
+        if (triangle_score[t] > best_score)
+        {
+          best = int64_t(t);
+          best_score = triangle_score[t];
+        }
+      }
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices.begin() + first);
+}
+
+void
+optimize_overdraw(const VertexVector &vertices, IndexVector &indices,
+  size_t first, size_t count, float threshold)
+{
+  size_t triangle_count = count / 3;
+  if (triangle_count < 2)
+    return;
+
+  IndexVector original = IndexVector(indices.begin() + first,
+    indices.begin() + first + (triangle_count * 3));
+
+  // Clusters start wherever all three vertices of a triangle miss the cache,
+  // so moving them around costs little in cache efficiency
+  std::vector<size_t> cluster_starts = std::vector<size_t>();
+  {
+    const unsigned int cache_size = 16;
+    std::vector<uint64_t> loaded_at = std::vector<uint64_t>(vertices.size(), 0);
+    uint64_t misses = 0;
+    for (size_t t = 0; t < triangle_count; ++t)
+    {
+      unsigned int triangle_misses = 0;
+      for (unsigned int corner = 0; corner < 3; ++corner)
+      {
+        unsigned int v = original[(t * 3) + corner];
+        if (loaded_at[v] == 0 || misses + 1 - loaded_at[v] >= cache_size)
+        {
+          misses += 1;
+          loaded_at[v] = misses;
+          triangle_misses += 1;
+        }
+      }
+      if (t == 0 || triangle_misses == 3)
+        cluster_starts.push_back(t);
+    }
+  }
+  if (cluster_starts.size() < 2)
+    return;
+
+  Vec3 mesh_center = Vec3(0.0f);
+  for (unsigned int index : original)
+    mesh_center += vertices[index].position;
+  mesh_center = (1.0f / float(original.size())) * mesh_center;
+
+  // Clusters that are further out along the direction they face are more
+  // likely to cover the others, so they are drawn first
+  struct Cluster
+  {
+    size_t start;
+    size_t end;
+    float sort_key;
+  };
+  std::vector<Cluster> clusters = std::vector<Cluster>();
+  for (size_t i = 0; i < cluster_starts.size(); ++i)
+  {
+    Cluster cluster = {};
+    cluster.start = cluster_starts[i];
+    cluster.end = (i + 1 < cluster_starts.size()) ? cluster_starts[i + 1] : triangle_count;
+
+    Vec3 center = Vec3(0.0f);
+    Vec3 normal = Vec3(0.0f);
+    float area = 0.0f;
+    for (size_t t = cluster.start; t < cluster.end; ++t)
+    {
+      const Vec3 &a = vertices[original[t * 3]].position;
+      const Vec3 &b = vertices[original[(t * 3) + 1]].position;
+      const Vec3 &c = vertices[original[(t * 3) + 2]].position;
+      Vec3 n = (b - a).cross(c - a);
+      float triangle_area = n.norm();
+      center += (triangle_area / 3.0f) * (a + b + c);
+      normal += n;
+      area += triangle_area;
+    }
+    if (area > 0.0f)
+      center = (1.0f / area) * center;
+    if (normal.norm() > 0.0f)
+      normal = normal.normalized();
+    cluster.sort_key = (center - mesh_center) * normal;
+
+    clusters.push_back(cluster);
+  }
+
+  std::stable_sort(clusters.begin(), clusters.end(),
+    [](const Cluster &a, const Cluster &b) {
+      return a.sort_key > b.sort_key;
+    });
+
+  IndexVector sorted = IndexVector();
+  sorted.reserve(original.size());
+  for (const Cluster &cluster : clusters)
+    sorted.insert(sorted.end(), original.begin() + (cluster.start * 3),
+      original.begin() + (cluster.end * 3));
+
+  // Keep the cache order if this costs too many extra vertex transforms
+  VertexCacheStats before = analyze_vertex_cache(original, vertices.size());
+  VertexCacheStats after = analyze_vertex_cache(sorted, vertices.size());
+  if (after.acmr > before.acmr * threshold)
+    return;
+
+  std::copy(sorted.begin(), sorted.end(), indices.begin() + first);
+}
+
+void
+optimize_vertex_fetch(VertexVector &vertices, IndexVector &indices)
+{
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap = std::vector<unsigned int>(vertices.size(), unused);
+
+  VertexVector reordered = VertexVector();
+  reordered.reserve(vertices.size());
+  for (unsigned int &index : indices)
+  {
+    if (remap[index] == unused)
+    {
+      remap[index] = unsigned(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  vertices = std::move(reordered);
+}
+
+IndexVector
+simplify(const VertexVector &vertices, const IndexVector &indices, size_t first,
+  size_t count, size_t target_count, float max_error, float &error)
+{
+  IndexVector result = IndexVector(indices.begin() + first,
+    indices.begin() + first + ((count / 3) * 3));
+  error = 0.0f;
+  size_t vertex_count = vertices.size();
+
+  std::vector<Quadric> quadrics = std::vector<Quadric>(vertex_count, Quadric());
+  for (size_t t = 0; t < result.size() / 3; ++t)
+  {
+    const Vec3 &a = vertices[result[t * 3]].position;
+    const Vec3 &b = vertices[result[(t * 3) + 1]].position;
+    const Vec3 &c = vertices[result[(t * 3) + 2]].position;
+    Vec3 normal = (b - a).cross(c - a);
+    float area = normal.norm();
+    if (area <= 0.0f)
+      continue;
+    normal = (1.0f / area) * normal;
+
+    Quadric q = plane_quadric(normal, -(normal * a), 0.5 * area);
+    for (unsigned int corner = 0; corner < 3; ++corner)
+      add_quadric(quadrics[result[(t * 3) + corner]], q);
+  }
+
+  /* Vertices sharing a position with another are on a seam between normals
+     or texture coordinates, and moving only one of them would tear it. Edges
+     used by a single triangle are on a border, which would shrink. */
+  std::vector<bool> locked = std::vector<bool>(vertex_count, false);
+  {
+    std::unordered_map<Vec3, unsigned int, PositionHash, PositionEqual> positions;
+    std::vector<unsigned int> canonical = std::vector<unsigned int>(vertex_count);
+    std::vector<bool> seen = std::vector<bool>(vertex_count, false);
+    for (unsigned int v : result)
+    {
+      if (seen[v])
+        continue;
+      seen[v] = true;
+
+      auto found = positions.find(vertices[v].position);
+      if (found == positions.end())
+      {
+        positions[vertices[v].position] = v;
+        canonical[v] = v;
+      }
+      else
+      {
+        canonical[v] = found->second;
+        locked[v] = true;
+        locked[found->second] = true;
+      }
+    }
+
+    std::unordered_map<uint64_t, uint32_t> edges;
+    for (size_t t = 0; t < result.size() / 3; ++t)
+    {
+      for (unsigned int corner = 0; corner < 3; ++corner)
+      {
+        uint64_t a = canonical[result[(t * 3) + corner]];
+        uint64_t b = canonical[result[(t * 3) + ((corner + 1) % 3)]];
+        edges[(std::min(a, b) << 32) | std::max(a, b)] += 1;
+      }
+    }
+    for (const std::pair<const uint64_t, uint32_t> &edge : edges)
+    {
+      if (edge.second != 1)
+        continue;
+      locked[edge.first >> 32] = true;
+      locked[edge.first & 0xffffffff] = true;
+    }
+  }
+
+  double max_cost = double(max_error) * double(max_error);
+  std::vector<uint32_t> adjacency_offset = std::vector<uint32_t>(vertex_count + 1);
+  std::vector<uint32_t> adjacency = std::vector<uint32_t>();
+  std::vector<Collapse> collapses = std::vector<Collapse>();
+  std::vector<bool> touched = std::vector<bool>(vertex_count);
+  std::vector<unsigned int> remap = std::vector<unsigned int>(vertex_count);
+
+  // Each pass collapses as many edges as it can without them interfering
+  while (result.size() > target_count)
+  {
+    size_t triangle_count = result.size() / 3;
+
+    std::fill(adjacency_offset.begin(), adjacency_offset.end(), 0);
+    for (unsigned int v : result)
+      adjacency_offset[v + 1] += 1;
+    for (size_t v = 0; v < vertex_count; ++v)
+      adjacency_offset[v + 1] += adjacency_offset[v];
+    adjacency.resize(result.size());
+    {
+      std::vector<uint32_t> cursor = adjacency_offset;
+      for (size_t i = 0; i < result.size(); ++i)
+        adjacency[cursor[result[i]]++] = uint32_t(i / 3);
+    }
+
+    collapses.clear();
+    for (size_t t = 0; t < triangle_count; ++t)
+    {
+      for (unsigned int corner = 0; corner < 3; ++corner)
+      {
+        unsigned int a = result[(t * 3) + corner];
+        unsigned int b = result[(t * 3) + ((corner + 1) % 3)];
+        for (unsigned int direction = 0; direction < 2; ++direction)
+        {
+          unsigned int from = direction == 0 ? a : b;
+          unsigned int to = direction == 0 ? b : a;
+          if (locked[from])
+            continue;
+
+          Quadric q = quadrics[from];
+          add_quadric(q, quadrics[to]);
+          double cost = quadric_error(q, vertices[to].position);
+          if (cost <= max_cost)
+            collapses.push_back(Collapse{from, to, float(cost)});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+      [](const Collapse &a, const Collapse &b) {
+        return a.cost < b.cost;
+      });
+
+    std::fill(touched.begin(), touched.end(), false);
+    for (size_t v = 0; v < vertex_count; ++v)
+      remap[v] = unsigned(v);
+
+    size_t remaining = triangle_count;
+    size_t applied = 0;
+    for (const Collapse &collapse : collapses)
+    {
+      if (remaining * 3 <= target_count)
+        break;
+      if (touched[collapse.from] || touched[collapse.to])
+        continue;
+
+      // Moving the vertex mustn't flip or crush the triangles that stay
+      bool flips = false;
+      size_t removed = 0;
+      const Vec3 &to = vertices[collapse.to].position;
+      for (uint32_t i = adjacency_offset[collapse.from];
+        i < adjacency_offset[collapse.from + 1] && !flips; ++i)
+      {
+        const unsigned int *triangle = &result[adjacency[i] * 3];
+        if (triangle[0] == collapse.to || triangle[1] == collapse.to
+          || triangle[2] == collapse.to)
+        {
+          removed += 1;
+          continue;
+        }
+
+        Vec3 before[3];
+        Vec3 after[3];
+        for (unsigned int corner = 0; corner < 3; ++corner)
+        {
+          before[corner] = vertices[triangle[corner]].position;
+          after[corner] = (triangle[corner] == collapse.from) ? to : before[corner];
+        }
+        Vec3 n0 = (before[1] - before[0]).cross(before[2] - before[0]);
+        Vec3 n1 = (after[1] - after[0]).cross(after[2] - after[0]);
+        flips = (n0 * n1) <= 0.25f * n0.norm() * n1.norm();
+      }
+      if (flips)
+        continue;
+
+      remap[collapse.from] = collapse.to;
+      add_quadric(quadrics[collapse.to], quadrics[collapse.from]);
+      error = std::max(error, std::sqrt(collapse.cost));
+      remaining -= removed;
+      applied += 1;
+
+      // The neighbours' triangles are about to change, so leave them alone
+      touched[collapse.from] = true;
+      touched[collapse.to] = true;
+      for (uint32_t i = adjacency_offset[collapse.from];
+        i < adjacency_offset[collapse.from + 1]; ++i)
+      {
+        const unsigned int *triangle = &result[adjacency[i] * 3];
+        for (unsigned int corner = 0; corner < 3; ++corner)
+          touched[triangle[corner]] = true;
+      }
+    }
+    if (applied == 0)
+      break;
+
+    size_t write = 0;
+    for (size_t t = 0; t < triangle_count; ++t)
+    {
+      unsigned int a = remap[result[t * 3]];
+      unsigned int b = remap[result[(t * 3) + 1]];
+      unsigned int c = remap[result[(t * 3) + 2]];
+      if (a == b || b == c || a == c)
+        continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+
+  return result;
+}
+
+void
+generate_lods(Mesh &mesh)
+{
+  if (mesh.is_packed() || mesh.indices.size() < 3)
+    return;
+
+  // Levels need ranges to copy, even when the mesh is drawn all at once
+  if (mesh.materials.size() == 0)
+  {
+    MaterialData whole = MaterialData();
+    whole.diffuse_color = Vec3(1);
+    whole.index_count = uint32_t(mesh.indices.size());
+    mesh.materials.push_back(whole);
+  }
+
+  Vec3 low = mesh.vertices[0].position;
+  Vec3 high = low;
+  for (const Vertex &vertex : mesh.vertices)
+  {
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+      low[axis] = std::min(low[axis], vertex.position[axis]);
+      high[axis] = std::max(high[axis], vertex.position[axis]);
+    }
+  }
+  float radius = 0.5f * (high - low).norm();
+
+  // Each level is simplified from the one before, so the errors add up
+  std::vector<MaterialData> source = mesh.materials;
+  size_t source_count = 0;
+  for (const MaterialData &range : source)
+    source_count += range.index_count;
+
+  float error = 0.0f;
+  for (unsigned int level = 0; level < lod_max_levels; ++level)
+  {
+    size_t level_start = mesh.indices.size();
+    float max_error = radius * lod_error_limit * float(1 << level);
+
+    LodData lod = LodData();
+    float level_error = 0.0f;
+    size_t level_count = 0;
+    for (const MaterialData &range : source)
+    {
+      float range_error = 0.0f;
+      IndexVector simplified = simplify(mesh.vertices, mesh.indices,
+        range.first_index, range.index_count, ((range.index_count / 6) * 3),
+        max_error, range_error);
+
+      MaterialData lod_range = range;
+      lod_range.first_index = uint32_t(mesh.indices.size());
+      lod_range.index_count = uint32_t(simplified.size());
+      mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+      optimize_vertex_cache(mesh.indices, lod_range.first_index,
+        lod_range.index_count, mesh.vertices.size());
+
+      lod.materials.push_back(lod_range);
+      level_error = std::max(level_error, range_error);
+      level_count += simplified.size();
+    }
+
+    // A level that barely removes anything isn't worth storing
+    if (level_count * 5 > source_count * 4)
+    {
+      mesh.indices.resize(level_start);
+      break;
+    }
+
+    error += level_error;
+    lod.error = error;
+    mesh.lods.push_back(lod);
+    source = lod.materials;
+    source_count = level_count;
+  }
+}
+
+std::pair<VertexCacheStats, VertexCacheStats>
+optimize_mesh(Mesh &mesh)
+{
+  std::pair<VertexCacheStats, VertexCacheStats> stats;
+  stats.first = analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+
+  weld_vertices(mesh.vertices, mesh.indices);
+
+  // Each material is drawn from its own range of indices
+  std::vector<std::pair<size_t, size_t>> ranges;
+  if (mesh.materials.size() == 0)
+  {
+    ranges.push_back(std::make_pair(size_t(0), mesh.indices.size()));
+  }
+  else
+  {
+    for (const MaterialData &material : mesh.materials)
+      ranges.push_back(std::make_pair(size_t(material.first_index),
+        size_t(material.index_count)));
+  }
+
+  for (const std::pair<size_t, size_t> &range : ranges)
+  {
+    optimize_vertex_cache(mesh.indices, range.first, range.second,
+      mesh.vertices.size());
+    optimize_overdraw(mesh.vertices, mesh.indices, range.first, range.second);
+  }
+
+  optimize_vertex_fetch(mesh.vertices, mesh.indices);
+
+  stats.second = analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+  return stats;
+}
@@ -0,0 +1,68 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "core/resource.h"
+
+/* Passes run on imported meshes so that they draw faster. Triangles are only
+   ever reordered within a range of indices, so that the ranges drawn with
+   each material stay intact. */
+
+struct VertexCacheStats
+{
+  // Average cache miss ratio: vertices transformed per triangle, between 0.5
+  // for a large regular grid and 3 when nothing is reused
+  float acmr;
+
+  // Average transform to vertex ratio: vertices transformed per vertex used,
+  // 1 at best
+  float atvr;
+};
+
+// Simulates a FIFO post-transform cache of the given size
+VertexCacheStats
+analyze_vertex_cache(const IndexVector &indices, size_t vertex_count,
+  unsigned int cache_size = 16);
+
+// Merges vertices that are exactly the same
+void
+weld_vertices(VertexVector &vertices, IndexVector &indices);
+
+// Reorders the triangles in the range so that they reuse recently transformed
+// vertices, using Tom Forsyth's linear-speed vertex cache optimization
+void
+optimize_vertex_cache(IndexVector &indices, size_t first, size_t count,
+  size_t vertex_count);
+
+/* Splits the triangles in the range into clusters wherever the cache order
+   starts over, and draws the clusters facing away from the center of the
+   mesh first, since they tend to cover the rest. The threshold limits how
+   much worse than the cache optimized order the result may get. */
+void
+optimize_overdraw(const VertexVector &vertices, IndexVector &indices,
+  size_t first, size_t count, float threshold = 1.05f);
+
+// Reorders the vertices by first use, and drops any that aren't used
+void
+optimize_vertex_fetch(VertexVector &vertices, IndexVector &indices);
+
+/* Collapses edges between the range's triangles, moving vertices onto one of
+   their neighbours so that no new vertices are needed. Stops once the range
+   is down to target_count indices, or when every collapse left would move
+   the surface further than max_error. Vertices on borders and attribute
+   seams never move. Returns the new triangles, and sets error to how far the
+   surface moved. */
+IndexVector
+simplify(const VertexVector &vertices, const IndexVector &indices, size_t first,
+  size_t count, size_t target_count, float max_error, float &error);
+
+// Appends simplified levels to the mesh, each with about half the triangles
+// of the one before, for as long as that stays within the error limits
+void
+generate_lods(Mesh &mesh);
+
+// Runs every pass on the mesh, which can't be packed yet. Returns the cache
+// statistics from before and after.
+std::pair<VertexCacheStats, VertexCacheStats>
+optimize_mesh(Mesh &mesh);
+
+#endif
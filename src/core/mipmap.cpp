@@ -0,0 +1,306 @@
+#include "core/mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+namespace
+{
+
+/* Images are filtered as one plane of floats per channel, so that the inner
+   loops run over contiguous rows the compiler can vectorize. */
+struct Plane
+{
+  uint32_t width;
+  uint32_t height;
+  std::vector<float> values;
+};
+
+float
+srgb_to_linear(float x)
+{
+  if (x <= 0.04045f)
+    return x / 12.92f;
+  return std::pow((x + 0.055f) / 1.055f, 2.4f);
+}
+
+float
+linear_to_srgb(float x)
+{
+  if (x <= 0.0031308f)
+    return x * 12.92f;
+  return (1.055f * std::pow(x, 1.0f / 2.4f)) - 0.055f;
+}
+
+// Modified Bessel function of the first kind, for the Kaiser window
+double
+bessel_i0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; ++k)
+  {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+const double kaiser_alpha = 4.0;
+const double kaiser_radius = 2.0; // in destination pixels
+
+struct Tap
+{
+  uint32_t source;
+  float weight;
+};
+
+/* The source pixels and weights making up each destination pixel along one
+   axis, with the edges clamped */
+std::vector<std::vector<Tap>>
+get_taps(uint32_t source_size, uint32_t destination_size, MipmapFilter filter)
+{
+  std::vector<std::vector<Tap>> taps = std::vector<std::vector<Tap>>(destination_size);
+  double scale = double(source_size) / double(destination_size);
+
+  for (uint32_t x = 0; x < destination_size; ++x)
+  {
+    if (filter == MipmapFilterBox)
+    {
+      uint32_t first = std::min(uint32_t(double(x) * scale), source_size - 1);
+      uint32_t last = std::min(uint32_t(double(x + 1) * scale), source_size);
+      last = std::max(last, first + 1);
+      for (uint32_t i = first; i < last; ++i)
+        taps[x].push_back(Tap{i, 1.0f / float(last - first)});
+      continue;
+    }
+
+    double center = ((double(x) + 0.5) * scale) - 0.5;
+    double support = kaiser_radius * scale;
+    int first = int(std::floor(center - support));
+    int last = int(std::ceil(center + support));
+    double total = 0.0;
+    for (int i = first; i <= last; ++i)
+    {
+      double d = (double(i) - center) / scale;
+      double t = d / kaiser_radius;
+      if (std::abs(t) >= 1.0)
+        continue;
+      double sinc = (d == 0.0) ? 1.0 : std::sin(std::numbers::pi * d) / (std::numbers::pi * d);
+      double window = bessel_i0(kaiser_alpha * std::sqrt(1.0 - (t * t)))
+        / bessel_i0(kaiser_alpha);
+      double weight = sinc * window;
+      uint32_t source = uint32_t(std::clamp(i, 0, int(source_size) - 1));
+      taps[x].push_back(Tap{source, float(weight)});
+      total += weight;
+    }
+    for (Tap &tap : taps[x])
+      tap.weight = float(tap.weight / total);
+  }
+  return taps;
+}
+
+Plane
+downsample(const Plane &source, uint32_t width, uint32_t height,
+  const std::vector<std::vector<Tap>> &horizontal,
+  const std::vector<std::vector<Tap>> &vertical)
+{
+  // Horizontal pass into a plane that is already narrow
+  Plane narrow = Plane();
+  narrow.width = width;
+  narrow.height = source.height;
+  narrow.values = std::vector<float>(size_t(width) * source.height, 0.0f);
+  for (uint32_t y = 0; y < source.height; ++y)
+  {
+    const float *in = &source.values[size_t(y) * source.width];
+    float *out = &narrow.values[size_t(y) * width];
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      float sum = 0.0f;
+      for (const Tap &tap : horizontal[x])
+        sum += in[tap.source] * tap.weight;
+      out[x] = sum;
+    }
+  }
+
+  // The vertical pass adds up whole rows at a time
+  Plane result = Plane();
+  result.width = width;
+  result.height = height;
+  result.values = std::vector<float>(size_t(width) * height, 0.0f);
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    float *out = &result.values[size_t(y) * width];
+    for (const Tap &tap : vertical[y])
+    {
+      const float *in = &narrow.values[size_t(tap.source) * width];
+      float weight = tap.weight;
+      for (uint32_t x = 0; x < width; ++x)
+        out[x] += in[x] * weight;
+    }
+  }
+
+  return result;
+}
+
+float
+get_alpha_coverage(const std::vector<float> &alpha, float scale, float threshold)
+{
+  size_t covered = 0;
+  for (float a : alpha)
+  {
+    if (a * scale >= threshold)
+      covered += 1;
+  }
+  return float(covered) / float(std::max(alpha.size(), size_t(1)));
+}
+
+// Finds how much to scale the alpha by to get the target coverage back
+float
+find_alpha_scale(const std::vector<float> &alpha, float threshold, float target)
+{
+  float low = 0.0f;
+  float high = 4.0f;
+  for (int i = 0; i < 16; ++i)
+  {
+    float middle = 0.5f * (low + high);
+    if (get_alpha_coverage(alpha, middle, threshold) < target)
+      low = middle;
+    else
+      high = middle;
+  }
+  return high;
+}
+
+}
+
+uint32_t
+get_mip_level_count(uint32_t width, uint32_t height)
+{
+  uint32_t levels = 1;
+  uint32_t size = std::max(width, height);
+  while (size > 1)
+  {
+    size >>= 1;
+    levels += 1;
+  }
+  return levels;
+}
+
+uint32_t
+get_mip_level_size(uint32_t size, uint32_t level)
+{
+  return std::max(size >> level, uint32_t(1));
+}
+
+std::vector<unsigned char>
+generate_mipmaps(const unsigned char *pixels, uint32_t width, uint32_t height,
+  uint32_t channels, const MipmapOptions &options)
+{
+  uint32_t levels = get_mip_level_count(width, height);
+  size_t total_size = 0;
+  for (uint32_t level = 0; level < levels; ++level)
+    total_size += size_t(get_mip_level_size(width, level))
+      * get_mip_level_size(height, level) * channels;
+
+  std::vector<unsigned char> result = std::vector<unsigned char>(total_size);
+  if (width == 0 || height == 0 || channels == 0)
+    return result;
+  memcpy(result.data(), pixels, size_t(width) * height * channels);
+
+  // Grey and alpha images have one color channel, RGBA three
+  bool has_alpha = (channels == 2 || channels == 4);
+  uint32_t color_channels = (channels >= 3) ? 3 : 1;
+  uint32_t alpha_channel = channels - 1;
+
+  float to_linear[256];
+  for (int i = 0; i < 256; ++i)
+    to_linear[i] = options.srgb ? srgb_to_linear(float(i) / 255.0f) : float(i) / 255.0f;
+
+  /* Colors are premultiplied by alpha while filtering, so that transparent
+     pixels don't bleed their color into the ones next to them */
+  std::vector<Plane> planes = std::vector<Plane>(channels);
+  for (uint32_t c = 0; c < channels; ++c)
+  {
+    planes[c].width = width;
+    planes[c].height = height;
+    planes[c].values.resize(size_t(width) * height);
+    for (size_t i = 0; i < size_t(width) * height; ++i)
+    {
+      unsigned char value = pixels[(i * channels) + c];
+      bool is_color = c < color_channels;
+      planes[c].values[i] = is_color ? to_linear[value] : float(value) / 255.0f;
+    }
+  }
+  if (has_alpha)
+  {
+    for (uint32_t c = 0; c < color_channels; ++c)
+    {
+      for (size_t i = 0; i < planes[c].values.size(); ++i)
+        planes[c].values[i] *= planes[alpha_channel].values[i];
+    }
+  }
+
+  bool preserve_coverage = has_alpha && options.alpha_coverage_threshold > 0.0f;
+  float target_coverage = 0.0f;
+  if (preserve_coverage)
+    target_coverage = get_alpha_coverage(planes[alpha_channel].values, 1.0f,
+      options.alpha_coverage_threshold);
+
+  size_t offset = size_t(width) * height * channels;
+  for (uint32_t level = 1; level < levels; ++level)
+  {
+    uint32_t level_width = get_mip_level_size(width, level);
+    uint32_t level_height = get_mip_level_size(height, level);
+
+    // Each level is filtered from the one before, at full precision
+    std::vector<std::vector<Tap>> horizontal = get_taps(planes[0].width,
+      level_width, options.filter);
+    std::vector<std::vector<Tap>> vertical = get_taps(planes[0].height,
+      level_height, options.filter);
+    for (uint32_t c = 0; c < channels; ++c)
+      planes[c] = downsample(planes[c], level_width, level_height, horizontal,
+        vertical);
+
+    size_t count = size_t(level_width) * level_height;
+    std::vector<float> alpha = std::vector<float>();
+    float alpha_scale = 1.0f;
+    if (has_alpha)
+    {
+      alpha = planes[alpha_channel].values;
+      for (float &a : alpha)
+        a = std::clamp(a, 0.0f, 1.0f);
+      if (preserve_coverage)
+        alpha_scale = find_alpha_scale(alpha, options.alpha_coverage_threshold,
+          target_coverage);
+    }
+
+    unsigned char *out = &result[offset];
+    for (size_t i = 0; i < count; ++i)
+    {
+      for (uint32_t c = 0; c < channels; ++c)
+      {
+        float value = planes[c].values[i];
+        if (c < color_channels)
+        {
+          if (has_alpha)
+            value = (alpha[i] > 0.0f) ? value / alpha[i] : 0.0f;
+          value = std::clamp(value, 0.0f, 1.0f);
+          if (options.srgb)
+            value = linear_to_srgb(value);
+        }
+        else if (has_alpha && c == alpha_channel)
+        {
+          value = std::min(alpha[i] * alpha_scale, 1.0f);
+        }
+        out[(i * channels) + c] = (unsigned char)std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f);
+      }
+    }
+    offset += count * channels;
+  }
+
+  return result;
+}
@@ -0,0 +1,38 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <cstdint>
+#include <vector>
+
+enum MipmapFilter
+{
+  MipmapFilterBox = 0, // averages 2x2 pixels, fast but slightly blurry
+  MipmapFilterKaiser = 1 // Kaiser windowed sinc, keeps small levels sharper
+};
+
+struct MipmapOptions
+{
+  MipmapFilter filter;
+
+  // Filters color channels in linear light rather than as stored
+  bool srgb;
+
+  /* Scales each level's alpha so that as many pixels pass an alpha test at
+     this threshold as in the full image, which stops cutout icons from
+     fading away as they shrink. 0 leaves alpha alone. */
+  float alpha_coverage_threshold;
+};
+
+// Levels down to 1x1, each half the size of the one before, rounding down
+uint32_t
+get_mip_level_count(uint32_t width, uint32_t height);
+
+uint32_t
+get_mip_level_size(uint32_t size, uint32_t level);
+
+// Returns every level one after the other, starting with a copy of the image
+std::vector<unsigned char>
+generate_mipmaps(const unsigned char *pixels, uint32_t width, uint32_t height,
+  uint32_t channels, const MipmapOptions &options);
+
+#endif
@@ -1,7 +1,11 @@
 #include "core/resource.h"
+#include "core/util.h"
+#include "core/worker_pool.h"
+#include "core/compression.h"
 
 #ifdef GAME
 #include "core/graphics.h"
+#include "core/audio.h"
 #endif
 
 #include <ogg/ogg.h>
@@ -10,12 +14,15 @@
 #include <sstream>
 #include <bit>
 #include <cstring>
+#include <algorithm>
 #include "picosha2.h"
 
 #ifdef RESOURCE_IMPORTER
+#include "core/mesh_optimizer.h"
 #include "AudioFile.h"
 #include <samplerate.h>
 #include <algorithm>
+#include <filesystem>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -94,14 +101,55 @@ nbo_to_host(const int32_t &x)
   }
 }
 
+uint64_t
+host_to_nbo(const uint64_t &x)
+{
+  if constexpr (std::endian::native == std::endian::big)
+  {
+    return x;
+  }
+  else if constexpr (std::endian::native == std::endian::little)
+  {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&x);
+    uint64_t result = 0;
+    for (unsigned int i = 0; i < 8; ++i)
+      result = (result << 8) | bytes[i];
+    return result;
+  }
+}
+
+uint64_t
+nbo_to_host(const uint64_t &x)
+{
+  return host_to_nbo(x);
+}
+
 Resource::~Resource()
 {
 
 }
 
+size_t
+Resource::get_cpu_size() const
+{
+  return 0;
+}
+
+size_t
+Resource::get_gpu_size() const
+{
+  return 0;
+}
+
+void
+Resource::release_cpu_data()
+{
+
+}
+
 #ifdef RESOURCE_IMPORTER
 Image::Image(std::string path) :
-  stb_allocated(true)
+  format(TextureFormatRaw), levels(1), storage(StbAllocated)
 {
   {
     // TODO: handle errors
@@ -116,24 +164,47 @@ Image::Image(std::string path) :
 }
 #endif
 
+Image::Image() :
+#ifdef GAME
+  width(0), height(0), channels(0), format(TextureFormatRaw), levels(1),
+  data(nullptr), storage(Owned), texture(nullptr)
+#else
+  width(0), height(0), channels(0), format(TextureFormatRaw), levels(1),
+  data(nullptr), storage(Owned)
+#endif
+{
+
+}
+
 Image::Image(uint32_t _width, uint32_t _height, uint32_t _channels,
   const unsigned char *_data) :
+  Image(_width, _height, _channels, TextureFormatRaw, 1, _data)
+{
+
+}
+
+Image::Image(uint32_t _width, uint32_t _height, uint32_t _channels,
+  TextureFormat _format, uint32_t _levels, const unsigned char *_data) :
 #ifdef GAME
-  width(_width), height(_height), channels(_channels), stb_allocated(false),
-  texture(nullptr)
+  width(_width), height(_height), channels(_channels), format(_format),
+  levels(_levels), storage(Owned), texture(nullptr)
 #else
-  width(_width), height(_height), channels(_channels), stb_allocated(false)
+  width(_width), height(_height), channels(_channels), format(_format),
+  levels(_levels), storage(Owned)
 #endif
 {
-  data = new unsigned char[width * height * channels];
-  memcpy(data, _data, sizeof(unsigned char) * width * height * channels);
+  size_t size = get_data_size();
+  unsigned char *copy = new unsigned char[size];
+  if (_data != nullptr)
+    memcpy(copy, _data, sizeof(unsigned char) * size);
+  data = copy;
 }
 
 Image::~Image()
 {
-  if (stb_allocated)
-    stbi_image_free(data);
-  else
+  if (storage == StbAllocated)
+    stbi_image_free(const_cast<unsigned char *>(data));
+  else if (storage == Owned)
     delete[] data;
 #ifdef GAME
   if (texture != nullptr)
@@ -141,10 +212,16 @@ Image::~Image()
 #endif
 }
 
+size_t
+Image::get_data_size() const
+{
+  return get_texture_data_size(format, width, height, channels, levels);
+}
+
 Resource *
 Image::duplicate() const
 {
-  return new Image(width, height, channels, data);
+  return new Image(width, height, channels, format, levels, data);
 }
 
 std::string
@@ -153,12 +230,138 @@ Image::get_type() const
   return "image";
 }
 
+size_t
+Image::get_cpu_size() const
+{
+  if (data == nullptr || storage == Borrowed)
+    return 0;
+  return get_data_size();
+}
+
+size_t
+Image::get_gpu_size() const
+{
+#ifdef GAME
+  /* Images that bring their own mipmaps or are compressed are uploaded as
+     they are, while generated mipmaps add another third to the others */
+  if (texture != nullptr && (levels > 1 || is_compressed_format(format)))
+    return get_data_size();
+  if (texture != nullptr)
+    return (size_t(width) * height * channels * 4) / 3;
+#endif
+  return 0;
+}
+
+void
+Image::release_cpu_data()
+{
+#ifdef GAME
+  if (texture == nullptr || data == nullptr)
+    return;
+
+  if (storage == StbAllocated)
+    stbi_image_free(const_cast<unsigned char *>(data));
+  else if (storage == Owned)
+    delete[] data;
+  data = nullptr;
+  storage = Owned;
+  texture->release_data();
+#endif
+}
+
+uint32_t
+Image::get_channels() const
+{
+  return channels;
+}
+
+TextureFormat
+Image::get_format() const
+{
+  return format;
+}
+
+uint32_t
+Image::get_levels() const
+{
+  return levels;
+}
+
+#ifdef RESOURCE_IMPORTER
+void
+Image::generate_mipmaps(const MipmapOptions &options)
+{
+  if (format != TextureFormatRaw || levels > 1 || data == nullptr)
+    return;
+
+  std::vector<unsigned char> chain = ::generate_mipmaps(data, width, height,
+    channels, options);
+
+  if (storage == StbAllocated)
+    stbi_image_free(const_cast<unsigned char *>(data));
+  else if (storage == Owned)
+    delete[] data;
+
+  unsigned char *copy = new unsigned char[chain.size()];
+  memcpy(copy, chain.data(), chain.size());
+  data = copy;
+  storage = Owned;
+  levels = get_mip_level_count(width, height);
+}
+
+float
+Image::compress(TextureFormat _format, TextureQuality quality)
+{
+  if (format != TextureFormatRaw || !is_compressed_format(_format) || data == nullptr)
+    return 0.0f;
+
+  // Every level is compressed on its own, and only the first is compared
+  size_t compressed_size = get_texture_data_size(_format, width, height,
+    channels, levels);
+  unsigned char *blocks = new unsigned char[compressed_size];
+  float psnr = 0.0f;
+  for (uint32_t level = 0; level < levels; ++level)
+  {
+    uint32_t level_width = get_mip_level_size(width, level);
+    uint32_t level_height = get_mip_level_size(height, level);
+    const unsigned char *pixels = &data[get_texture_data_size(format, width,
+      height, channels, level)];
+
+    std::vector<unsigned char> level_blocks = compress_texture(pixels,
+      level_width, level_height, channels, _format, quality);
+    memcpy(&blocks[get_texture_data_size(_format, width, height, channels, level)],
+      level_blocks.data(), level_blocks.size());
+
+    if (level == 0)
+    {
+      // Decode the blocks again to see how close they came
+      std::vector<unsigned char> decoded = std::vector<unsigned char>(
+        size_t(width) * height * channels);
+      decompress_texture(level_blocks.data(), _format, width, height, channels,
+        decoded.data());
+      psnr = compute_psnr(pixels, decoded.data(), width, height, channels);
+    }
+  }
+
+  if (storage == StbAllocated)
+    stbi_image_free(const_cast<unsigned char *>(data));
+  else if (storage == Owned)
+    delete[] data;
+
+  data = blocks;
+  storage = Owned;
+  format = _format;
+
+  return psnr;
+}
+#endif
+
 #ifdef GAME
 void
 Image::generate_texture()
 {
   if (texture == nullptr)
-    texture = new Texture(width, height, channels, data);
+    texture = new Texture(width, height, channels, format, levels, data);
 }
 
 const Texture *
@@ -168,10 +371,36 @@ Image::get_texture()
 }
 #endif
 
+namespace
+{
+
+/* Images with mipmaps or compressed pixels start with this marker, which is
+   far wider than any image stored without one. It is followed by the width,
+   height, channels, format and number of levels, then every level in turn.
+   Compressed images briefly had a 'BCN1' marker and no level count. */
+const uint32_t image_marker = 0x494d4732; // 'IMG2'
+const uint32_t image_header_size = 6 * 4;
+const uint32_t compressed_image_marker = 0x42434e31; // 'BCN1'
+const uint32_t compressed_image_header_size = 5 * 4;
+
+}
+
 Image *
 Image::from_data(const char *data, uint32_t length)
 {
   uint32_t width_nbo = *reinterpret_cast<const uint32_t *>(&data[0]);
+  uint32_t marker = nbo_to_host(width_nbo);
+  if (marker == image_marker || marker == compressed_image_marker)
+  {
+    Image *view = view_data(data, length);
+    if (view == nullptr)
+      return nullptr;
+    Image *img = new Image(view->width, view->height, view->channels,
+      view->format, view->levels, view->data);
+    delete view;
+    return img;
+  }
+
   uint32_t height_nbo = *reinterpret_cast<const uint32_t *>(&data[4]);
   uint32_t channels_nbo = *reinterpret_cast<const uint32_t *>(&data[8]);
   const unsigned char *img_data =
@@ -180,10 +409,62 @@ Image::from_data(const char *data, uint32_t length)
     nbo_to_host(channels_nbo), img_data);
 }
 
+Image *
+Image::view_data(const char *data, uint32_t length)
+{
+  if (length < 12)
+    return nullptr;
+
+  uint32_t marker = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
+  uint32_t offset = 0;
+  uint32_t header_size = 12;
+  if (marker == image_marker || marker == compressed_image_marker)
+  {
+    offset = 4;
+    header_size = compressed_image_header_size;
+  }
+  if (marker == image_marker)
+    header_size = image_header_size;
+  if (length < header_size)
+    return nullptr;
+
+  Image *img = new Image();
+  if (marker == image_marker || marker == compressed_image_marker)
+  {
+    img->format = TextureFormat(nbo_to_host(
+      *reinterpret_cast<const uint32_t *>(&data[16])));
+  }
+  if (marker == image_marker)
+    img->levels = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[20]));
+  img->width = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[offset]));
+  img->height = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[offset + 4]));
+  img->channels = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[offset + 8]));
+  img->data = reinterpret_cast<const unsigned char *>(&data[header_size]);
+  img->storage = Borrowed;
+
+  // The header is not to be trusted until the pixels are known to fit
+  if (img->levels == 0 || img->levels > 32
+      || img->get_data_size() > length - header_size)
+  {
+    delete img;
+    return nullptr;
+  }
+  return img;
+}
+
 #ifdef RESOURCE_IMPORTER
 uint32_t
 Image::append_to(std::ostream &out) const
 {
+  // Plain images keep the original layout
+  bool extended = is_compressed_format(format) || levels > 1;
+  uint32_t header_size = 4 + 4 + 4;
+  if (extended)
+  {
+    uint32_t marker_nbo = host_to_nbo(image_marker);
+    out.write(reinterpret_cast<const char *>(&marker_nbo), sizeof(marker_nbo));
+    header_size = image_header_size;
+  }
   {
     uint32_t width_nbo = host_to_nbo(width);
     out.write(reinterpret_cast<const char *>(&width_nbo), sizeof(width_nbo));
@@ -196,25 +477,241 @@ Image::append_to(std::ostream &out) const
     uint32_t channels_nbo = host_to_nbo(channels);
     out.write(reinterpret_cast<const char *>(&channels_nbo), sizeof(channels_nbo));
   }
-  out.write(reinterpret_cast<const char *>(data),
-    sizeof(unsigned char) * width * height * channels);
-  return 4 + 4 + 4 + (width * height * channels);
+  if (extended)
+  {
+    uint32_t format_nbo = host_to_nbo(uint32_t(format));
+    out.write(reinterpret_cast<const char *>(&format_nbo), sizeof(format_nbo));
+    uint32_t levels_nbo = host_to_nbo(levels);
+    out.write(reinterpret_cast<const char *>(&levels_nbo), sizeof(levels_nbo));
+  }
+
+  size_t size = get_data_size();
+  out.write(reinterpret_cast<const char *>(data), sizeof(unsigned char) * size);
+  return header_size + uint32_t(size);
 }
 #endif
 
 const std::string FontFace::chars
   = " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~";
+const uint32_t FontFace::glyph_table_size;
+const uint32_t FontFace::glyph_block_size;
+const uint32_t FontFace::missing_glyph;
+
+namespace
+{
+
+/* Fonts packed into an atlas start with this marker, where older fonts start
+   with their number of glyphs. It is followed by the number of glyphs and the
+   atlas size, then each glyph's metrics, the kerning table and the atlas.
+   Fonts with glyphs outside the atlas end with the number of glyph blocks,
+   and for each one its first code point, the size of its bitmaps before and
+   after compression, a record per code point and the compressed bitmaps. */
+const uint32_t font_marker = 0x464e5432; // 'FNT2'
+
+// Empty space left around each glyph, so filtering doesn't pick up neighbours
+const uint32_t atlas_glyph_padding = 1;
+
+/* A skyline packer, which keeps the height of the packed area along the
+   atlas as a list of horizontal segments and puts each rectangle as low as
+   it can go. Rectangles are fed in order of height, tallest first. */
+class SkylinePacker
+{
+  struct Segment
+  {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+  };
+
+  uint32_t width;
+  uint32_t height;
+  std::vector<Segment> skyline;
+
+  // Height a rectangle would sit at if its left edge was on this segment
+  bool
+  fits(size_t index, uint32_t rect_width, uint32_t &y) const
+  {
+    uint32_t x = skyline[index].x;
+    if (x + rect_width > width)
+      return false;
+    y = 0;
+    uint32_t remaining = rect_width;
+    for (size_t i = index; remaining > 0; ++i)
+    {
+      y = std::max(y, skyline[i].y);
+      remaining -= std::min(remaining, skyline[i].width);
+    }
+    return true;
+  }
+public:
+  SkylinePacker(uint32_t _width) :
+    width(_width), height(0), skyline({ Segment{0, 0, _width} })
+  {
+
+  }
+
+  void
+  insert(uint32_t rect_width, uint32_t rect_height, uint32_t &x, uint32_t &y)
+  {
+    size_t best = 0;
+    uint32_t best_top = UINT32_MAX;
+    for (size_t i = 0; i < skyline.size(); ++i)
+    {
+      uint32_t fit_y = 0;
+      if (!fits(i, rect_width, fit_y))
+        continue;
+      if (fit_y + rect_height < best_top)
+      {
+        best = i;
+        best_top = fit_y + rect_height;
+        y = fit_y;
+      }
+    }
+    x = skyline[best].x;
+    height = std::max(height, best_top);
+
+    // Raise the skyline under the rectangle, trimming the segments it covers
+    skyline.insert(skyline.begin() + best, Segment{x, best_top, rect_width});
+    size_t i = best + 1;
+    while (i < skyline.size() && skyline[i].x < x + rect_width)
+    {
+      uint32_t end = skyline[i].x + skyline[i].width;
+      if (end <= x + rect_width)
+      {
+        skyline.erase(skyline.begin() + i);
+        continue;
+      }
+      skyline[i].width = end - (x + rect_width);
+      skyline[i].x = x + rect_width;
+      break;
+    }
+
+    // Join neighbours at the same height
+    for (size_t j = 0; j + 1 < skyline.size();)
+    {
+      if (skyline[j].y == skyline[j + 1].y)
+      {
+        skyline[j].width += skyline[j + 1].width;
+        skyline.erase(skyline.begin() + j + 1);
+      }
+      else
+        ++j;
+    }
+  }
+
+  uint32_t
+  get_height() const
+  {
+    return height;
+  }
+};
+
+}
+
+void
+FontFace::pack_atlas(const std::map<char, std::vector<unsigned char>> &bitmaps)
+{
+  // Start the atlas a power of two wide, so that rows come out roughly square
+  uint32_t area = 0;
+  uint32_t widest = 1;
+  std::vector<char> order = std::vector<char>();
+  for (char c : chars)
+  {
+    const Glyph &glyph = glyphs[uint8_t(c)];
+    uint32_t w = glyph.bitmap_width + atlas_glyph_padding;
+    uint32_t h = glyph.bitmap_height + atlas_glyph_padding;
+    area += w * h;
+    widest = std::max(widest, w);
+    order.push_back(c);
+  }
+  atlas_width = 1;
+  while (atlas_width * atlas_width < area || atlas_width < widest)
+    atlas_width *= 2;
+
+  std::stable_sort(order.begin(), order.end(), [this](char a, char b) {
+    return glyphs[uint8_t(a)].bitmap_height > glyphs[uint8_t(b)].bitmap_height;
+  });
+
+  SkylinePacker packer = SkylinePacker(atlas_width);
+  for (char c : order)
+  {
+    Glyph &glyph = glyphs[uint8_t(c)];
+    packer.insert(glyph.bitmap_width + atlas_glyph_padding,
+      glyph.bitmap_height + atlas_glyph_padding, glyph.atlas_x, glyph.atlas_y);
+  }
+  atlas_height = std::max(packer.get_height(), uint32_t(1));
+
+  atlas = std::vector<unsigned char>(size_t(atlas_width) * atlas_height, 0);
+  for (const std::pair<const char, std::vector<unsigned char>> &x : bitmaps)
+  {
+    const Glyph &glyph = glyphs[uint8_t(x.first)];
+    for (uint32_t row = 0; row < glyph.bitmap_height; ++row)
+    {
+      memcpy(&atlas[(size_t(glyph.atlas_y + row) * atlas_width) + glyph.atlas_x],
+        &x.second[size_t(row) * glyph.bitmap_width], glyph.bitmap_width);
+    }
+  }
+}
 
 #ifdef RESOURCE_IMPORTER
-FontFace::FontFace(std::string path) :
-#ifdef GAME
-  glyph_map(),
-  kerning_table(),
-  texture_map()
-#else
-  glyph_map(),
-  kerning_table()
-#endif
+namespace
+{
+
+// Renders the SDF bitmap for a code point and fills in its metrics. Returns
+// false, leaving both empty, if FreeType can't load or render the glyph.
+bool
+render_glyph(FT_Face font_face, uint32_t codepoint, Glyph &glyph,
+  std::vector<unsigned char> &bitmap)
+{
+  glyph = {};
+  bitmap.clear();
+
+  unsigned int glyph_index = FT_Get_Char_Index(font_face, codepoint);
+  if (FT_Load_Glyph(font_face, glyph_index, 0) != 0
+      || FT_Render_Glyph(font_face->glyph, FT_RENDER_MODE_SDF) != 0)
+    return false;
+
+  glyph.bitmap_width = font_face->glyph->bitmap.width;
+  glyph.bitmap_height = font_face->glyph->bitmap.rows;
+  uint32_t bitmap_size = glyph.bitmap_width * glyph.bitmap_height;
+  bitmap.resize(bitmap_size);
+
+  // If we are rendering SDFs, the FT bitmap has 16 bit gray values, so
+  // we need to convert these to 8 bit gray values
+  if (true)
+  {
+    for (unsigned int x = 0; x < glyph.bitmap_width; ++x)
+    {
+      for (unsigned int j = 0; j < glyph.bitmap_height; ++j)
+      {
+        int16_t gray_16 = reinterpret_cast<uint16_t *>(font_face->glyph->bitmap.buffer)[x + (glyph.bitmap_width * j)];
+        bitmap[x + (glyph.bitmap_width * j)] = (gray_16 + 32768) >> 8;
+      }
+    }
+  }
+  else
+  {
+    memcpy(bitmap.data(), font_face->glyph->bitmap.buffer, bitmap_size);
+  }
+
+  glyph.width = font_face->glyph->metrics.width;
+  glyph.height = font_face->glyph->metrics.height;
+
+  glyph.horizontal_bearing_x = font_face->glyph->metrics.horiBearingX;
+  glyph.horizontal_bearing_y = font_face->glyph->metrics.horiBearingY;
+  glyph.horizontal_advance = font_face->glyph->metrics.horiAdvance;
+
+  glyph.vertical_bearing_x = font_face->glyph->metrics.vertBearingX;
+  glyph.vertical_bearing_y = font_face->glyph->metrics.vertBearingY;
+  glyph.vertical_advance = font_face->glyph->metrics.vertAdvance;
+  return true;
+}
+
+}
+
+FontFace::FontFace(std::string path,
+  const std::vector<std::pair<uint32_t, uint32_t>> &ranges) :
+  FontFace()
 {
   // TODO: handle freetype errors
   FT_Library font_library;
@@ -226,51 +723,20 @@ FontFace::FontFace(std::string path) :
   // Render at 64 pixels for SDFs. This should be fine for all scales.
   error = FT_Set_Pixel_Sizes(font_face, 0, 64);
 
+  std::map<char, std::vector<unsigned char>> bitmaps
+    = std::map<char, std::vector<unsigned char>>();
   for (unsigned int i = 0; i < chars.length(); ++i)
   {
     char c = chars[i];
-    unsigned int glyph_index = FT_Get_Char_Index(font_face, c);
-    error = FT_Load_Glyph(font_face, glyph_index, 0);
-    error = FT_Render_Glyph(font_face->glyph, FT_RENDER_MODE_SDF);
-
-    Glyph glyph = {};
-    glyph.bitmap_width = font_face->glyph->bitmap.width;
-    glyph.bitmap_height = font_face->glyph->bitmap.rows;
-    uint32_t bitmap_size = glyph.bitmap_width * glyph.bitmap_height;
-    glyph.bitmap_data = new unsigned char[bitmap_size];
-
-    // If we are rendering SDFs, the FT bitmap has 16 bit gray values, so
-    // we need to convert these to 8 bit gray values
-    if (true)
-    {
-      for (unsigned int x = 0; x < glyph.bitmap_width; ++x)
-      {
-        for (unsigned int j = 0; j < glyph.bitmap_height; ++j)
-        {
-          int16_t gray_16 = reinterpret_cast<uint16_t *>(font_face->glyph->bitmap.buffer)[x + (glyph.bitmap_width * j)];
-          glyph.bitmap_data[x + (glyph.bitmap_width * j)] = (gray_16 + 32768) >> 8;
-        }
-      }
-    }
-    else
+    if (!render_glyph(font_face, uint8_t(c), glyphs[uint8_t(c)], bitmaps[c]))
     {
-      memcpy(glyph.bitmap_data, font_face->glyph->bitmap.buffer, bitmap_size);
+      // Left out of the atlas, and drawn as nothing
+      bitmaps.erase(c);
+      continue;
     }
 
-    glyph.width = font_face->glyph->metrics.width;
-    glyph.height = font_face->glyph->metrics.height;
-
-    glyph.horizontal_bearing_x = font_face->glyph->metrics.horiBearingX;
-    glyph.horizontal_bearing_y = font_face->glyph->metrics.horiBearingY;
-    glyph.horizontal_advance = font_face->glyph->metrics.horiAdvance;
-
-    glyph.vertical_bearing_x = font_face->glyph->metrics.vertBearingX;
-    glyph.vertical_bearing_y = font_face->glyph->metrics.vertBearingY;
-    glyph.vertical_advance = font_face->glyph->metrics.vertAdvance;
-
-    glyph_map[c] = glyph;
-
     // Loop through all the characters again to get kerning values
+    unsigned int glyph_index = FT_Get_Char_Index(font_face, c);
     for (unsigned int j = 0; j < chars.length(); ++j)
     {
       char c2 = chars[j];
@@ -283,23 +749,82 @@ FontFace::FontFace(std::string path) :
       entry.x = v.x;
       entry.y = v.y;
 
-      kerning_table[std::pair<char, char>(c, c2)] = entry;
+      add_kerning(c, c2, entry);
+    }
+  }
+  sort_kerning_table();
+
+  // Glyphs in the ranges go in blocks, leaving out any the font doesn't have
+  std::map<uint32_t, GlyphBlock> blocks = std::map<uint32_t, GlyphBlock>();
+  for (const std::pair<uint32_t, uint32_t> &range : ranges)
+  {
+    uint32_t last = std::min(range.second, uint32_t(0x10ffff));
+    for (uint32_t codepoint = std::max(range.first, glyph_table_size);
+      codepoint <= last; ++codepoint)
+    {
+      if (FT_Get_Char_Index(font_face, codepoint) == 0)
+        continue;
+
+      uint32_t first = codepoint - (codepoint % glyph_block_size);
+      uint32_t index = codepoint - first;
+      std::map<uint32_t, GlyphBlock>::iterator existing = blocks.find(first);
+      if (existing != blocks.end()
+          && existing->second.bitmap_offsets[index] != missing_glyph)
+        continue;
+
+      Glyph glyph = Glyph();
+      std::vector<unsigned char> bitmap = std::vector<unsigned char>();
+      if (!render_glyph(font_face, codepoint, glyph, bitmap))
+        continue;
+
+      GlyphBlock &block = blocks[first];
+      if (block.glyphs.empty())
+      {
+        block.first_codepoint = first;
+        block.glyphs = std::vector<Glyph>(glyph_block_size, Glyph());
+        block.bitmap_offsets = std::vector<uint32_t>(glyph_block_size,
+          missing_glyph);
+      }
+      block.glyphs[index] = glyph;
+      block.bitmap_offsets[index] = uint32_t(block.bitmaps.size());
+      block.bitmaps.insert(block.bitmaps.end(), bitmap.begin(), bitmap.end());
     }
   }
+  for (std::pair<const uint32_t, GlyphBlock> &x : blocks)
+  {
+    GlyphBlock &block = x.second;
+    block.bitmaps_size = uint32_t(block.bitmaps.size());
+    block.compressed_storage.resize(lz_compress_bound(block.bitmaps.size()));
+    size_t compressed_size = lz_compress(block.bitmaps.data(),
+      block.bitmaps.size(), block.compressed_storage.data(),
+      block.compressed_storage.size());
+    block.compressed_storage.resize(compressed_size);
+    block.compressed_bitmaps = block.compressed_storage;
+    block.bitmaps = std::vector<unsigned char>();
+    glyph_blocks.push_back(std::move(block));
+  }
 
   FT_Done_Face(font_face);
   FT_Done_FreeType(font_library);
+
+  pack_atlas(bitmaps);
 }
 #endif
 
 FontFace::FontFace() :
 #ifdef GAME
-  glyph_map(),
+  glyphs(glyph_table_size, Glyph()),
   kerning_table(),
-  texture_map()
+  atlas_width(0),
+  atlas_height(0),
+  atlas(),
+  atlas_texture(nullptr)
 #else
-  glyph_map(),
-  kerning_table()
+  glyphs(glyph_table_size, Glyph()),
+  kerning_table(),
+  atlas_width(0),
+  atlas_height(0),
+  atlas()
 #endif
 {
 
@@ -307,74 +832,193 @@ FontFace::FontFace() :
 
 FontFace::~FontFace()
 {
-  for (const std::pair<char, Glyph> &x : glyph_map)
-  {
-    if (x.second.bitmap_data != nullptr)
-      delete[] x.second.bitmap_data;
-  }
 #ifdef GAME
-  for (const std::pair<char, Texture *> &x : texture_map)
-  {
-    if (x.second != nullptr)
-      delete x.second;
-  }
+  if (atlas_texture != nullptr)
+    delete atlas_texture;
 #endif
 }
 
-const Glyph &
-FontFace::get_glyph(char c)
+size_t
+FontFace::find_glyph_block(uint32_t codepoint) const
 {
-  return glyph_map[c];
+  uint32_t first = codepoint - (codepoint % glyph_block_size);
+  std::vector<GlyphBlock>::const_iterator it = std::lower_bound(
+    glyph_blocks.begin(), glyph_blocks.end(), first,
+    [](const GlyphBlock &block, uint32_t f) { return block.first_codepoint < f; });
+  if (it != glyph_blocks.end() && it->first_codepoint == first)
+    return size_t(it - glyph_blocks.begin());
+  return glyph_blocks.size();
 }
 
-const FontFace::Kerning &
-FontFace::get_kerning(char a, char b)
+bool
+FontFace::has_glyph(uint32_t codepoint) const
 {
-  return kerning_table[std::pair<char, char>(a, b)];
+  if (codepoint < glyph_table_size)
+    return chars.find(char(codepoint)) != std::string::npos;
+  size_t block = find_glyph_block(codepoint);
+  if (block == glyph_blocks.size())
+    return false;
+  const GlyphBlock &b = glyph_blocks[block];
+  return b.bitmap_offsets[codepoint - b.first_codepoint] != missing_glyph;
 }
 
-#ifdef GAME
-void
-FontFace::generate_textures()
+const Glyph &
+FontFace::get_glyph(uint32_t codepoint) const
 {
-  for (const std::pair<char, Glyph> &x : glyph_map)
+  if (codepoint < glyph_table_size)
+    return glyphs[codepoint];
+  size_t block = find_glyph_block(codepoint);
+  if (block != glyph_blocks.size())
   {
-    if (texture_map.find(x.first) != texture_map.end())
-      continue;
-    texture_map[x.first] = new Texture(x.second.bitmap_width, x.second.bitmap_height, 1, x.second.bitmap_data);
+    const GlyphBlock &b = glyph_blocks[block];
+    if (b.bitmap_offsets[codepoint - b.first_codepoint] != missing_glyph)
+      return b.glyphs[codepoint - b.first_codepoint];
   }
+  return glyphs['?'];
 }
 
-Texture *
-FontFace::get_texture(char c)
+bool
+FontFace::is_atlas_glyph(uint32_t codepoint) const
 {
-  return texture_map[c];
+  return codepoint < glyph_table_size;
 }
-#endif
 
-void
-FontFace::add_glyph(const char &c, const Glyph &glyph)
+const unsigned char *
+FontFace::get_glyph_bitmap(uint32_t codepoint)
 {
-  // First, duplicate the bitmap, then add the glyph to the map
-  Glyph g = Glyph(glyph);
-  g.bitmap_data = new unsigned char[g.bitmap_width * g.bitmap_height];
-  memcpy(g.bitmap_data, glyph.bitmap_data,
-    sizeof(unsigned char) * g.bitmap_width * g.bitmap_height);
-  glyph_map[c] = g;
-}
+  if (codepoint < glyph_table_size)
+    return nullptr;
+  size_t block = find_glyph_block(codepoint);
+  if (block == glyph_blocks.size())
+    return nullptr;
+  GlyphBlock &b = glyph_blocks[block];
+  uint32_t offset = b.bitmap_offsets[codepoint - b.first_codepoint];
+  if (offset == missing_glyph || b.corrupt)
+    return nullptr;
 
-std::string
-FontFace::get_chars() const
-{
-  return chars;
+  if (b.bitmaps.size() != b.bitmaps_size)
+  {
+    b.bitmaps.resize(b.bitmaps_size);
+    if (!lz_decompress(b.compressed_bitmaps.data(), b.compressed_bitmaps.size(),
+      b.bitmaps.data(), b.bitmaps.size()))
+    {
+      // The block is corrupt, so none of its glyphs can be drawn
+      b.bitmaps = std::vector<unsigned char>();
+      b.corrupt = true;
+      return nullptr;
+    }
+  }
+  return b.bitmaps.data() + offset;
 }
 
-Resource *
+uint32_t
+FontFace::get_max_block_glyph_width() const
+{
+  uint32_t width = 0;
+  for (const GlyphBlock &block : glyph_blocks)
+  {
+    for (const Glyph &glyph : block.glyphs)
+      width = std::max(width, glyph.bitmap_width);
+  }
+  return width;
+}
+
+uint32_t
+FontFace::get_max_block_glyph_height() const
+{
+  uint32_t height = 0;
+  for (const GlyphBlock &block : glyph_blocks)
+  {
+    for (const Glyph &glyph : block.glyphs)
+      height = std::max(height, glyph.bitmap_height);
+  }
+  return height;
+}
+
+uint16_t
+FontFace::get_kerning_key(char a, char b)
+{
+  return uint16_t((uint8_t(a) << 8) | uint8_t(b));
+}
+
+void
+FontFace::add_kerning(char a, char b, const Kerning &kerning)
+{
+  if (kerning.x == 0 && kerning.y == 0)
+    return;
+  kerning_table.push_back(KerningPair{get_kerning_key(a, b), kerning});
+}
+
+void
+FontFace::sort_kerning_table()
+{
+  std::sort(kerning_table.begin(), kerning_table.end(),
+    [](const KerningPair &a, const KerningPair &b) { return a.key < b.key; });
+}
+
+FontFace::Kerning
+FontFace::get_kerning(uint32_t a, uint32_t b) const
+{
+  if (a > 0xff || b > 0xff)
+    return Kerning();
+  uint16_t key = get_kerning_key(char(a), char(b));
+  std::vector<KerningPair>::const_iterator it = std::lower_bound(
+    kerning_table.begin(), kerning_table.end(), key,
+    [](const KerningPair &pair, uint16_t k) { return pair.key < k; });
+  if (it != kerning_table.end() && it->key == key)
+    return it->kerning;
+  return Kerning();
+}
+
+uint32_t
+FontFace::get_atlas_width() const
+{
+  return atlas_width;
+}
+
+uint32_t
+FontFace::get_atlas_height() const
+{
+  return atlas_height;
+}
+
+#ifdef GAME
+void
+FontFace::generate_textures()
+{
+  if (atlas_texture == nullptr)
+    atlas_texture = new Texture(atlas_width, atlas_height, 1, atlas.data());
+}
+
+Texture *
+FontFace::get_texture()
+{
+  return atlas_texture;
+}
+#endif
+
+std::string
+FontFace::get_chars() const
+{
+  return chars;
+}
+
+Resource *
 FontFace::duplicate() const
 {
   FontFace *font = new FontFace();
-  for (const std::pair<char, Glyph> &x : glyph_map)
-    font->add_glyph(x.first, x.second);
+  font->glyphs = glyphs;
+  font->kerning_table = kerning_table;
+  font->glyph_blocks = glyph_blocks;
+  for (GlyphBlock &block : font->glyph_blocks)
+  {
+    block.compressed_storage = std::vector<unsigned char>(
+      block.compressed_bitmaps.begin(), block.compressed_bitmaps.end());
+    block.compressed_bitmaps = block.compressed_storage;
+  }
+  font->atlas_width = atlas_width;
+  font->atlas_height = atlas_height;
+  font->atlas = atlas;
   return font;
 }
 
@@ -384,41 +1028,122 @@ FontFace::get_type() const
   return "font_face";
 }
 
+size_t
+FontFace::get_cpu_size() const
+{
+  size_t size = atlas.size();
+  for (const GlyphBlock &block : glyph_blocks)
+  {
+    size += block.glyphs.size() * (sizeof(Glyph) + sizeof(uint32_t));
+    size += block.compressed_storage.size() + block.bitmaps.size();
+  }
+  return size;
+}
+
+size_t
+FontFace::get_gpu_size() const
+{
+  size_t size = 0;
+#ifdef GAME
+  if (atlas_texture != nullptr)
+    size += size_t(atlas_texture->get_width()) * atlas_texture->get_height();
+#endif
+  return size;
+}
+
+void
+FontFace::release_cpu_data()
+{
+  // Whatever was drawn since they were decompressed is in the glyph cache
+  for (GlyphBlock &block : glyph_blocks)
+    block.bitmaps = std::vector<unsigned char>();
+}
+
+namespace
+{
+
+// Reads the metrics that follow the bitmap size in a glyph record
+void
+read_glyph_metrics(const char *data, Glyph &g)
+{
+  g.width = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[0]));
+  g.height = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[4]));
+  g.horizontal_bearing_x = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[8]));
+  g.horizontal_bearing_y = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[12]));
+  g.horizontal_advance = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[16]));
+  g.vertical_bearing_x = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[20]));
+  g.vertical_bearing_y = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[24]));
+  g.vertical_advance = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[28]));
+}
+
+}
+
 FontFace *
 FontFace::from_data(const char *data, uint32_t length)
+{
+  FontFace *font = view_data(data, length);
+  for (GlyphBlock &block : font->glyph_blocks)
+  {
+    block.compressed_storage = std::vector<unsigned char>(
+      block.compressed_bitmaps.begin(), block.compressed_bitmaps.end());
+    block.compressed_bitmaps = block.compressed_storage;
+  }
+  return font;
+}
+
+FontFace *
+FontFace::view_data(const char *data, uint32_t length)
 {
   FontFace *font = new FontFace();
 
-  uint32_t num_chars = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
+  uint32_t marker = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
+  bool packed = marker == font_marker;
+  uint32_t num_chars = marker;
   uint32_t current_offset = 4;
+  if (packed)
+  {
+    num_chars = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[4]));
+    font->atlas_width = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[8]));
+    font->atlas_height = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[12]));
+    current_offset = 16;
+  }
+
+  // Older fonts store a bitmap per glyph, which are packed as they load
+  std::map<char, std::vector<unsigned char>> bitmaps
+    = std::map<char, std::vector<unsigned char>>();
   for (unsigned int i = 0; i < num_chars; ++i)
   {
     Glyph g = {};
 
     char c = data[current_offset];
-    uint32_t offset = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 1]));
-    g.bitmap_width = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 5]));
-    g.bitmap_height = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 9]));
-    g.width = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 13]));
-    g.height = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 17]));
-    g.horizontal_bearing_x = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 21]));
-    g.horizontal_bearing_y = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 25]));
-    g.horizontal_advance = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 29]));
-    g.vertical_bearing_x = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 33]));
-    g.vertical_bearing_y = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 37]));
-    g.vertical_advance = nbo_to_host(*reinterpret_cast<const int32_t *>(&data[current_offset + 41]));
-
-    uint32_t bitmap_size = g.bitmap_width * g.bitmap_height;
-
-    g.bitmap_data = new unsigned char[bitmap_size];
-    memcpy(g.bitmap_data, &data[offset], bitmap_size);
-
-    font->glyph_map[c] = g;
+    if (packed)
+    {
+      g.atlas_x = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 1]));
+      g.atlas_y = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 5]));
+      g.bitmap_width = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 9]));
+      g.bitmap_height = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 13]));
+      read_glyph_metrics(&data[current_offset + 17], g);
+      current_offset += 1 + (4 * 12);
+    }
+    else
+    {
+      uint32_t offset = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 1]));
+      g.bitmap_width = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 5]));
+      g.bitmap_height = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 9]));
+      read_glyph_metrics(&data[current_offset + 13], g);
+      current_offset += 1 + (4 * 11);
+
+      const unsigned char *bitmap = reinterpret_cast<const unsigned char *>(&data[offset]);
+      bitmaps[c] = std::vector<unsigned char>(bitmap,
+        bitmap + (size_t(g.bitmap_width) * g.bitmap_height));
+    }
 
-    current_offset += 1 + (4 * 11);
+    if (uint8_t(c) < glyph_table_size)
+      font->glyphs[uint8_t(c)] = g;
   }
 
-  // Extract kerning table data
+  /* Extract kerning table data. Older fonts have every pair, including the
+     ones without kerning, which are left out here. */
   uint32_t kerning_table_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
   current_offset += 4;
   for (unsigned int i = 0; i < kerning_table_length; ++i)
@@ -431,10 +1156,54 @@ FontFace::from_data(const char *data, uint32_t length)
     Kerning k = {};
     k.x = x;
     k.y = y;
-    font->kerning_table[std::pair<char, char>(c1, c2)] = k;
+    font->add_kerning(c1, c2, k);
 
     current_offset += 10;
   }
+  font->sort_kerning_table();
+
+  if (packed)
+  {
+    const unsigned char *atlas = reinterpret_cast<const unsigned char *>(&data[current_offset]);
+    font->atlas = std::vector<unsigned char>(atlas,
+      atlas + (size_t(font->atlas_width) * font->atlas_height));
+    current_offset += font->atlas_width * font->atlas_height;
+  }
+  else
+    font->pack_atlas(bitmaps);
+
+  if (packed && current_offset + 4 <= length)
+  {
+    uint32_t block_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
+    current_offset += 4;
+    for (uint32_t i = 0; i < block_count; ++i)
+    {
+      GlyphBlock block = GlyphBlock();
+      block.first_codepoint = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
+      block.bitmaps_size = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 4]));
+      uint32_t compressed_size = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 8]));
+      current_offset += 12;
+
+      block.glyphs = std::vector<Glyph>(glyph_block_size, Glyph());
+      block.bitmap_offsets = std::vector<uint32_t>(glyph_block_size, missing_glyph);
+      for (uint32_t j = 0; j < glyph_block_size; ++j)
+      {
+        Glyph &g = block.glyphs[j];
+        block.bitmap_offsets[j] = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
+        g.bitmap_width = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 4]));
+        g.bitmap_height = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 8]));
+        read_glyph_metrics(&data[current_offset + 12], g);
+        current_offset += 4 * 11;
+      }
+
+      // The bitmaps are only decompressed when a glyph is drawn
+      block.compressed_bitmaps = std::span<const unsigned char>(
+        reinterpret_cast<const unsigned char *>(&data[current_offset]),
+        compressed_size);
+      current_offset += compressed_size;
+      font->glyph_blocks.push_back(std::move(block));
+    }
+  }
 
   return font;
 }
@@ -443,101 +1212,107 @@ FontFace::from_data(const char *data, uint32_t length)
 uint32_t
 FontFace::append_to(std::ostream &out) const
 {
-  // We will add a table at the beginning that describes the metrics of each glyph,
-  // but we need to know the various offsets and sizes, so we will just allocate
-  // space now and fill it in at the end.
-  uint32_t header_size = 4 + (glyph_map.size() * (1 + (4 * 11)));
-  uint32_t binary_size = header_size;
-  for (uint32_t i = 0; i < header_size; ++i)
-    out.put(0x00);
+  uint32_t binary_size = 0;
+  {
+    uint32_t marker_nbo = host_to_nbo(font_marker);
+    out.write(reinterpret_cast<char *>(&marker_nbo), sizeof(marker_nbo));
+    uint32_t chars_nbo = host_to_nbo(uint32_t(chars.length()));
+    out.write(reinterpret_cast<char *>(&chars_nbo), sizeof(chars_nbo));
+    uint32_t atlas_width_nbo = host_to_nbo(atlas_width);
+    out.write(reinterpret_cast<char *>(&atlas_width_nbo), sizeof(atlas_width_nbo));
+    uint32_t atlas_height_nbo = host_to_nbo(atlas_height);
+    out.write(reinterpret_cast<char *>(&atlas_height_nbo), sizeof(atlas_height_nbo));
+    binary_size += 16;
+  }
 
-  // After the header, write the kerning table (10 bytes per pair)
-  uint32_t current_offset = header_size + 4 + (10 * kerning_table.size());
-  binary_size += 4 + (10 * kerning_table.size());
+  for (char c : chars)
+  {
+    // Write the character, then the order in the declaration of Glyph
+    out.write(&c, sizeof(char));
+    const Glyph &g = get_glyph(c);
+    uint32_t fields[12] = {
+      g.atlas_x, g.atlas_y, g.bitmap_width, g.bitmap_height,
+      uint32_t(g.width), uint32_t(g.height),
+      uint32_t(g.horizontal_bearing_x), uint32_t(g.horizontal_bearing_y),
+      uint32_t(g.horizontal_advance), uint32_t(g.vertical_bearing_x),
+      uint32_t(g.vertical_bearing_y), uint32_t(g.vertical_advance)
+    };
+    for (uint32_t field : fields)
+    {
+      uint32_t field_nbo = host_to_nbo(field);
+      out.write(reinterpret_cast<char *>(&field_nbo), sizeof(field_nbo));
+    }
+    binary_size += 1 + (4 * 12);
+  }
+
+  // After the glyphs, write the kerning table (10 bytes per pair)
   {
     uint32_t kerning_table_length_nbo = host_to_nbo(uint32_t(kerning_table.size()));
     out.write(reinterpret_cast<char *>(&kerning_table_length_nbo), sizeof(kerning_table_length_nbo));
   }
-  for (const std::pair<std::pair<char, char>, Kerning> &x : kerning_table)
+  binary_size += 4 + (10 * kerning_table.size());
+  for (const KerningPair &x : kerning_table)
   {
     // Put the two characters
-    out.write(&x.first.first, sizeof(char));
-    out.write(&x.first.second, sizeof(char));
+    char first = char(x.key >> 8);
+    char second = char(x.key & 0xff);
+    out.write(&first, sizeof(char));
+    out.write(&second, sizeof(char));
     {
-      int32_t x_nbo = host_to_nbo(x.second.x);
+      int32_t x_nbo = host_to_nbo(x.kerning.x);
       out.write(reinterpret_cast<char *>(&x_nbo), sizeof(x_nbo));
     }
     {
-      int32_t y_nbo = host_to_nbo(x.second.y);
+      int32_t y_nbo = host_to_nbo(x.kerning.y);
       out.write(reinterpret_cast<char *>(&y_nbo), sizeof(y_nbo));
     }
   }
 
-  // Now, write the bitmaps
-  std::map<char, uint32_t> offsets = std::map<char, uint32_t>();
-  for (const std::pair<char, Glyph> &x : glyph_map)
-  {
-    offsets[x.first] = current_offset;
-    uint32_t bitmap_size = sizeof(unsigned char) * x.second.bitmap_width * x.second.bitmap_height;
-    out.write(reinterpret_cast<char *>(x.second.bitmap_data), bitmap_size);
-    current_offset += bitmap_size;
-    binary_size += bitmap_size;
-  }
+  // Then the atlas
+  out.write(reinterpret_cast<const char *>(atlas.data()), atlas.size());
+  binary_size += atlas.size();
 
-  out.seekp(0);
+  // Finally, any glyphs outside the atlas
+  if (!glyph_blocks.empty())
   {
-    uint32_t chars_nbo = host_to_nbo(uint32_t(chars.length()));
-    out.write(reinterpret_cast<char *>(&chars_nbo), sizeof(chars_nbo));
+    uint32_t block_count_nbo = host_to_nbo(uint32_t(glyph_blocks.size()));
+    out.write(reinterpret_cast<char *>(&block_count_nbo), sizeof(block_count_nbo));
+    binary_size += 4;
   }
-  for (const std::pair<char, Glyph> &x : glyph_map)
+  for (const GlyphBlock &block : glyph_blocks)
   {
-    // Write the character, metrics, bitmap offset, and size
-    out.write(&x.first, sizeof(char));
-    // Offset first, then the order in the declaration of Glyph
-    {
-      uint32_t offset_nbo = host_to_nbo(offsets[x.first]);
-      out.write(reinterpret_cast<char *>(&offset_nbo), sizeof(offset_nbo));
-    }
-    {
-      uint32_t bitmap_width_nbo = host_to_nbo(x.second.bitmap_width);
-      out.write(reinterpret_cast<char *>(&bitmap_width_nbo), sizeof(bitmap_width_nbo));
-    }
-    {
-      uint32_t bitmap_height_nbo = host_to_nbo(x.second.bitmap_height);
-      out.write(reinterpret_cast<char *>(&bitmap_height_nbo), sizeof(bitmap_height_nbo));
-    }
-    {
-      int32_t width_nbo = host_to_nbo(x.second.width);
-      out.write(reinterpret_cast<char *>(&width_nbo), sizeof(width_nbo));
-    }
-    {
-      int32_t height_nbo = host_to_nbo(x.second.height);
-      out.write(reinterpret_cast<char *>(&height_nbo), sizeof(height_nbo));
-    }
-    {
-      int32_t horizontal_bearing_x_nbo = host_to_nbo(x.second.horizontal_bearing_x);
-      out.write(reinterpret_cast<char *>(&horizontal_bearing_x_nbo), sizeof(horizontal_bearing_x_nbo));
-    }
-    {
-      int32_t horizontal_bearing_y_nbo = host_to_nbo(x.second.horizontal_bearing_y);
-      out.write(reinterpret_cast<char *>(&horizontal_bearing_y_nbo), sizeof(horizontal_bearing_y_nbo));
-    }
-    {
-      int32_t horizontal_advance_nbo = host_to_nbo(x.second.horizontal_advance);
-      out.write(reinterpret_cast<char *>(&horizontal_advance_nbo), sizeof(horizontal_advance_nbo));
-    }
-    {
-      int32_t vertical_bearing_x_nbo = host_to_nbo(x.second.vertical_bearing_x);
-      out.write(reinterpret_cast<char *>(&vertical_bearing_x_nbo), sizeof(vertical_bearing_x_nbo));
-    }
+    uint32_t header[3] = {
+      block.first_codepoint, block.bitmaps_size,
+      uint32_t(block.compressed_bitmaps.size())
+    };
+    for (uint32_t field : header)
     {
-      int32_t vertical_bearing_y_nbo = host_to_nbo(x.second.vertical_bearing_y);
-      out.write(reinterpret_cast<char *>(&vertical_bearing_y_nbo), sizeof(vertical_bearing_y_nbo));
+      uint32_t field_nbo = host_to_nbo(field);
+      out.write(reinterpret_cast<char *>(&field_nbo), sizeof(field_nbo));
     }
+    binary_size += 12;
+
+    for (uint32_t i = 0; i < glyph_block_size; ++i)
     {
-      int32_t vertical_advance_nbo = host_to_nbo(x.second.vertical_advance);
-      out.write(reinterpret_cast<char *>(&vertical_advance_nbo), sizeof(vertical_advance_nbo));
+      const Glyph &g = block.glyphs[i];
+      uint32_t fields[11] = {
+        block.bitmap_offsets[i], g.bitmap_width, g.bitmap_height,
+        uint32_t(g.width), uint32_t(g.height),
+        uint32_t(g.horizontal_bearing_x), uint32_t(g.horizontal_bearing_y),
+        uint32_t(g.horizontal_advance), uint32_t(g.vertical_bearing_x),
+        uint32_t(g.vertical_bearing_y), uint32_t(g.vertical_advance)
+      };
+      for (uint32_t field : fields)
+      {
+        uint32_t field_nbo = host_to_nbo(field);
+        out.write(reinterpret_cast<char *>(&field_nbo), sizeof(field_nbo));
+      }
     }
+    binary_size += 4 * 11 * glyph_block_size;
+
+    out.write(reinterpret_cast<const char *>(block.compressed_bitmaps.data()),
+      block.compressed_bitmaps.size());
+    binary_size += block.compressed_bitmaps.size();
   }
   return binary_size;
 }
@@ -549,11 +1324,12 @@ Text::Text(std::string path)
   std::stringstream buffer = std::stringstream();
   buffer << file.rdbuf();
   text = buffer.str();
+  contents = text;
   file.close();
 }
 
 Text::Text() :
-  text()
+  text(), contents()
 {
 
 }
@@ -563,17 +1339,18 @@ Text::~Text()
 
 }
 
-const std::string &
+std::string_view
 Text::get_text() const
 {
-  return text;
+  return contents;
 }
 
 Resource *
 Text::duplicate() const
 {
   Text *t = new Text();
-  t->text = text;
+  t->text = std::string(contents);
+  t->contents = t->text;
   return t;
 }
 
@@ -583,12 +1360,35 @@ Text::get_type() const
   return "text";
 }
 
+size_t
+Text::get_cpu_size() const
+{
+  return text.size();
+}
+
 Text *
 Text::from_data(const char *data, uint32_t length)
 {
+  Text *view = view_data(data, length);
+  if (view == nullptr)
+    return nullptr;
+  Text *t = new Text();
+  t->text = std::string(view->contents);
+  t->contents = t->text;
+  delete view;
+  return t;
+}
+
+Text *
+Text::view_data(const char *data, uint32_t length)
+{
+  if (length < 4)
+    return nullptr;
   uint32_t text_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
+  if (text_length > length - 4)
+    return nullptr;
   Text *t = new Text();
-  t->text = std::string(&data[4], text_length);
+  t->contents = std::string_view(&data[4], text_length);
   return t;
 }
 
@@ -596,12 +1396,12 @@ Text::from_data(const char *data, uint32_t length)
 uint32_t
 Text::append_to(std::ostream &out) const
 {
-  uint32_t length_nbo = host_to_nbo(uint32_t(text.length()));
+  uint32_t length_nbo = host_to_nbo(uint32_t(contents.length()));
 
   out.write(reinterpret_cast<char *>(&length_nbo), sizeof(length_nbo));
-  out.write(text.data(), text.length());
+  out.write(contents.data(), contents.length());
 
-  return 4 + text.length();
+  return 4 + contents.length();
 }
 #endif
 
@@ -816,7 +1616,38 @@ AudioTrack::from_data(const char *data, uint32_t length)
   track->ogg_data = std::vector<unsigned char>(ogg_bytes);
   memcpy(track->ogg_data.data(), &data[8], ogg_bytes);
 
-  // The ogg data is loaded, now convert it back to PCM
+  track->decode_samples();
+
+  return track;
+}
+
+size_t
+AudioTrack::get_cpu_size() const
+{
+  return (samples.size() * sizeof(int16_t)) + ogg_data.size();
+}
+
+void
+AudioTrack::release_cpu_data()
+{
+  if (ogg_data.empty())
+    return;
+#ifdef GAME
+  // The audio thread may be in the middle of mixing these
+  std::unique_lock<std::mutex> lock;
+  if (AudioServer::get() != nullptr)
+    lock = AudioServer::get()->lock_mixer();
+#endif
+  samples = std::vector<int16_t>();
+}
+
+void
+AudioTrack::decode_samples()
+{
+  if (!samples.empty() || ogg_data.empty())
+    return;
+
+  // Convert the ogg data back to PCM
   ogg_sync_state decoder_sync;
   ogg_page decoder_page;
   ogg_stream_state decoder_stream;
@@ -841,11 +1672,11 @@ AudioTrack::from_data(const char *data, uint32_t length)
     /* First, fetch more data, and then look through all pages until we get
        enough packets. */
     uint32_t bytes_to_read = std::min(uint32_t(4096),
-     uint32_t(track->ogg_data.size() - read_offset));
+     uint32_t(ogg_data.size() - read_offset));
     if (bytes_to_read == 0)
      break;
     sync_buffer = ogg_sync_buffer(&decoder_sync, 4096);
-    memcpy(sync_buffer, &track->ogg_data.data()[read_offset], bytes_to_read);
+    memcpy(sync_buffer, &ogg_data.data()[read_offset], bytes_to_read);
     ogg_sync_wrote(&decoder_sync, bytes_to_read);
     read_offset += bytes_to_read;
 
@@ -877,16 +1708,16 @@ AudioTrack::from_data(const char *data, uint32_t length)
   vorbis_block_init(&pcm_dsp, &pcm_block);
 
   // Loop through the packets in the ogg data and convert it to pcm audio.
-  while (read_offset <= track->ogg_data.size())
+  while (read_offset <= ogg_data.size())
   {
     /* First, fetch more data, and then look through all pages until we get
        enough packets. */
     uint32_t bytes_to_read = std::min(uint32_t(4096),
-     uint32_t(track->ogg_data.size() - read_offset));
+     uint32_t(ogg_data.size() - read_offset));
     if (bytes_to_read == 0)
      break;
     sync_buffer = ogg_sync_buffer(&decoder_sync, 4096);
-    memcpy(sync_buffer, &track->ogg_data.data()[read_offset], bytes_to_read);
+    memcpy(sync_buffer, &ogg_data.data()[read_offset], bytes_to_read);
     ogg_sync_wrote(&decoder_sync, bytes_to_read);
     read_offset += bytes_to_read;
 
@@ -908,7 +1739,7 @@ AudioTrack::from_data(const char *data, uint32_t length)
           {
             float value_f = pcm_f[j][i];
             int16_t value_i = floor((value_f * 32767.0f) + 0.5f);
-            track->samples.push_back(value_i);
+            samples.push_back(value_i);
           }
         }
 
@@ -916,8 +1747,6 @@ AudioTrack::from_data(const char *data, uint32_t length)
       }
     }
   }
-
-  return track;
 }
 
 #ifdef RESOURCE_IMPORTER
@@ -952,15 +1781,207 @@ Vertex::Vertex(Vec3 _position, Vec2 _texture_coordinates, Vec3 _normal) :
 }
 
 Mesh::Mesh() :
-  vertices(), indices()
+  vertices(), indices(), bounds_origin(0.0f), bounds_extent(1.0f)
 {
 
 }
 
 Mesh::Mesh(const VertexVector &_vertices, const IndexVector &_indices) :
-  vertices(_vertices), indices(_indices)
+  vertices(_vertices), indices(_indices), bounds_origin(0.0f),
+  bounds_extent(1.0f)
+{
+
+}
+
+std::span<const Vertex>
+Mesh::get_vertices() const
+{
+  if (vertex_view.data() != nullptr)
+    return vertex_view;
+  return std::span<const Vertex>(vertices);
+}
+
+std::span<const unsigned int>
+Mesh::get_indices() const
+{
+  if (index_view.data() != nullptr)
+    return index_view;
+  return std::span<const unsigned int>(indices);
+}
+
+std::span<const PackedVertex>
+Mesh::get_packed_vertices() const
+{
+  if (packed_vertex_view.data() != nullptr)
+    return packed_vertex_view;
+  return std::span<const PackedVertex>(packed_vertices);
+}
+
+std::span<const uint16_t>
+Mesh::get_short_indices() const
+{
+  if (short_index_view.data() != nullptr)
+    return short_index_view;
+  return std::span<const uint16_t>(short_indices);
+}
+
+bool
+Mesh::is_packed() const
+{
+  return get_packed_vertices().size() > 0;
+}
+
+uint32_t
+Mesh::get_vertex_count() const
+{
+  if (is_packed())
+    return uint32_t(get_packed_vertices().size());
+  return uint32_t(get_vertices().size());
+}
+
+uint32_t
+Mesh::get_index_count() const
+{
+  if (get_short_indices().size() > 0)
+    return uint32_t(get_short_indices().size());
+  return uint32_t(get_indices().size());
+}
+
+Mat4
+Mesh::get_position_transform() const
+{
+  if (!is_packed())
+    return Mat4::identity();
+  return Mat4::translation(bounds_origin) * Mat4::scale(bounds_extent);
+}
+
+uint32_t
+Mesh::select_lod(float max_error) const
+{
+  for (uint32_t i = uint32_t(lods.size()); i > 0; --i)
+  {
+    if (lods[i - 1].error <= max_error)
+      return i;
+  }
+  return 0;
+}
+
+const std::vector<MaterialData> &
+Mesh::get_lod_materials(uint32_t lod) const
+{
+  if (lod == 0 || lod > lods.size())
+    return materials;
+  return lods[lod - 1].materials;
+}
+
+namespace
+{
+
+uint16_t
+float_to_half(float x)
+{
+  uint32_t bits = std::bit_cast<uint32_t>(x);
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (exponent <= 0)
+  {
+    // Too small even for a subnormal half
+    if (exponent < -10)
+      return uint16_t(sign);
+    mantissa |= 0x800000;
+    uint32_t shift = uint32_t(14 - exponent);
+    uint32_t half = mantissa >> shift;
+    // Round to nearest
+    if ((mantissa >> (shift - 1)) & 1)
+      half += 1;
+    return uint16_t(sign | half);
+  }
+  if (exponent >= 31)
+    return uint16_t(sign | 0x7c00); // infinity, and NaN isn't worth keeping
+
+  uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+  // Round to nearest, which may carry into the exponent
+  if (mantissa & 0x1000)
+    half += 1;
+  return uint16_t(half);
+}
+
+uint32_t
+pack_snorm_10(float x)
 {
+  x = std::clamp(x, -1.0f, 1.0f);
+  return uint32_t(int32_t(std::round(x * 511.0f))) & 0x3ff;
+}
+
+}
+
+void
+Mesh::pack()
+{
+  std::span<const Vertex> source_vertices = get_vertices();
+  std::span<const unsigned int> source_indices = get_indices();
+  if (source_vertices.size() == 0)
+    return;
+
+  Vec3 lower = source_vertices[0].position;
+  Vec3 upper = source_vertices[0].position;
+  for (const Vertex &v : source_vertices)
+  {
+    lower = Vec3(std::min(lower.x, v.position.x), std::min(lower.y, v.position.y),
+      std::min(lower.z, v.position.z));
+    upper = Vec3(std::max(upper.x, v.position.x), std::max(upper.y, v.position.y),
+      std::max(upper.z, v.position.z));
+  }
+  bounds_origin = lower;
+  bounds_extent = upper - lower;
+
+  // Flat meshes still need something to divide by
+  if (bounds_extent.x <= 0.0f)
+    bounds_extent.x = 1.0f;
+  if (bounds_extent.y <= 0.0f)
+    bounds_extent.y = 1.0f;
+  if (bounds_extent.z <= 0.0f)
+    bounds_extent.z = 1.0f;
+
+  std::vector<PackedVertex> packed = std::vector<PackedVertex>(source_vertices.size());
+  for (size_t i = 0; i < source_vertices.size(); ++i)
+  {
+    const Vertex &v = source_vertices[i];
+    PackedVertex &p = packed[i];
+
+    float position[3] = {
+      (v.position.x - lower.x) / bounds_extent.x,
+      (v.position.y - lower.y) / bounds_extent.y,
+      (v.position.z - lower.z) / bounds_extent.z
+    };
+    for (unsigned int j = 0; j < 3; ++j)
+      p.position[j] = uint16_t(std::round(std::clamp(position[j], 0.0f, 1.0f) * 65535.0f));
+    p.padding = 0;
+
+    p.texture_coordinates[0] = float_to_half(v.texture_coordinates.x);
+    p.texture_coordinates[1] = float_to_half(v.texture_coordinates.y);
+
+    p.normal = pack_snorm_10(v.normal.x) | (pack_snorm_10(v.normal.y) << 10)
+      | (pack_snorm_10(v.normal.z) << 20);
+  }
+
+  std::vector<uint16_t> packed_indices = std::vector<uint16_t>();
+  IndexVector wide_indices = IndexVector();
+  if (source_vertices.size() <= 0x10000)
+    packed_indices.assign(source_indices.begin(), source_indices.end());
+  else
+    wide_indices.assign(source_indices.begin(), source_indices.end());
 
+  packed_vertices = std::move(packed);
+  short_indices = std::move(packed_indices);
+  indices = std::move(wide_indices);
+  vertices = VertexVector();
+  packed_vertex_view = std::span<const PackedVertex>();
+  short_index_view = std::span<const uint16_t>();
+  vertex_view = std::span<const Vertex>();
+  index_view = std::span<const unsigned int>();
 }
 
 Mesh *
@@ -1036,56 +2057,144 @@ Mesh::primitive_cube()
 }
 
 #ifdef RESOURCE_IMPORTER
+namespace
+{
+
+// A mesh placed somewhere in the node hierarchy
+struct MeshInstance
+{
+  const aiMesh *mesh;
+  aiMatrix4x4 transform;
+  uint32_t index;
+};
+
+void
+collect_mesh_instances(const aiScene *scene, const aiNode *node,
+  const aiMatrix4x4 &parent, std::vector<MeshInstance> &instances)
+{
+  aiMatrix4x4 transform = parent * node->mTransformation;
+  for (unsigned int i = 0; i < node->mNumMeshes; ++i)
+  {
+    MeshInstance instance = MeshInstance();
+    instance.mesh = scene->mMeshes[node->mMeshes[i]];
+    instance.transform = transform;
+    instance.index = uint32_t(instances.size());
+    instances.push_back(instance);
+  }
+
+  for (unsigned int i = 0; i < node->mNumChildren; ++i)
+    collect_mesh_instances(scene, node->mChildren[i], transform, instances);
+}
+
+}
+
 Scene::Scene(std::string path)
   : data()
 {
   Assimp::Importer importer = Assimp::Importer();
-  const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate);
+  const aiScene *scene = importer.ReadFile(path,
+    aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_SortByPType);
 
-  // FIXME: do something smarter than just grabbing the first mesh
-  const aiMesh *mesh = scene->mMeshes[0];
+  // TODO: handle errors
+  if (scene == nullptr || scene->mRootNode == nullptr)
+    return;
 
   data.vertices = VertexVector();
   data.indices = IndexVector();
 
+  /* Every mesh in the file goes into the same buffers, with its node's
+     transform baked in. Meshes sharing a material are kept together so that
+     they can be drawn with one call. */
+  std::vector<MeshInstance> instances = std::vector<MeshInstance>();
+  collect_mesh_instances(scene, scene->mRootNode, aiMatrix4x4(), instances);
+  std::stable_sort(instances.begin(), instances.end(),
+    [](const MeshInstance &a, const MeshInstance &b) {
+      return a.mesh->mMaterialIndex < b.mesh->mMaterialIndex;
+    });
+
   Mat4 y_up = Mat4::rotation(Vec3(1, 0, 0), -3.14159 / 2);
 
-  for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+  for (const MeshInstance &instance : instances)
   {
-    Vec3 pos;
-    Vec3 normal;
-    Vec2 uv;
-    {
-      aiVector3D _pos = mesh->mVertices[i];
-      pos = (y_up * Vec4(_pos.x, _pos.y, _pos.z, 0)).xyz();
+    const aiMesh *mesh = instance.mesh;
 
-      aiVector3D _normal = mesh->mNormals[i];
-      normal = (y_up * Vec4(_normal.x, _normal.y, _normal.z, 0)).xyz();
+    // Points and lines were split into their own meshes, and are skipped
+    if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0)
+      continue;
 
-      if (mesh->mTextureCoords[0] != nullptr)
-      {
-        aiVector3D _uv = mesh->mTextureCoords[0][i];
-        uv = Vec2(_uv.x, _uv.y);
-      }
-    }
+    aiMatrix3x3 normal_transform = aiMatrix3x3(instance.transform);
+    normal_transform.Inverse().Transpose();
 
-    Vertex vertex = Vertex(pos, uv);
-    vertex.normal = normal.normalized();
+    unsigned int base_vertex = data.vertices.size();
+    for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+    {
+      Vec3 pos;
+      Vec3 normal;
+      Vec2 uv;
+      {
+        aiVector3D _pos = instance.transform * mesh->mVertices[i];
+        pos = (y_up * Vec4(_pos.x, _pos.y, _pos.z, 0)).xyz();
 
-    data.vertices.push_back(vertex);
-  }
+        if (mesh->mNormals != nullptr)
+        {
+          aiVector3D _normal = normal_transform * mesh->mNormals[i];
+          normal = (y_up * Vec4(_normal.x, _normal.y, _normal.z, 0)).xyz();
+        }
 
-  for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
-  {
-    aiFace face = mesh->mFaces[i];
-    data.indices.push_back(face.mIndices[0]);
-    data.indices.push_back(face.mIndices[1]);
-    data.indices.push_back(face.mIndices[2]);
+        if (mesh->mTextureCoords[0] != nullptr)
+        {
+          aiVector3D _uv = mesh->mTextureCoords[0][i];
+          uv = Vec2(_uv.x, _uv.y);
+        }
+      }
+
+      Vertex vertex = Vertex(pos, uv);
+      if (normal.norm() > 0)
+        vertex.normal = normal.normalized();
+
+      data.vertices.push_back(vertex);
+    }
+
+    MaterialData material = MaterialData();
+    material.first_index = data.indices.size();
+    material.submesh = instance.index;
+    material.material = mesh->mMaterialIndex;
+
+    aiColor3D diffuse = aiColor3D(1, 1, 1);
+    if (mesh->mMaterialIndex < scene->mNumMaterials)
+      scene->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse);
+    material.diffuse_color = Vec3(diffuse.r, diffuse.g, diffuse.b);
+
+    for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
+    {
+      aiFace face = mesh->mFaces[i];
+      if (face.mNumIndices != 3)
+        continue;
+      data.indices.push_back(base_vertex + face.mIndices[0]);
+      data.indices.push_back(base_vertex + face.mIndices[1]);
+      data.indices.push_back(base_vertex + face.mIndices[2]);
+    }
+    material.index_count = data.indices.size() - material.first_index;
+
+    data.materials.push_back(material);
   }
 
+  std::pair<VertexCacheStats, VertexCacheStats> stats = optimize_mesh(data);
+  generate_lods(data);
+
   std::cout << std::to_string(data.vertices.size()) << std::endl;
   std::cout << std::to_string(data.indices.size()) << std::endl;
   std::cout << std::to_string(data.materials.size()) << std::endl;
+  std::cout << "ACMR " << stats.first.acmr << " -> " << stats.second.acmr
+    << ", ATVR " << stats.first.atvr << " -> " << stats.second.atvr << std::endl;
+  for (const LodData &lod : data.lods)
+  {
+    uint32_t lod_indices = 0;
+    for (const MaterialData &range : lod.materials)
+      lod_indices += range.index_count;
+    std::cout << "LOD " << std::to_string(lod_indices / 3) << " triangles, error "
+      << lod.error << std::endl;
+  }
 }
 #endif
 
@@ -1103,7 +2212,18 @@ Resource *
 Scene::duplicate() const
 {
   Scene *s = new Scene();
-  s->data = data;
+  std::span<const Vertex> vertices = data.get_vertices();
+  std::span<const unsigned int> indices = data.get_indices();
+  std::span<const PackedVertex> packed_vertices = data.get_packed_vertices();
+  std::span<const uint16_t> short_indices = data.get_short_indices();
+  s->data.vertices.assign(vertices.begin(), vertices.end());
+  s->data.indices.assign(indices.begin(), indices.end());
+  s->data.packed_vertices.assign(packed_vertices.begin(), packed_vertices.end());
+  s->data.short_indices.assign(short_indices.begin(), short_indices.end());
+  s->data.bounds_origin = data.bounds_origin;
+  s->data.bounds_extent = data.bounds_extent;
+  s->data.materials = data.materials;
+  s->data.lods = data.lods;
   return s;
 }
 
@@ -1113,34 +2233,252 @@ Scene::get_type() const
   return "scene";
 }
 
+size_t
+Scene::get_cpu_size() const
+{
+  size_t lod_size = 0;
+  for (const LodData &lod : data.lods)
+    lod_size += sizeof(LodData) + (lod.materials.size() * sizeof(MaterialData));
+
+  return lod_size
+    + (data.vertices.size() * sizeof(Vertex))
+    + (data.indices.size() * sizeof(unsigned int))
+    + (data.packed_vertices.size() * sizeof(PackedVertex))
+    + (data.short_indices.size() * sizeof(uint16_t))
+    + (data.materials.size() * sizeof(MaterialData));
+}
+
+namespace
+{
+
+/* Packed scenes start with this marker, which is far larger than any vertex
+   count the original layout could start with. It is followed by the vertex,
+   index, material and LOD counts and flags, then the bounds, vertices,
+   indices and materials. Those are in host order so that they can be used as
+   is. Each LOD follows as its error and range count, then its ranges. */
+const uint32_t packed_scene_marker = 0x4d534832; // 'MSH2'
+const uint32_t packed_scene_header_size = (6 * 4) + (6 * 4);
+const uint32_t packed_scene_short_indices = 0x1;
+const uint32_t packed_scene_material_ranges = 0x2;
+
+// Materials used to only store how many indices followed the previous one
+struct LegacyMaterialData
+{
+  Vec3 diffuse_color;
+  uint32_t vertices;
+};
+
+struct SceneLayout
+{
+  bool packed;
+  bool short_indices;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t material_count;
+  uint32_t material_size;
+  uint32_t lod_count;
+  Vec3 bounds_origin;
+  Vec3 bounds_extent;
+
+  uint32_t vertex_offset;
+  uint32_t index_offset;
+  uint32_t material_offset;
+  uint32_t lod_offset;
+};
+
+bool
+read_scene_layout(const char *data, uint32_t length, SceneLayout &layout)
+{
+  layout = SceneLayout();
+  if (length < 12)
+    return false;
+
+  uint32_t first = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
+  layout.packed = (first == packed_scene_marker);
+  if (!layout.packed)
+  {
+    // Unpacked scenes are whole Vertex structs and 32 bit indices
+    layout.vertex_count = first;
+    layout.index_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[4]));
+    layout.material_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[8]));
+    layout.vertex_offset = 12;
+    layout.index_offset = layout.vertex_offset + (sizeof(Vertex) * layout.vertex_count);
+    layout.material_offset = layout.index_offset + (sizeof(unsigned int) * layout.index_count);
+    layout.material_size = sizeof(LegacyMaterialData);
+  }
+  else
+  {
+    if (length < packed_scene_header_size)
+      return false;
+    layout.vertex_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[4]));
+    layout.index_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[8]));
+    layout.material_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[12]));
+    uint32_t flags = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[16]));
+    layout.lod_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[20]));
+    layout.short_indices = (flags & packed_scene_short_indices) != 0;
+    layout.material_size = ((flags & packed_scene_material_ranges) != 0)
+      ? sizeof(MaterialData) : sizeof(LegacyMaterialData);
+
+    float bounds[6];
+    memcpy(bounds, &data[24], sizeof(bounds));
+    layout.bounds_origin = Vec3(bounds[0], bounds[1], bounds[2]);
+    layout.bounds_extent = Vec3(bounds[3], bounds[4], bounds[5]);
+
+    uint32_t index_size = layout.short_indices ? sizeof(uint16_t) : sizeof(unsigned int);
+    layout.vertex_offset = packed_scene_header_size;
+    layout.index_offset = layout.vertex_offset + (sizeof(PackedVertex) * layout.vertex_count);
+    // Materials stay 4 byte aligned after an odd number of short indices
+    layout.material_offset = layout.index_offset
+      + (((index_size * layout.index_count) + 3) & ~uint32_t(3));
+  }
+
+  uint64_t material_end = uint64_t(layout.material_offset)
+    + (uint64_t(layout.material_size) * layout.material_count);
+  layout.lod_offset = uint32_t(material_end);
+  return material_end <= length;
+}
+
+bool
+read_scene_lods(const char *data, uint32_t length, const SceneLayout &layout,
+  std::vector<LodData> &lods)
+{
+  lods.clear();
+  uint64_t offset = layout.lod_offset;
+  for (uint32_t i = 0; i < layout.lod_count; ++i)
+  {
+    if (offset + 8 > length)
+      return false;
+
+    LodData lod = LodData();
+    uint32_t range_count = 0;
+    memcpy(&lod.error, &data[offset], sizeof(float));
+    memcpy(&range_count, &data[offset + 4], sizeof(uint32_t));
+    offset += 8;
+
+    if (offset + (uint64_t(sizeof(MaterialData)) * range_count) > length)
+      return false;
+    lod.materials.resize(range_count);
+    memcpy(lod.materials.data(), &data[offset], sizeof(MaterialData) * range_count);
+    offset += sizeof(MaterialData) * range_count;
+
+    lods.push_back(lod);
+  }
+  return true;
+}
+
+void
+read_scene_materials(const char *data, const SceneLayout &layout,
+  std::vector<MaterialData> &materials)
+{
+  materials.resize(layout.material_count);
+  if (layout.material_size == sizeof(MaterialData))
+  {
+    memcpy(materials.data(), &data[layout.material_offset],
+      sizeof(MaterialData) * layout.material_count);
+    return;
+  }
+
+  // Older materials were drawn back to back, each one its own material
+  uint32_t first_index = 0;
+  for (uint32_t i = 0; i < layout.material_count; ++i)
+  {
+    LegacyMaterialData legacy = LegacyMaterialData();
+    memcpy(&legacy, &data[layout.material_offset + (sizeof(LegacyMaterialData) * i)],
+      sizeof(LegacyMaterialData));
+
+    materials[i] = MaterialData();
+    materials[i].diffuse_color = legacy.diffuse_color;
+    materials[i].first_index = first_index;
+    materials[i].index_count = legacy.vertices;
+    materials[i].material = i;
+    first_index += legacy.vertices;
+  }
+}
+
+}
+
 Scene *
 Scene::from_data(const char *data, uint32_t length)
 {
   Scene *s = new Scene();
 
-  uint32_t vertex_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
-  uint32_t index_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[4]));
-  uint32_t mat_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[8]));
+  SceneLayout layout = SceneLayout();
+  if (!read_scene_layout(data, length, layout))
+    return s;
 
-  uint32_t offset = 12;
+  if (!layout.packed)
+  {
+    const Vertex *vertices = reinterpret_cast<const Vertex *>(&data[layout.vertex_offset]);
+    s->data.vertices.assign(vertices, vertices + layout.vertex_count);
+  }
+  else
+  {
+    s->data.packed_vertices.resize(layout.vertex_count);
+    memcpy(s->data.packed_vertices.data(), &data[layout.vertex_offset],
+      sizeof(PackedVertex) * layout.vertex_count);
+    s->data.bounds_origin = layout.bounds_origin;
+    s->data.bounds_extent = layout.bounds_extent;
+  }
 
-  for (uint32_t i = 0; i < vertex_count; ++i)
+  if (layout.short_indices)
   {
-    s->data.vertices.push_back(*reinterpret_cast<const Vertex *>(&data[offset + (sizeof(Vertex) * i)]));
+    s->data.short_indices.resize(layout.index_count);
+    memcpy(s->data.short_indices.data(), &data[layout.index_offset],
+      sizeof(uint16_t) * layout.index_count);
   }
-  offset += sizeof(Vertex) * vertex_count;
+  else
+  {
+    s->data.indices.resize(layout.index_count);
+    memcpy(s->data.indices.data(), &data[layout.index_offset],
+      sizeof(unsigned int) * layout.index_count);
+  }
+
+  read_scene_materials(data, layout, s->data.materials);
+  read_scene_lods(data, length, layout, s->data.lods);
+
+  return s;
+}
+
+Scene *
+Scene::view_data(const char *data, uint32_t length)
+{
+  Scene *s = new Scene();
+
+  SceneLayout layout = SceneLayout();
+  if (!read_scene_layout(data, length, layout))
+    return s;
 
-  for (uint32_t i = 0; i < index_count; ++i)
+  if (!layout.packed)
   {
-    s->data.indices.push_back(*reinterpret_cast<const unsigned int *>(&data[offset + (sizeof(unsigned int) * i)]));
+    s->data.vertex_view = std::span<const Vertex>(
+      reinterpret_cast<const Vertex *>(&data[layout.vertex_offset]), layout.vertex_count);
+  }
+  else
+  {
+    s->data.packed_vertex_view = std::span<const PackedVertex>(
+      reinterpret_cast<const PackedVertex *>(&data[layout.vertex_offset]),
+      layout.vertex_count);
+    s->data.bounds_origin = layout.bounds_origin;
+    s->data.bounds_extent = layout.bounds_extent;
   }
-  offset += sizeof(unsigned int) * index_count;
 
-  for (uint32_t i = 0; i < mat_count; ++i)
+  if (layout.short_indices)
+  {
+    s->data.short_index_view = std::span<const uint16_t>(
+      reinterpret_cast<const uint16_t *>(&data[layout.index_offset]),
+      layout.index_count);
+  }
+  else
   {
-    s->data.materials.push_back(*reinterpret_cast<const MaterialData *>(&data[offset + (sizeof(MaterialData) * i)]));
+    s->data.index_view = std::span<const unsigned int>(
+      reinterpret_cast<const unsigned int *>(&data[layout.index_offset]),
+      layout.index_count);
   }
 
+  // Materials are small, so just copy them
+  read_scene_materials(data, layout, s->data.materials);
+  read_scene_lods(data, length, layout, s->data.lods);
+
   return s;
 }
 
@@ -1154,292 +2492,1516 @@ Scene::get_mesh()
 uint32_t
 Scene::append_to(std::ostream &out) const
 {
-  uint32_t total_bytes = 0;
-
-  // For each mesh, write down the # of vertices and indices, then the raw data.
-  uint32_t vertex_count_nbo = host_to_nbo(uint32_t(data.vertices.size()));
-  out.write(reinterpret_cast<char *>(&vertex_count_nbo), sizeof(vertex_count_nbo));
+  Mesh packed = data;
+  if (!packed.is_packed())
+    packed.pack();
+
+  std::span<const PackedVertex> vertices = packed.get_packed_vertices();
+  std::span<const uint16_t> short_indices = packed.get_short_indices();
+  std::span<const unsigned int> indices = packed.get_indices();
+  bool use_short_indices = (short_indices.size() > 0 || indices.size() == 0);
+
+  uint32_t header[6] = {
+    host_to_nbo(packed_scene_marker),
+    host_to_nbo(uint32_t(vertices.size())),
+    host_to_nbo(uint32_t(use_short_indices ? short_indices.size() : indices.size())),
+    host_to_nbo(uint32_t(packed.materials.size())),
+    host_to_nbo(packed_scene_material_ranges
+      | (use_short_indices ? packed_scene_short_indices : uint32_t(0))),
+    host_to_nbo(uint32_t(packed.lods.size()))
+  };
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
 
-  uint32_t index_count_nbo = host_to_nbo(uint32_t(data.indices.size()));
-  out.write(reinterpret_cast<char *>(&index_count_nbo), sizeof(index_count_nbo));
+  float bounds[6] = {
+    packed.bounds_origin.x, packed.bounds_origin.y, packed.bounds_origin.z,
+    packed.bounds_extent.x, packed.bounds_extent.y, packed.bounds_extent.z
+  };
+  out.write(reinterpret_cast<const char *>(bounds), sizeof(bounds));
 
-  uint32_t mat_count_nbo = host_to_nbo(uint32_t(data.materials.size()));
-  out.write(reinterpret_cast<char *>(&mat_count_nbo), sizeof(mat_count_nbo));
+  uint32_t total_bytes = packed_scene_header_size;
 
-  total_bytes += 12;
+  out.write(reinterpret_cast<const char *>(vertices.data()), vertices.size_bytes());
+  total_bytes += vertices.size_bytes();
 
-  out.write(reinterpret_cast<const char *>(data.vertices.data()), sizeof(Vertex) * data.vertices.size());
-  total_bytes += sizeof(Vertex) * data.vertices.size();
+  size_t index_bytes = use_short_indices ? short_indices.size_bytes() : indices.size_bytes();
+  if (use_short_indices)
+    out.write(reinterpret_cast<const char *>(short_indices.data()), index_bytes);
+  else
+    out.write(reinterpret_cast<const char *>(indices.data()), index_bytes);
+  for (size_t i = index_bytes; i % 4 != 0; ++i)
+    out.put(0x00);
+  total_bytes += (index_bytes + 3) & ~size_t(3);
 
-  out.write(reinterpret_cast<const char *>(data.indices.data()), sizeof(unsigned int) * data.indices.size());
-  total_bytes += sizeof(unsigned int) * data.indices.size();
+  out.write(reinterpret_cast<const char *>(packed.materials.data()),
+    sizeof(MaterialData) * packed.materials.size());
+  total_bytes += sizeof(MaterialData) * packed.materials.size();
 
-  out.write(reinterpret_cast<const char *>(data.materials.data()), sizeof(MaterialData) * data.materials.size());
-  total_bytes += sizeof(MaterialData) * data.materials.size();
+  for (const LodData &lod : packed.lods)
+  {
+    uint32_t range_count = uint32_t(lod.materials.size());
+    out.write(reinterpret_cast<const char *>(&lod.error), sizeof(float));
+    out.write(reinterpret_cast<const char *>(&range_count), sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(lod.materials.data()),
+      sizeof(MaterialData) * range_count);
+    total_bytes += 8 + (sizeof(MaterialData) * range_count);
+  }
 
   return total_bytes;
 }
 #endif
 
-ResourceBundle::ResourceBundle() :
-  resources()
+namespace
 {
 
+constexpr uint32_t
+make_type_tag(char a, char b, char c, char d)
+{
+  return (uint32_t(uint8_t(a)) << 24) | (uint32_t(uint8_t(b)) << 16)
+    | (uint32_t(uint8_t(c)) << 8) | uint32_t(uint8_t(d));
 }
 
-ResourceBundle::ResourceBundle(std::string path) :
-  resources()
+/* Every type that can be stored in a bundle. Version 3 bundles identify entry
+   types by tag; older bundles name them, so both are kept here. Types that
+   can borrow their data from a mapped bundle also provide view_data(). */
+struct ResourceType
 {
-  std::ifstream file = std::ifstream(path, std::ios::binary);
+  uint32_t tag;
+  const char *name;
+  Resource *(*from_data)(const char *data, uint32_t length);
+  Resource *(*view_data)(const char *data, uint32_t length);
 
-  // First, parse the header
-  uint32_t table_length;
-  Header header = {};
+  // Used when no codec is requested for a resource
+  ResourceBundle::Codec default_codec;
+};
+
+const ResourceType resource_types[] = {
+  {
+    make_type_tag('I', 'M', 'A', 'G'), "image",
+    [](const char *data, uint32_t length) -> Resource * { return Image::from_data(data, length); },
+    [](const char *data, uint32_t length) -> Resource * { return Image::view_data(data, length); },
+    ResourceBundle::CodecLZ
+  },
+  {
+    make_type_tag('F', 'O', 'N', 'T'), "font_face",
+    [](const char *data, uint32_t length) -> Resource * { return FontFace::from_data(data, length); },
+    [](const char *data, uint32_t length) -> Resource * { return FontFace::view_data(data, length); },
+    ResourceBundle::CodecStore // glyph blocks are already compressed, and are used in place
+  },
+  {
+    make_type_tag('T', 'E', 'X', 'T'), "text",
+    [](const char *data, uint32_t length) -> Resource * { return Text::from_data(data, length); },
+    [](const char *data, uint32_t length) -> Resource * { return Text::view_data(data, length); },
+    ResourceBundle::CodecDeflate
+  },
   {
-    uint32_t magic_number_nbo;
-    file.read(reinterpret_cast<char *>(&magic_number_nbo), sizeof(magic_number_nbo));
+    make_type_tag('A', 'U', 'D', 'I'), "audiotrack",
+    [](const char *data, uint32_t length) -> Resource * { return AudioTrack::from_data(data, length); },
+    nullptr,
+    ResourceBundle::CodecStore // Vorbis doesn't compress any further
+  },
+  {
+    make_type_tag('S', 'C', 'E', 'N'), "scene",
+    [](const char *data, uint32_t length) -> Resource * { return Scene::from_data(data, length); },
+    [](const char *data, uint32_t length) -> Resource * { return Scene::view_data(data, length); },
+    ResourceBundle::CodecLZ
   }
+};
+
+const ResourceType *
+find_resource_type(uint32_t tag)
+{
+  for (const ResourceType &type : resource_types)
   {
-    uint32_t version_nbo;
-    file.read(reinterpret_cast<char *>(&version_nbo), sizeof(version_nbo));
-    header.bundle_version = nbo_to_host(version_nbo);
+    if (type.tag == tag)
+      return &type;
   }
+  return nullptr;
+}
+
+const ResourceType *
+find_resource_type(std::string_view name)
+{
+  for (const ResourceType &type : resource_types)
   {
-    uint32_t table_length_nbo;
-    file.read(reinterpret_cast<char *>(&table_length_nbo), sizeof(table_length_nbo));
-    table_length = nbo_to_host(table_length_nbo);
+    if (name == type.name)
+      return &type;
   }
+  return nullptr;
+}
 
-  for (unsigned int i = 0; i < table_length; ++i)
+// 64-bit FNV-1a
+uint64_t
+hash_name(std::string_view name)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : name)
   {
-    HeaderResourceDescriptor entry = {};
-    {
-      uint32_t name_length_nbo;
-      file.read(reinterpret_cast<char *>(&name_length_nbo), sizeof(name_length_nbo));
-      uint32_t name_length = nbo_to_host(name_length_nbo);
-      char *name_buf = new char[name_length];
-      file.read(name_buf, name_length);
-      entry.resource_name = std::string(name_buf);
-      delete[] name_buf;
-    }
-    {
-      uint32_t type_length_nbo;
-      file.read(reinterpret_cast<char *>(&type_length_nbo), sizeof(type_length_nbo));
-      uint32_t type_length = nbo_to_host(type_length_nbo);
-      char *type_buf = new char[type_length];
-      file.read(type_buf, type_length);
-      entry.resource_type = std::string(type_buf);
-      delete[] type_buf;
-    }
-    {
-      uint32_t offset_nbo;
-      file.read(reinterpret_cast<char *>(&offset_nbo), sizeof(offset_nbo));
-      entry.offset = nbo_to_host(offset_nbo);
-    }
-    {
-      uint32_t compressed_size_nbo;
-      file.read(reinterpret_cast<char *>(&compressed_size_nbo), sizeof(compressed_size_nbo));
-      entry.compressed_size = nbo_to_host(compressed_size_nbo);
-    }
-    {
-      uint32_t size_nbo;
-      file.read(reinterpret_cast<char *>(&size_nbo), sizeof(size_nbo));
-      entry.size = nbo_to_host(size_nbo);
-    }
-    header.entries.push_back(entry);
+    hash ^= uint8_t(c);
+    hash *= 0x100000001b3;
   }
+  return hash;
+}
+
+// Type of the entry holding the shared dictionary, which isn't a resource
+const uint32_t dictionary_type_tag = make_type_tag('D', 'I', 'C', 'T');
+
+// Entries up to this size are compressed with the shared dictionary, if
+// there are enough of them to train one
+const uint32_t small_entry_size = 16384;
+const size_t dictionary_min_samples = 8;
+const size_t dictionary_capacity = 32768;
+
+// Larger entries are split into chunks of this size
+const uint32_t entry_chunk_size = 262144;
+
+/* Version 5 bundles can be updated in place: changed entries are appended
+   along with a new table that replaces the one in the header, and a trailer
+   at the end of the file points to the latest table. */
+const uint32_t current_bundle_version = 5;
+
+// Magic, version, entry count, and string table size
+const uint32_t bundle_header_size = 4 + 4 + 4 + 4;
+
+// Tables appended to a bundle start with their own magic number and a count
+// of the tables appended so far, then follow the layout of the header
+const uint32_t journal_table_magic = make_type_tag('F', 'P', 'J', 'T');
+
+// Offset of the latest table, the magic number, and padding
+const uint32_t journal_trailer_size = 8 + 4 + 4;
+const uint32_t journal_trailer_magic = make_type_tag('F', 'P', 'J', 'E');
+
+// Name hash, name offset and length, type tag, flags, codec and padding,
+// offset, compressed size, and size. Version 3 has no codec or padding.
+const uint32_t bundle_entry_size = 8 + 4 + 4 + 4 + 4 + 4 + 4 + 8 + 8 + 8;
+const uint32_t bundle_v3_entry_size = 8 + 4 + 4 + 4 + 4 + 8 + 8 + 8;
+
+}
+
+uint64_t ResourceBundle::use_clock = 0;
+
+ResourceBundle::ResourceBundle() :
+  path(), version(0), journal_length(0), mapping(nullptr), entries(),
+  dictionary(), name_index()
+{
+
+}
 
-  // We have all the information necessary to decompress each resource
-  for (unsigned int i = 0; i < header.entries.size(); ++i)
+ResourceBundle::ResourceBundle(std::string _path, LoadMode mode) :
+  path(_path), version(0), journal_length(0), mapping(nullptr), entries(),
+  dictionary(), name_index()
+{
+  open();
+
+  // Otherwise, the entries themselves are decoded on demand by get_resource()
+  if (mode == LoadParallel)
   {
-    file.seekg(header.entries[i].offset);
-    unsigned char *uncompressed = new unsigned char[header.entries[i].size];
-    unsigned long uncompressed_size = header.entries[i].size;
+    WorkerPool pool = WorkerPool();
+    preload_all(&pool);
+  }
+}
 
-    char *compressed = new char[header.entries[i].compressed_size];
-    unsigned long compressed_size = header.entries[i].compressed_size;
+ResourceBundle::~ResourceBundle()
+{
+  // Resources that are still referenced elsewhere keep the mapping alive
+}
 
-    file.read(compressed, header.entries[i].compressed_size);
+void
+ResourceBundle::open()
+{
+  mapping = std::make_shared<MappedFile>(path);
+  if (!mapping->is_open() || mapping->get_size() < 12)
+    return;
 
-    int err = uncompress2(uncompressed, &uncompressed_size,
-      reinterpret_cast<unsigned char *>(compressed), &compressed_size);
+  // Skip the magic number
+  version = nbo_to_host(*reinterpret_cast<const uint32_t *>(&mapping->get_data()[4]));
+  if (version >= 3)
+    read_table(version);
+  else
+    read_legacy_table(version);
+}
 
-    if (header.entries[i].resource_type == "image")
-    {
-      resources[header.entries[i].resource_name] =
-        Image::from_data(reinterpret_cast<char *>(uncompressed), header.entries[i].size);
-    }
-    else if (header.entries[i].resource_type == "font_face")
+void
+ResourceBundle::reopen()
+{
+  std::vector<Entry> previous = std::move(entries);
+  entries = std::vector<Entry>();
+  dictionary = std::span<const unsigned char>();
+  name_index = std::vector<uint32_t>();
+  journal_length = 0;
+
+  // Anything borrowing from the old mapping keeps it alive
+  open();
+
+  // Resources that were already loaded don't need to be decoded again
+  for (Entry &old_entry : previous)
+  {
+    if (!old_entry.resource)
+      continue;
+    Entry *entry = find_entry(old_entry.name);
+    if (entry == nullptr)
+      continue;
+    entry->resource = old_entry.resource;
+    entry->last_used = old_entry.last_used;
+  }
+}
+
+void
+ResourceBundle::read_table(uint32_t bundle_version)
+{
+  const char *data = mapping->get_data();
+  size_t data_size = mapping->get_size();
+  if (data_size < bundle_header_size)
+    return;
+
+  uint32_t entry_size = (bundle_version >= 4) ? bundle_entry_size : bundle_v3_entry_size;
+  uint32_t sizes_offset = (bundle_version >= 4) ? 32 : 24;
+
+  // Use the latest appended table, if there is one
+  size_t table_offset = 0;
+  if (bundle_version >= 5 && data_size >= bundle_header_size + journal_trailer_size)
+  {
+    const char *trailer = &data[data_size - journal_trailer_size];
+    uint64_t latest = nbo_to_host(*reinterpret_cast<const uint64_t *>(&trailer[0]));
+    uint32_t magic = nbo_to_host(*reinterpret_cast<const uint32_t *>(&trailer[8]));
+    if (magic == journal_trailer_magic
+        && latest <= data_size - journal_trailer_size - bundle_header_size
+        && nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[latest])) == journal_table_magic)
     {
-      resources[header.entries[i].resource_name] =
-        FontFace::from_data(reinterpret_cast<char *>(uncompressed), header.entries[i].size);
+      table_offset = latest;
+      journal_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[latest + 4]));
     }
-    else if (header.entries[i].resource_type == "text")
+  }
+
+  uint32_t entry_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[table_offset + 8]));
+  uint32_t string_table_size = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[table_offset + 12]));
+
+  size_t descriptors_offset = table_offset + bundle_header_size;
+  size_t string_table_offset = descriptors_offset + (size_t(entry_count) * entry_size);
+  if (string_table_offset + string_table_size > data_size)
+    return;
+  const char *string_table = &data[string_table_offset];
+
+  entries.reserve(entry_count);
+  for (unsigned int i = 0; i < entry_count; ++i)
+  {
+    const char *descriptor = &data[descriptors_offset + (size_t(i) * entry_size)];
+
+    Entry entry = {};
+    entry.name_hash = nbo_to_host(*reinterpret_cast<const uint64_t *>(&descriptor[0]));
+    uint32_t name_offset = nbo_to_host(*reinterpret_cast<const uint32_t *>(&descriptor[8]));
+    uint32_t name_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&descriptor[12]));
+    entry.type_tag = nbo_to_host(*reinterpret_cast<const uint32_t *>(&descriptor[16]));
+    entry.flags = nbo_to_host(*reinterpret_cast<const uint32_t *>(&descriptor[20]));
+    if (bundle_version >= 4)
+      entry.codec = nbo_to_host(*reinterpret_cast<const uint32_t *>(&descriptor[24]));
+    else
     {
-      resources[header.entries[i].resource_name] =
-        Text::from_data(reinterpret_cast<char *>(uncompressed), header.entries[i].size);
+      // Entries that weren't stored were compressed however the bundle chose
+      entry.codec = (entry.flags & EntryFlagStored) ? CodecStore : CodecDeflate;
+      if (entry.codec != CodecStore)
+        entry.flags |= EntryFlagAutomaticCodec;
     }
-    else if (header.entries[i].resource_type == "audiotrack")
+    entry.offset = nbo_to_host(*reinterpret_cast<const uint64_t *>(&descriptor[sizes_offset]));
+    entry.compressed_size = nbo_to_host(*reinterpret_cast<const uint64_t *>(&descriptor[sizes_offset + 8]));
+    entry.size = nbo_to_host(*reinterpret_cast<const uint64_t *>(&descriptor[sizes_offset + 16]));
+
+    if (entry.type_tag == dictionary_type_tag)
     {
-      resources[header.entries[i].resource_name] =
-        AudioTrack::from_data(reinterpret_cast<char *>(uncompressed), header.entries[i].size);
+      if (entry.codec == CodecStore && entry.offset <= data_size
+          && entry.size <= data_size - entry.offset)
+        dictionary = std::span<const unsigned char>(
+          reinterpret_cast<const unsigned char *>(&data[entry.offset]), entry.size);
+      continue;
     }
-    else if (header.entries[i].resource_type == "scene")
+
+    if (size_t(name_offset) + name_length > string_table_size)
+      continue;
+    entry.name = std::string(&string_table[name_offset], name_length);
+
+    entries.push_back(entry);
+  }
+
+  rebuild_index();
+}
+
+void
+ResourceBundle::read_legacy_table(uint32_t bundle_version)
+{
+  const char *data = mapping->get_data();
+  size_t data_size = mapping->get_size();
+
+  uint32_t table_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[8]));
+
+  size_t current_offset = 12;
+  for (unsigned int i = 0; i < table_length; ++i)
+  {
+    Entry entry = {};
     {
-      resources[header.entries[i].resource_name] =
-        Scene::from_data(reinterpret_cast<char *>(uncompressed), header.entries[i].size);
+      if (current_offset + 4 > data_size)
+        break;
+      uint32_t name_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
+      current_offset += 4;
+      if (current_offset + name_length > data_size)
+        break;
+      entry.name = std::string(&data[current_offset],
+        strnlen(&data[current_offset], name_length));
+      current_offset += name_length;
     }
-    else
     {
-      // TODO: handle unsupported types
+      if (current_offset + 4 > data_size)
+        break;
+      uint32_t type_length = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
+      current_offset += 4;
+      if (current_offset + type_length > data_size)
+        break;
+      const ResourceType *type = find_resource_type(std::string_view(&data[current_offset],
+        strnlen(&data[current_offset], type_length)));
+      entry.type_tag = (type != nullptr) ? type->tag : 0;
+      current_offset += type_length;
     }
 
-    delete[] uncompressed;
-    delete[] compressed;
+    uint32_t fields = (bundle_version >= 2) ? 4 : 3;
+    if (current_offset + (4 * fields) > data_size)
+      break;
+    entry.offset = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset]));
+    entry.compressed_size = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 4]));
+    entry.size = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 8]));
+    if (bundle_version >= 2)
+      entry.flags = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[current_offset + 12]));
+    entry.codec = (entry.flags & EntryFlagStored) ? CodecStore : CodecDeflate;
+    if (entry.codec != CodecStore)
+      entry.flags |= EntryFlagAutomaticCodec;
+    current_offset += 4 * fields;
+
+    entry.name_hash = hash_name(entry.name);
+    entries.push_back(entry);
   }
 
-  file.close();
+  rebuild_index();
 }
 
-ResourceBundle::~ResourceBundle()
+void
+ResourceBundle::index_entry(uint32_t i)
 {
-  for (const std::pair<std::string, Resource *> &x : resources)
-    delete x.second;
+  size_t mask = name_index.size() - 1;
+  size_t slot = entries[i].name_hash & mask;
+  while (name_index[slot] != 0)
+    slot = (slot + 1) & mask;
+  name_index[slot] = i + 1;
 }
 
-Resource *
-ResourceBundle::get_resource(std::string name)
+void
+ResourceBundle::rebuild_index()
 {
-  if (resources.find(name) == resources.end())
-    return nullptr;
-  return resources[name];
+  // Keep the table at most half full so probe sequences stay short
+  size_t capacity = 16;
+  while (capacity < entries.size() * 2)
+    capacity *= 2;
+
+  name_index = std::vector<uint32_t>(capacity, 0);
+  for (uint32_t i = 0; i < entries.size(); ++i)
+    index_entry(i);
 }
 
-void
-ResourceBundle::add_resource(std::string name, const Resource *resource)
+ResourceBundle::Entry *
+ResourceBundle::find_entry(std::string_view name)
 {
-  // TODO: search the map for something with this name already and throw
-  // an exception if this already exists
-  resources[name] = resource->duplicate();
+  if (name_index.empty())
+    return nullptr;
+
+  uint64_t hash = hash_name(name);
+  size_t mask = name_index.size() - 1;
+  for (size_t slot = hash & mask; name_index[slot] != 0; slot = (slot + 1) & mask)
+  {
+    Entry &entry = entries[name_index[slot] - 1];
+    if (entry.name_hash == hash && entry.name == name)
+      return &entry;
+  }
+  return nullptr;
 }
 
-#ifdef RESOURCE_IMPORTER
-void
-ResourceBundle::write_to(std::string path)
+const char *
+ResourceBundle::get_entry_data(const Entry &entry) const
 {
-  std::ofstream file = std::ofstream();
-  file.open(path, std::ios_base::binary);
-  write_to(file);
-  file.close();
+  if (mapping == nullptr || !mapping->is_open()
+      || entry.offset > mapping->get_size()
+      || entry.compressed_size > mapping->get_size() - entry.offset)
+    return nullptr;
+  return &mapping->get_data()[entry.offset];
 }
 
-void
-ResourceBundle::write_to(std::ostream &out)
+bool
+ResourceBundle::decode(uint32_t codec, const char *src, size_t src_size,
+  unsigned char *dst, size_t dst_size) const
 {
-  uint32_t header_size = 4 + 4 + 4;
-  Header header = {};
-  header.bundle_version = 1;
-  for (const std::pair<std::string, Resource *> &x : resources)
+  const unsigned char *compressed = reinterpret_cast<const unsigned char *>(src);
+  if (codec == CodecStore)
+  {
+    if (src_size != dst_size)
+      return false;
+    memcpy(dst, compressed, dst_size);
+    return true;
+  }
+  else if (codec == CodecDeflate)
   {
-    HeaderResourceDescriptor entry = {};
-    entry.resource_name = x.first;
-    entry.resource_type = x.second->get_type();
-    entry.offset = 0;
-    entry.compressed_size = 0;
-    entry.size = 0;
+    unsigned long uncompressed_size = dst_size;
+    unsigned long compressed_size = src_size;
+    int err = uncompress2(dst, &uncompressed_size, compressed, &compressed_size);
+    return err == Z_OK && uncompressed_size == dst_size;
+  }
+  else if (codec == CodecLZ)
+  {
+    return lz_decompress(compressed, src_size, dst, dst_size);
+  }
+  else if (codec == CodecDeflateDictionary)
+  {
+    return inflate_with_dictionary(compressed, src_size, dst, dst_size, dictionary);
+  }
+  return false;
+}
 
-    header.entries.push_back(entry);
+uint64_t
+ResourceBundle::get_chunk_size(const Entry &entry) const
+{
+  if (!(entry.flags & EntryFlagChunked))
+    return entry.size;
 
-    header_size += x.first.length() + 5;
-    header_size += x.second->get_type().length() + 5;
-    header_size += 4 + 4 + 4;
-  }
+  const char *data = get_entry_data(entry);
+  if (data == nullptr || entry.compressed_size < 8)
+    return 0;
+  return nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[0]));
+}
 
-  // Temporarily zero out the header
-  for (unsigned int i = 0; i < header_size; ++i)
-    out.put(0x00);
+bool
+ResourceBundle::read_chunk(const Entry &entry, uint64_t chunk,
+  unsigned char *dst) const
+{
+  const char *data = get_entry_data(entry);
+  uint64_t chunk_size = get_chunk_size(entry);
+  if (data == nullptr || chunk_size == 0 || chunk >= (entry.size + chunk_size - 1) / chunk_size)
+    return false;
+  uint64_t length = std::min(chunk_size, entry.size - (chunk * chunk_size));
+
+  if (!(entry.flags & EntryFlagChunked))
+    return decode(entry.codec, data, entry.compressed_size, dst, length);
+
+  // Chunked entries start with the chunk size and count, then where each
+  // chunk starts relative to the entry, and where the last one ends
+  uint32_t chunk_count = nbo_to_host(*reinterpret_cast<const uint32_t *>(&data[4]));
+  if (chunk >= chunk_count || 8 + ((uint64_t(chunk_count) + 1) * 8) > entry.compressed_size)
+    return false;
+  uint64_t start = nbo_to_host(*reinterpret_cast<const uint64_t *>(&data[8 + (chunk * 8)]));
+  uint64_t end = nbo_to_host(*reinterpret_cast<const uint64_t *>(&data[8 + ((chunk + 1) * 8)]));
+  if (start > end || end > entry.compressed_size)
+    return false;
+  return decode(entry.codec, &data[start], end - start, dst, length);
+}
+
+ResourceHandle<Resource>
+ResourceBundle::load_entry(const Entry &entry)
+{
+  const char *data = get_entry_data(entry);
+  if (data == nullptr || entry.size > UINT32_MAX)
+    return ResourceHandle<Resource>();
 
-  // Compress each resource and write it to the body
-  uint32_t current_offset = header_size;
-  for (unsigned int i = 0; i < header.entries.size(); ++i)
+  const ResourceType *type = find_resource_type(entry.type_tag);
+  if (type == nullptr)
   {
-    Resource *r = resources[header.entries[i].resource_name];
-    std::stringstream resource_out = std::stringstream();
+    // TODO: handle unsupported types
+    return ResourceHandle<Resource>();
+  }
+
+  if (entry.codec == CodecStore)
+  {
+    // Stored entries can be used straight out of the mapping. Only image
+    // pixels, text, mesh arrays, and glyph blocks are big enough to be worth
+    // borrowing, and those hold on to the mapping until they are freed.
+    if (type->view_data != nullptr)
+    {
+      Resource *view = type->view_data(data, uint32_t(entry.size));
+      if (view == nullptr)
+        return ResourceHandle<Resource>();
+      std::shared_ptr<MappedFile> borrowed = mapping;
+      return ResourceHandle<Resource>(std::shared_ptr<Resource>(view,
+        [borrowed](Resource *r) { delete r; }));
+    }
+    return ResourceHandle<Resource>(type->from_data(data, uint32_t(entry.size)));
+  }
 
-    uint32_t raw_size = r->append_to(resource_out);
-    unsigned char *raw_data = new unsigned char[raw_size];
-    memcpy(raw_data, resource_out.str().data(), raw_size);
+  unsigned char *uncompressed = new unsigned char[entry.size];
+  uint64_t chunk_size = get_chunk_size(entry);
+  bool decoded = (chunk_size != 0);
+  for (uint64_t chunk = 0; decoded && chunk * chunk_size < entry.size; ++chunk)
+    decoded = read_chunk(entry, chunk, &uncompressed[chunk * chunk_size]);
 
-    unsigned long compressed_size = compressBound((unsigned long)raw_size);
-    unsigned char *compressed = new unsigned char[compressed_size];
-    compress2(compressed, &compressed_size, raw_data, (unsigned long)raw_size, 9);
+  // Corrupt entries and unknown codecs give an empty handle, which the
+  // caller remembers
+  Resource *resource = nullptr;
+  if (decoded)
+    resource = type->from_data(reinterpret_cast<char *>(uncompressed), uint32_t(entry.size));
 
-    delete[] raw_data;
+  delete[] uncompressed;
 
-    out.write(reinterpret_cast<const char *>(compressed), compressed_size);
+  return ResourceHandle<Resource>(resource);
+}
 
-    delete[] compressed;
+Resource *
+ResourceBundle::get_resource(std::string_view name)
+{
+  return get_handle(name).get();
+}
 
-    header.entries[i].offset = current_offset;
-    header.entries[i].compressed_size = uint32_t(compressed_size);
-    header.entries[i].size = raw_size;
+ResourceHandle<Resource>
+ResourceBundle::get_handle(std::string_view name)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+    return ResourceHandle<Resource>();
 
-    current_offset += compressed_size;
+  if (!entry->resource && !entry->failed)
+  {
+    entry->resource = load_entry(*entry);
+    entry->failed = !entry->resource;
   }
+  entry->last_used = ++use_clock;
+  return entry->resource;
+}
 
-  // Now that we have the data, go back and fill in the header with sizes
-  out.seekp(0);
-
-  // Magic number
-  out.put(0x46);
-  out.put(0x50);
-  out.put(0x32);
-  out.put(0x44);
+void
+ResourceBundle::preload(const std::vector<std::string> &names, WorkerPool *pool)
+{
+  if (pool == nullptr)
+  {
+    for (const std::string &name : names)
+      get_resource(name);
+    return;
+  }
 
-  // Version
+  // Collect the entries that still need to be decoded. Each entry has its own
+  // offset in the mapping, so they can be inflated and parsed independently.
+  std::vector<Entry *> pending;
+  for (const std::string &name : names)
   {
-    uint32_t version_nbo = host_to_nbo(header.bundle_version);
-    out.write(reinterpret_cast<const char *>(&version_nbo), sizeof(version_nbo));
+    Entry *entry = find_entry(name);
+    if (entry == nullptr || entry->resource || entry->failed
+        || std::find(pending.begin(), pending.end(), entry) != pending.end())
+      continue;
+    pending.push_back(entry);
   }
 
-  // Table describing resources
+  // Start the biggest entries first so that one large scene or audio track
+  // doesn't end up running alone at the end
+  std::sort(pending.begin(), pending.end(),
+    [](const Entry *a, const Entry *b) {
+      return a->size > b->size;
+    });
+
+  std::vector<ResourceHandle<Resource>> decoded =
+    std::vector<ResourceHandle<Resource>>(pending.size());
+  std::vector<std::future<void>> jobs;
+  for (size_t i = 0; i < pending.size(); ++i)
   {
-    uint32_t table_length_nbo = host_to_nbo(uint32_t(header.entries.size()));
-    out.write(reinterpret_cast<const char *>(&table_length_nbo),
-      sizeof(table_length_nbo));
+    jobs.push_back(pool->submit([this, &pending, &decoded, i]() {
+      decoded[i] = load_entry(*pending[i]);
+    }));
   }
+  for (std::future<void> &job : jobs)
+    job.wait();
 
-  for (unsigned int i = 0; i < header.entries.size(); ++i)
+  // Only this thread touches the entries
+  for (size_t i = 0; i < pending.size(); ++i)
   {
+    pending[i]->resource = decoded[i];
+    pending[i]->failed = !decoded[i];
+  }
+}
+
+void
+ResourceBundle::preload_all(WorkerPool *pool)
+{
+  preload(get_resource_names(), pool);
+}
+
+std::vector<std::string>
+ResourceBundle::get_resource_names() const
+{
+  std::vector<std::string> names = std::vector<std::string>();
+  for (const Entry &entry : entries)
+    names.push_back(entry.name);
+  return names;
+}
+
+ResourceHandle<Resource>
+ResourceBundle::decode_resource(std::string_view name)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+    return ResourceHandle<Resource>();
+  return load_entry(*entry);
+}
+
+ResourceHandle<Resource>
+ResourceBundle::insert_decoded(std::string_view name,
+  ResourceHandle<Resource> resource)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+    return ResourceHandle<Resource>();
+
+  if (!entry->resource)
+  {
+    entry->resource = resource;
+    entry->failed = !resource;
+  }
+  entry->last_used = ++use_clock;
+  return entry->resource;
+}
+
+std::vector<ResourceBundle::ResidentResource>
+ResourceBundle::get_resident_resources() const
+{
+  std::vector<ResidentResource> resident = std::vector<ResidentResource>();
+  for (const Entry &entry : entries)
+  {
+    if (!entry.resource)
+      continue;
+
+    ResidentResource r = {};
+    r.name = entry.name;
+    r.resource = entry.resource.get();
+    r.last_used = entry.last_used;
+    r.shared = entry.resource.get_shared().use_count() > 1;
+    resident.push_back(r);
+  }
+  return resident;
+}
+
+void
+ResourceBundle::unload(std::string_view name)
+{
+  Entry *entry = find_entry(name);
+  if (entry != nullptr)
+    entry->resource = ResourceHandle<Resource>();
+}
+
+uint64_t
+ResourceBundle::get_entry_size(std::string_view name)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+    return 0;
+  return entry->size;
+}
+
+size_t
+ResourceBundle::read_range(std::string_view name, uint64_t offset, char *out,
+  size_t length)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr || offset >= entry->size)
+    return 0;
+  length = size_t(std::min(uint64_t(length), entry->size - offset));
+
+  const char *data = get_entry_data(*entry);
+  if (data == nullptr)
+    return 0;
+  if (entry->codec == CodecStore)
+  {
+    memcpy(out, &data[offset], length);
+    return length;
+  }
+
+  uint64_t chunk_size = get_chunk_size(*entry);
+  if (chunk_size == 0)
+    return 0;
+
+  std::vector<unsigned char> chunk_data = std::vector<unsigned char>();
+  size_t copied = 0;
+  while (copied < length)
+  {
+    uint64_t position = offset + copied;
+    uint64_t chunk = position / chunk_size;
+    uint64_t chunk_start = chunk * chunk_size;
+    uint64_t chunk_length = std::min(chunk_size, entry->size - chunk_start);
+    size_t count = size_t(std::min(uint64_t(length - copied),
+      chunk_start + chunk_length - position));
+
+    // Whole chunks can be decoded straight into the output
+    if (position == chunk_start && count == chunk_length)
+    {
+      if (!read_chunk(*entry, chunk, reinterpret_cast<unsigned char *>(&out[copied])))
+        break;
+    }
+    else
+    {
+      chunk_data.resize(chunk_length);
+      if (!read_chunk(*entry, chunk, chunk_data.data()))
+        break;
+      memcpy(&out[copied], &chunk_data[position - chunk_start], count);
+    }
+    copied += count;
+  }
+  return copied;
+}
+
+ResourceBundle::EntryStream *
+ResourceBundle::open_entry(std::string_view name)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+    return nullptr;
+  return new EntryStream(this, entry);
+}
+
+ResourceBundle::EntryStreamBuffer::EntryStreamBuffer(const ResourceBundle *_bundle,
+  const Entry *_entry) :
+  bundle(_bundle), entry(_entry), chunk_data(), chunk_start(0)
+{
+
+}
+
+bool
+ResourceBundle::EntryStreamBuffer::load(uint64_t position)
+{
+  const char *data = bundle->get_entry_data(*entry);
+  uint64_t chunk_size = bundle->get_chunk_size(*entry);
+  if (position >= entry->size || data == nullptr || chunk_size == 0)
+  {
+    setg(nullptr, nullptr, nullptr);
+    chunk_start = std::min(position, entry->size);
+    return false;
+  }
+
+  // Stored entries are read from the mapping directly
+  if (entry->codec == CodecStore)
+  {
+    char *begin = const_cast<char *>(data);
+    setg(begin, begin + position, begin + entry->size);
+    chunk_start = 0;
+    return true;
+  }
+
+  uint64_t chunk = position / chunk_size;
+  chunk_start = chunk * chunk_size;
+  chunk_data.resize(std::min(chunk_size, entry->size - chunk_start));
+  if (!bundle->read_chunk(*entry, chunk, reinterpret_cast<unsigned char *>(chunk_data.data())))
+  {
+    setg(nullptr, nullptr, nullptr);
+    return false;
+  }
+  setg(chunk_data.data(), chunk_data.data() + (position - chunk_start),
+    chunk_data.data() + chunk_data.size());
+  return true;
+}
+
+ResourceBundle::EntryStreamBuffer::int_type
+ResourceBundle::EntryStreamBuffer::underflow()
+{
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+
+  if (!load(chunk_start + (egptr() - eback())))
+    return traits_type::eof();
+  return traits_type::to_int_type(*gptr());
+}
+
+ResourceBundle::EntryStreamBuffer::pos_type
+ResourceBundle::EntryStreamBuffer::seekoff(off_type off,
+  std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+  if (!(which & std::ios_base::in))
+    return pos_type(off_type(-1));
+
+  off_type base = 0;
+  if (dir == std::ios_base::cur)
+    base = off_type(chunk_start + (gptr() - eback()));
+  else if (dir == std::ios_base::end)
+    base = off_type(entry->size);
+
+  off_type target = base + off;
+  if (target < 0 || uint64_t(target) > entry->size)
+    return pos_type(off_type(-1));
+
+  // Stay in the current chunk if we can
+  uint64_t position = uint64_t(target);
+  if (position >= chunk_start && position < chunk_start + (egptr() - eback()))
+    setg(eback(), eback() + (position - chunk_start), egptr());
+  else
+    load(position);
+  return pos_type(target);
+}
+
+ResourceBundle::EntryStreamBuffer::pos_type
+ResourceBundle::EntryStreamBuffer::seekpos(pos_type pos,
+  std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+ResourceBundle::EntryStream::EntryStream(const ResourceBundle *_bundle,
+  const Entry *_entry) :
+  std::istream(nullptr), buffer(_bundle, _entry)
+{
+  rdbuf(&buffer);
+}
+
+void
+ResourceBundle::add_resource(std::string name, ResourceHandle<Resource> resource,
+  Codec codec)
+{
+  const ResourceType *type = find_resource_type(resource->get_type());
+  if (type == nullptr)
+  {
+    // TODO: handle unsupported types
+    return;
+  }
+
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+  {
+    Entry new_entry = {};
+    new_entry.name = name;
+    new_entry.name_hash = hash_name(name);
+    entries.push_back(new_entry);
+    if (entries.size() * 2 > name_index.size())
+      rebuild_index();
+    else
+      index_entry(uint32_t(entries.size() - 1));
+    entry = &entries.back();
+  }
+
+  // Adding a resource under a name that is taken replaces it
+  entry->resource = std::move(resource);
+  entry->type_tag = type->tag;
+  entry->flags = 0;
+  entry->codec = codec;
+  entry->modified = true;
+  entry->failed = false;
+}
+
+void
+ResourceBundle::add_resource(std::string name, const Resource *resource,
+  Codec codec)
+{
+  add_resource(name, ResourceHandle<Resource>(resource->duplicate()), codec);
+}
+
+void
+ResourceBundle::remove_resource(std::string_view name)
+{
+  Entry *entry = find_entry(name);
+  if (entry == nullptr)
+    return;
+
+  entries.erase(entries.begin() + (entry - entries.data()));
+  rebuild_index();
+}
+
+uint32_t
+ResourceBundle::get_journal_length() const
+{
+  return journal_length;
+}
+
+#ifdef RESOURCE_IMPORTER
+namespace
+{
+
+/* An output stream buffer that serializes straight into a growable byte
+   vector. Unlike a stringstream, the contents can be handed to deflate without
+   copying them out first. Seeking backwards is supported since some resources
+   patch their own headers once the rest has been written. */
+class EntryBuffer : public std::streambuf
+{
+  std::vector<char> data;
+  size_t length;
+
+  void
+  update_length()
+  {
+    length = std::max(length, size_t(pptr() - pbase()));
+  }
+protected:
+  int_type
+  overflow(int_type c)
+  {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+      return traits_type::not_eof(c);
+
+    size_t position = pptr() - pbase();
+    update_length();
+    data.resize(std::max(data.size() * 2, size_t(4096)));
+    setp(data.data(), data.data() + data.size());
+    pbump(int(position));
+
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+  }
+
+  pos_type
+  seekoff(off_type off, std::ios_base::seekdir dir,
+    std::ios_base::openmode which)
+  {
+    if (!(which & std::ios_base::out))
+      return pos_type(off_type(-1));
+
+    update_length();
+    off_type base = 0;
+    if (dir == std::ios_base::cur)
+      base = pptr() - pbase();
+    else if (dir == std::ios_base::end)
+      base = off_type(length);
+
+    off_type target = base + off;
+    if (target < 0 || target > off_type(length))
+      return pos_type(off_type(-1));
+
+    setp(data.data(), data.data() + data.size());
+    pbump(int(target));
+    return pos_type(target);
+  }
+
+  pos_type
+  seekpos(pos_type pos, std::ios_base::openmode which)
+  {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+public:
+  EntryBuffer() :
+    data(), length(0)
+  {
+
+  }
+
+  const char *
+  get_data() const
+  {
+    return data.data();
+  }
+
+  size_t
+  get_size()
+  {
+    update_length();
+    return length;
+  }
+};
+
+struct EncodedEntry
+{
+  EntryBuffer raw;
+  std::vector<unsigned char> compressed;
+  uint32_t raw_size;
+  ResourceBundle::Codec codec;
+
+  // Set for entries that get a codec picked for them, which are stored if
+  // compressing them barely helps
+  bool automatic;
+
+  bool chunked;
+};
+
+// Appends the compressed data to out
+bool
+compress_data(ResourceBundle::Codec codec, const unsigned char *src,
+  size_t src_size, std::vector<unsigned char> &out,
+  std::span<const unsigned char> dictionary)
+{
+  size_t start = out.size();
+  size_t compressed_size = 0;
+  if (codec == ResourceBundle::CodecDeflate)
+  {
+    unsigned long deflated_size = compressBound((unsigned long)src_size);
+    out.resize(start + deflated_size);
+    if (compress2(&out[start], &deflated_size, src, (unsigned long)src_size, 9) == Z_OK)
+      compressed_size = deflated_size;
+  }
+  else if (codec == ResourceBundle::CodecLZ)
+  {
+    out.resize(start + lz_compress_bound(src_size));
+    compressed_size = lz_compress(src, src_size, &out[start], out.size() - start);
+  }
+  else if (codec == ResourceBundle::CodecDeflateDictionary)
+  {
+    out.resize(start + compressBound((unsigned long)src_size));
+    compressed_size = deflate_with_dictionary(src, src_size, &out[start],
+      out.size() - start, dictionary);
+  }
+  out.resize(start + compressed_size);
+  return compressed_size != 0;
+}
+
+void
+compress_entry(EncodedEntry *e, std::span<const unsigned char> dictionary)
+{
+  if (e->codec == ResourceBundle::CodecStore)
+    return;
+
+  const unsigned char *raw = reinterpret_cast<const unsigned char *>(e->raw.get_data());
+  bool compressed = true;
+  e->chunked = (e->raw_size > entry_chunk_size);
+  if (!e->chunked)
+  {
+    compressed = compress_data(e->codec, raw, e->raw_size, e->compressed, dictionary);
+  }
+  else
+  {
+    // The chunk size and count, then where each chunk starts relative to the
+    // entry, and where the last one ends
+    uint32_t chunk_count = (e->raw_size + entry_chunk_size - 1) / entry_chunk_size;
+    e->compressed.resize(8 + ((size_t(chunk_count) + 1) * 8));
+    {
+      uint32_t chunk_size_nbo = host_to_nbo(entry_chunk_size);
+      memcpy(&e->compressed[0], &chunk_size_nbo, sizeof(chunk_size_nbo));
+      uint32_t chunk_count_nbo = host_to_nbo(chunk_count);
+      memcpy(&e->compressed[4], &chunk_count_nbo, sizeof(chunk_count_nbo));
+    }
+    for (uint32_t i = 0; i <= chunk_count; ++i)
+    {
+      uint64_t start_nbo = host_to_nbo(uint64_t(e->compressed.size()));
+      memcpy(&e->compressed[8 + (i * 8)], &start_nbo, sizeof(start_nbo));
+      if (i == chunk_count)
+        break;
+
+      uint32_t chunk_start = i * entry_chunk_size;
+      compressed = compressed && compress_data(e->codec, &raw[chunk_start],
+        std::min(entry_chunk_size, e->raw_size - chunk_start), e->compressed,
+        dictionary);
+    }
+  }
+
+  if (!compressed
+      || (e->automatic && e->compressed.size() >= e->raw_size - (e->raw_size / 8)))
+  {
+    e->codec = ResourceBundle::CodecStore;
+    e->chunked = false;
+    e->compressed = std::vector<unsigned char>();
+  }
+}
+
+}
+
+void
+ResourceBundle::write_to(std::string path, WorkerPool *pool)
+{
+  std::ofstream file = std::ofstream();
+  file.open(path, std::ios_base::binary);
+  write_to(file, pool);
+  file.close();
+}
+
+void
+ResourceBundle::write_to(std::ostream &out, WorkerPool *pool)
+{
+  // Entries that were never requested still need to be written out. Ones
+  // that can't be decoded are dropped. The copies made here describe the new
+  // file, so the entries of this bundle keep pointing into the mapped one.
+  std::vector<Entry> written = std::vector<Entry>();
+  for (Entry &entry : entries)
+  {
+    if (get_resource(entry.name) != nullptr)
+      written.push_back(entry);
+  }
+
+  write_body(out, written, std::span<const unsigned char>(), true,
+    [&out](const std::vector<Entry> &table) {
+      uint64_t header_size = bundle_header_size
+        + (uint64_t(table.size()) * bundle_entry_size)
+        + get_string_table_size(table);
+
+      // Temporarily zero out the header
+      for (uint64_t i = 0; i < header_size; ++i)
+        out.put(0x00);
+      return header_size;
+    }, pool);
+
+  // Now that we have the data, go back and fill in the header with sizes
+  out.seekp(0);
+
+  // Magic number
+  out.put(0x46);
+  out.put(0x50);
+  out.put(0x32);
+  out.put(0x44);
+
+  // Version
+  {
+    uint32_t version_nbo = host_to_nbo(current_bundle_version);
+    out.write(reinterpret_cast<const char *>(&version_nbo), sizeof(version_nbo));
+  }
+
+  {
+    uint32_t entry_count_nbo = host_to_nbo(uint32_t(written.size()));
+    out.write(reinterpret_cast<const char *>(&entry_count_nbo),
+      sizeof(entry_count_nbo));
+  }
+
+  {
+    uint32_t string_table_size_nbo = host_to_nbo(get_string_table_size(written));
+    out.write(reinterpret_cast<const char *>(&string_table_size_nbo),
+      sizeof(string_table_size_nbo));
+  }
+
+  write_table(out, written);
+}
+
+void
+ResourceBundle::append_changes(WorkerPool *pool)
+{
+  if (path.empty())
+    return;
+
+  // Older files have no room for a journal, so they are upgraded first
+  if (mapping == nullptr || !mapping->is_open() || version < 4)
+  {
+    compact(pool);
+    return;
+  }
+
+  std::vector<Entry> appended = std::vector<Entry>();
+  for (const Entry &entry : entries)
+  {
+    if (entry.modified && entry.resource)
+      appended.push_back(entry);
+  }
+
+  std::fstream file = std::fstream();
+  file.open(path, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+  if (!file.is_open())
+    return;
+
+  // Nothing already in the file is touched, other than the version
+  uint64_t current_offset = mapping->get_size();
+  file.seekp(current_offset);
+  write_body(file, appended, dictionary, false,
+    [current_offset](const std::vector<Entry> &) {
+      return current_offset;
+    }, pool);
+
+  // The new table lists every entry, pointing at the appended copies of the
+  // ones that changed
+  std::vector<Entry> table = std::vector<Entry>();
+  for (const Entry &entry : entries)
+  {
+    if (!entry.modified)
+      table.push_back(entry);
+  }
+  table.insert(table.end(), appended.begin(), appended.end());
+
+  if (dictionary.size() > 0)
+  {
+    Entry dictionary_entry = {};
+    dictionary_entry.name_hash = hash_name("");
+    dictionary_entry.type_tag = dictionary_type_tag;
+    dictionary_entry.codec = CodecStore;
+    dictionary_entry.offset = reinterpret_cast<const char *>(dictionary.data())
+      - mapping->get_data();
+    dictionary_entry.compressed_size = dictionary.size();
+    dictionary_entry.size = dictionary.size();
+    table.push_back(dictionary_entry);
+  }
+
+  std::sort(table.begin(), table.end(),
+    [](const Entry &a, const Entry &b) {
+      if (a.name_hash != b.name_hash)
+        return a.name_hash < b.name_hash;
+      return a.name < b.name;
+    });
+
+  // The table is read in place, so it is aligned like the header
+  current_offset = file.tellp();
+  while (current_offset % 16 != 0)
+  {
+    file.put(0x00);
+    current_offset += 1;
+  }
+  uint64_t table_offset = current_offset;
+
+  {
+    uint32_t magic_nbo = host_to_nbo(journal_table_magic);
+    file.write(reinterpret_cast<const char *>(&magic_nbo), sizeof(magic_nbo));
+    uint32_t journal_length_nbo = host_to_nbo(journal_length + 1);
+    file.write(reinterpret_cast<const char *>(&journal_length_nbo),
+      sizeof(journal_length_nbo));
+    uint32_t entry_count_nbo = host_to_nbo(uint32_t(table.size()));
+    file.write(reinterpret_cast<const char *>(&entry_count_nbo),
+      sizeof(entry_count_nbo));
+    uint32_t string_table_size_nbo = host_to_nbo(get_string_table_size(table));
+    file.write(reinterpret_cast<const char *>(&string_table_size_nbo),
+      sizeof(string_table_size_nbo));
+  }
+  write_table(file, table);
+
+  current_offset = file.tellp();
+  while (current_offset % 8 != 0)
+  {
+    file.put(0x00);
+    current_offset += 1;
+  }
+
+  {
+    uint64_t table_offset_nbo = host_to_nbo(table_offset);
+    file.write(reinterpret_cast<const char *>(&table_offset_nbo),
+      sizeof(table_offset_nbo));
+    uint32_t magic_nbo = host_to_nbo(journal_trailer_magic);
+    file.write(reinterpret_cast<const char *>(&magic_nbo), sizeof(magic_nbo));
+    uint32_t padding = 0;
+    file.write(reinterpret_cast<const char *>(&padding), sizeof(padding));
+  }
+
+  if (version < current_bundle_version)
+  {
+    file.seekp(4);
+    uint32_t version_nbo = host_to_nbo(current_bundle_version);
+    file.write(reinterpret_cast<const char *>(&version_nbo), sizeof(version_nbo));
+  }
+  file.close();
+
+  reopen();
+}
+
+void
+ResourceBundle::compact(WorkerPool *pool)
+{
+  if (path.empty())
+    return;
+
+  // Write next to the old file and then replace it
+  std::string compacted_path = path + ".compact";
+  write_to(compacted_path, pool);
+
+  /* Not every platform will replace a file that is still mapped, so the
+     resources borrowing from the mapping get copies of their own and the
+     mapping is let go first. */
+  for (Entry &entry : entries)
+  {
+    const ResourceType *type = find_resource_type(entry.type_tag);
+    if (entry.resource && !entry.modified && entry.codec == CodecStore
+        && type != nullptr && type->view_data != nullptr)
+      entry.resource = ResourceHandle<Resource>(entry.resource->duplicate());
+  }
+  dictionary = std::span<const unsigned char>();
+  mapping = nullptr;
+
+  // Something else may still be borrowing from the old file, in which case
+  // it is kept as it was
+  std::error_code error = std::error_code();
+  std::filesystem::rename(compacted_path, path, error);
+  if (error)
+    std::filesystem::remove(compacted_path, error);
+
+  reopen();
+}
+
+void
+ResourceBundle::write_body(std::ostream &out, std::vector<Entry> &table,
+  std::span<const unsigned char> shared_dictionary, bool train,
+  std::function<uint64_t(const std::vector<Entry> &)> begin_body,
+  WorkerPool *pool)
+{
+  // The table is sorted by name hash, and the body follows the same order
+  std::sort(table.begin(), table.end(),
+    [](const Entry &a, const Entry &b) {
+      if (a.name_hash != b.name_hash)
+        return a.name_hash < b.name_hash;
+      return a.name < b.name;
+    });
+
+  WorkerPool *local_pool = nullptr;
+  if (pool == nullptr)
+  {
+    local_pool = new WorkerPool();
+    pool = local_pool;
+  }
+
+  // Serialize every resource on the pool
+  std::vector<EncodedEntry> encoded = std::vector<EncodedEntry>(table.size());
+  std::vector<std::future<void>> jobs;
+  for (unsigned int i = 0; i < table.size(); ++i)
+  {
+    const Resource *r = table[i].resource.get();
+    EncodedEntry *e = &encoded[i];
+
+    /* Entries read back from a bundle have the codec they were written
+       with. Only automatic entries are ever given the dictionary, which
+       marks them in bundles written before there was a flag for it. */
+    e->automatic = (table[i].codec == CodecAuto)
+      || (table[i].codec == CodecDeflateDictionary)
+      || (table[i].flags & EntryFlagAutomaticCodec);
+    e->chunked = false;
+    e->codec = Codec(table[i].codec);
+    if (e->automatic)
+      e->codec = find_resource_type(table[i].type_tag)->default_codec;
+
+    jobs.push_back(pool->submit([r, e]() {
+      std::ostream resource_out = std::ostream(&e->raw);
+      e->raw_size = r->append_to(resource_out);
+    }));
+  }
+  for (std::future<void> &job : jobs)
+    job.get();
+
+  // Train a dictionary on the small entries that are going to be compressed,
+  // if there are enough of them for it to pay off
+  std::vector<unsigned char> trained_dictionary = std::vector<unsigned char>();
+  if (train)
+  {
+    std::vector<std::span<const unsigned char>> samples;
+    for (const EncodedEntry &e : encoded)
     {
-      uint32_t name_length_nbo = host_to_nbo(uint32_t(header.entries[i].resource_name.length() + 1));
-      out.write(reinterpret_cast<const char *>(&name_length_nbo),
-        sizeof(name_length_nbo));
-    }
-    out.write(reinterpret_cast<const char *>(header.entries[i].resource_name.c_str()),
-      header.entries[i].resource_name.length() + 1);
-    {
-      uint32_t type_length_nbo = host_to_nbo(uint32_t(header.entries[i].resource_type.length() + 1));
-      out.write(reinterpret_cast<const char *>(&type_length_nbo),
-        sizeof(type_length_nbo));
-    }
-    out.write(reinterpret_cast<const char *>(header.entries[i].resource_type.c_str()),
-      header.entries[i].resource_type.length() + 1);
-    {
-      uint32_t offset_nbo = host_to_nbo(header.entries[i].offset);
-      out.write(reinterpret_cast<const char *>(&offset_nbo),
-        sizeof(offset_nbo));
+      if (e.automatic && e.codec != CodecStore && e.raw_size <= small_entry_size)
+        samples.push_back(std::span<const unsigned char>(
+          reinterpret_cast<const unsigned char *>(e.raw.get_data()), e.raw_size));
     }
+
+    if (samples.size() >= dictionary_min_samples)
+      trained_dictionary = train_dictionary(samples, dictionary_capacity);
+    shared_dictionary = trained_dictionary;
+  }
+
+  if (shared_dictionary.size() > 0)
+  {
+    for (EncodedEntry &e : encoded)
     {
-      uint32_t compressized_size_nbo = host_to_nbo(header.entries[i].compressed_size);
-      out.write(reinterpret_cast<const char *>(&compressized_size_nbo),
-        sizeof(compressized_size_nbo));
+      if (e.automatic && e.codec != CodecStore && e.raw_size <= small_entry_size)
+        e.codec = CodecDeflateDictionary;
+    }
+  }
+
+  if (trained_dictionary.size() > 0)
+  {
+    // The dictionary goes first, as a stored entry of its own
+    Entry dictionary_entry = {};
+    dictionary_entry.name_hash = hash_name("");
+    dictionary_entry.type_tag = dictionary_type_tag;
+    dictionary_entry.codec = CodecStore;
+    table.insert(table.begin(), dictionary_entry);
+
+    encoded.insert(encoded.begin(), EncodedEntry());
+    encoded[0].raw.sputn(reinterpret_cast<const char *>(trained_dictionary.data()),
+      trained_dictionary.size());
+    encoded[0].raw_size = uint32_t(trained_dictionary.size());
+    encoded[0].codec = CodecStore;
+    encoded[0].automatic = false;
+    encoded[0].chunked = false;
+  }
+
+  uint64_t current_offset = begin_body(table);
+
+  // Compress every entry on the pool
+  jobs.clear();
+  for (unsigned int i = 0; i < table.size(); ++i)
+  {
+    EncodedEntry *e = &encoded[i];
+    jobs.push_back(pool->submit([e, shared_dictionary]() {
+      compress_entry(e, shared_dictionary);
+    }));
+  }
+
+  // Write the body in table order as each entry finishes, releasing the
+  // buffers as we go
+  for (unsigned int i = 0; i < table.size(); ++i)
+  {
+    jobs[i].get();
+    EncodedEntry &e = encoded[i];
+    Entry *entry = &table[i];
+
+    // Stored entries are aligned so that their contents can be used in place
+    // once mapped, and chunked ones so that their chunk index can be read
+    if (e.codec == CodecStore || e.chunked)
+    {
+      while (current_offset % 16 != 0)
+      {
+        out.put(0x00);
+        current_offset += 1;
+      }
+    }
+
+    if (e.codec == CodecStore)
+    {
+      out.write(e.raw.get_data(), e.raw_size);
+      entry->compressed_size = e.raw_size;
+    }
+    else
+    {
+      out.write(reinterpret_cast<const char *>(e.compressed.data()),
+        e.compressed.size());
+      entry->compressed_size = e.compressed.size();
+    }
+
+    entry->codec = e.codec;
+    entry->flags = 0;
+    if (e.chunked)
+      entry->flags |= EntryFlagChunked;
+    if (e.automatic)
+      entry->flags |= EntryFlagAutomaticCodec;
+    entry->offset = current_offset;
+    entry->size = e.raw_size;
+
+    current_offset += entry->compressed_size;
+
+    e.raw = EntryBuffer();
+    e.compressed = std::vector<unsigned char>();
+  }
+  delete local_pool;
+}
+
+uint32_t
+ResourceBundle::get_string_table_size(const std::vector<Entry> &table)
+{
+  uint32_t size = 0;
+  for (const Entry &entry : table)
+    size += uint32_t(entry.name.length());
+  return size;
+}
+
+void
+ResourceBundle::write_table(std::ostream &out, const std::vector<Entry> &table)
+{
+  // Fixed size table describing resources, followed by their names
+  uint32_t name_offset = 0;
+  for (const Entry &entry : table)
+  {
+    {
+      uint64_t name_hash_nbo = host_to_nbo(entry.name_hash);
+      out.write(reinterpret_cast<const char *>(&name_hash_nbo), sizeof(name_hash_nbo));
+    }
+    {
+      uint32_t name_offset_nbo = host_to_nbo(name_offset);
+      out.write(reinterpret_cast<const char *>(&name_offset_nbo), sizeof(name_offset_nbo));
+      uint32_t name_length_nbo = host_to_nbo(uint32_t(entry.name.length()));
+      out.write(reinterpret_cast<const char *>(&name_length_nbo), sizeof(name_length_nbo));
+      name_offset += uint32_t(entry.name.length());
     }
     {
-      uint32_t size_nbo = host_to_nbo(header.entries[i].size);
-      out.write(reinterpret_cast<const char *>(&size_nbo),
-        sizeof(size_nbo));
+      uint32_t type_tag_nbo = host_to_nbo(entry.type_tag);
+      out.write(reinterpret_cast<const char *>(&type_tag_nbo), sizeof(type_tag_nbo));
+    }
+    {
+      uint32_t flags_nbo = host_to_nbo(entry.flags);
+      out.write(reinterpret_cast<const char *>(&flags_nbo), sizeof(flags_nbo));
+      uint32_t codec_nbo = host_to_nbo(entry.codec);
+      out.write(reinterpret_cast<const char *>(&codec_nbo), sizeof(codec_nbo));
+      uint32_t padding = 0;
+      out.write(reinterpret_cast<const char *>(&padding), sizeof(padding));
+    }
+    {
+      uint64_t offset_nbo = host_to_nbo(entry.offset);
+      out.write(reinterpret_cast<const char *>(&offset_nbo), sizeof(offset_nbo));
+    }
+    {
+      uint64_t compressed_size_nbo = host_to_nbo(entry.compressed_size);
+      out.write(reinterpret_cast<const char *>(&compressed_size_nbo),
+        sizeof(compressed_size_nbo));
+    }
+    {
+      uint64_t size_nbo = host_to_nbo(entry.size);
+      out.write(reinterpret_cast<const char *>(&size_nbo), sizeof(size_nbo));
     }
   }
+
+  for (const Entry &entry : table)
+    out.write(entry.name.data(), entry.name.length());
 }
 #endif
@@ -2,11 +2,20 @@
 #define RESOURCE_H
 
 #include <map>
+#include <set>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <span>
 #include <fstream>
+#include <functional>
+#include <memory>
 
 #include "linear_algebra.h"
+#include "core/texture_compression.h"
+#ifdef RESOURCE_IMPORTER
+#include "core/mipmap.h"
+#endif
 
 // TODO: move these to a util file?
 uint32_t
@@ -21,10 +30,19 @@ nbo_to_host(const uint32_t &x);
 int32_t
 nbo_to_host(const int32_t &x);
 
+uint64_t
+host_to_nbo(const uint64_t &x);
+
+uint64_t
+nbo_to_host(const uint64_t &x);
+
 #ifdef GAME
 class Texture;
 #endif
 
+class MappedFile;
+class WorkerPool;
+
 class Resource
 {
 public:
@@ -37,6 +55,20 @@ public:
   virtual std::string
   get_type() const = 0;
 
+  // Bytes of memory the resource holds, not counting anything it borrows
+  // from a mapped bundle
+  virtual size_t
+  get_cpu_size() const;
+
+  // Bytes of video memory held by textures the resource created
+  virtual size_t
+  get_gpu_size() const;
+
+  // Frees data that can be recreated, or that isn't needed once the resource
+  // has been uploaded. The resource keeps working afterwards.
+  virtual void
+  release_cpu_data();
+
 #ifdef RESOURCE_IMPORTER
   virtual uint32_t // returns size
   append_to(std::ostream &out) const = 0;
@@ -45,16 +77,30 @@ public:
 
 class Image : public Resource
 {
+  enum Storage
+  {
+    Owned,
+    StbAllocated,
+    Borrowed // points into memory owned by someone else, e.g. a mapped bundle
+  };
+
   uint32_t width;
   uint32_t height;
   uint32_t channels;
-  unsigned char *data;
+  TextureFormat format;
+  uint32_t levels;
+  const unsigned char *data;
 
-  bool stb_allocated;
+  Storage storage;
 
 #ifdef GAME
   Texture *texture;
 #endif
+
+  Image();
+
+  size_t
+  get_data_size() const;
 public:
 #ifdef RESOURCE_IMPORTER
   Image(std::string path);
@@ -63,6 +109,12 @@ public:
   Image(uint32_t _width, uint32_t _height, uint32_t _channels,
     const unsigned char *_data);
 
+  /* For pixels in a block compressed format, which still has the channels
+     of the image it was made from, and for images with their mipmaps. The
+     levels follow each other in the data. */
+  Image(uint32_t _width, uint32_t _height, uint32_t _channels,
+    TextureFormat _format, uint32_t _levels, const unsigned char *_data);
+
   ~Image();
 
   Resource *
@@ -71,6 +123,36 @@ public:
   std::string
   get_type() const;
 
+  size_t
+  get_cpu_size() const;
+
+  size_t
+  get_gpu_size() const;
+
+  // Drops the pixels once the texture has been generated
+  void
+  release_cpu_data();
+
+  uint32_t
+  get_channels() const;
+
+  TextureFormat
+  get_format() const;
+
+  uint32_t
+  get_levels() const;
+
+#ifdef RESOURCE_IMPORTER
+  // Adds every mip level below the image
+  void
+  generate_mipmaps(const MipmapOptions &options);
+
+  // Replaces the pixels with blocks in the given format, returning the PSNR
+  // of the first level against the original
+  float
+  compress(TextureFormat _format, TextureQuality quality);
+#endif
+
 #ifdef GAME
   void
   generate_texture();
@@ -82,6 +164,10 @@ public:
   static Image *
   from_data(const char *data, uint32_t length);
 
+  // Like from_data(), but the pixels are referenced instead of copied
+  static Image *
+  view_data(const char *data, uint32_t length);
+
 #ifdef RESOURCE_IMPORTER
   uint32_t
   append_to(std::ostream &out) const;
@@ -90,9 +176,11 @@ public:
 
 struct Glyph
 {
+  // Where the glyph's SDF bitmap sits in the font's atlas, in pixels
+  uint32_t atlas_x;
+  uint32_t atlas_y;
   uint32_t bitmap_width;
   uint32_t bitmap_height;
-  unsigned char *bitmap_data;
 
   int32_t width;
   int32_t height;
@@ -115,37 +203,130 @@ public:
     int32_t y;
   };
 private:
+  struct KerningPair
+  {
+    uint16_t key; // first character in the high byte, second in the low byte
+    Kerning kerning;
+  };
+
   const static std::string chars;
 
-  std::map<char, Glyph> glyph_map;
-  std::map<std::pair<char, char>, Kerning> kerning_table;
+  /* Glyphs are indexed by character. Characters past the end of the table
+     get the empty glyph for '\0'. */
+  const static uint32_t glyph_table_size = 128;
+  std::vector<Glyph> glyphs;
+
+  // Only the pairs with any kerning, sorted by key
+  std::vector<KerningPair> kerning_table;
+
+  /* Glyphs past the table come in blocks of consecutive code points, whose
+     bitmaps stay compressed until a glyph in the block is drawn. They are
+     only decompressed for as long as it takes to copy them to the glyph
+     cache. */
+  struct GlyphBlock
+  {
+    uint32_t first_codepoint;
+    std::vector<Glyph> glyphs;
+
+    // Where each glyph's bitmap starts, or missing_glyph
+    std::vector<uint32_t> bitmap_offsets;
+
+    uint32_t bitmaps_size;
+
+    // Points into compressed_storage, or into the mapped bundle
+    std::span<const unsigned char> compressed_bitmaps;
+    std::vector<unsigned char> compressed_storage;
+
+    std::vector<unsigned char> bitmaps;
+
+    // The bitmaps failed to decompress, so there is no point trying again
+    bool corrupt;
+  };
+
+  const static uint32_t glyph_block_size = 128;
+  const static uint32_t missing_glyph = UINT32_MAX;
+
+  // Sorted by first code point
+  std::vector<GlyphBlock> glyph_blocks;
+
+  // Every glyph bitmap packed into one single channel image
+  uint32_t atlas_width;
+  uint32_t atlas_height;
+  std::vector<unsigned char> atlas;
   #ifdef GAME
-  std::map<char, Texture *> texture_map;
+  Texture *atlas_texture;
   #endif
 
   void
-  add_glyph(const char &c, const Glyph &glyph);
+  pack_atlas(const std::map<char, std::vector<unsigned char>> &bitmaps);
+
+  // Index of the block holding the code point, or the number of blocks
+  size_t
+  find_glyph_block(uint32_t codepoint) const;
+
+  static uint16_t
+  get_kerning_key(char a, char b);
+
+  // Keeps non-zero kerning, which must be followed by sort_kerning_table()
+  void
+  add_kerning(char a, char b, const Kerning &kerning);
+
+  void
+  sort_kerning_table();
 public:
 #ifdef RESOURCE_IMPORTER
-  FontFace(std::string path);
+  /* Printable ASCII always goes in the atlas. Glyphs in the given ranges of
+     code points (first and last) are rendered too, into blocks. */
+  FontFace(std::string path,
+    const std::vector<std::pair<uint32_t, uint32_t>> &ranges
+      = std::vector<std::pair<uint32_t, uint32_t>>());
 #endif
 
   FontFace();
 
   ~FontFace();
 
+  bool
+  has_glyph(uint32_t codepoint) const;
+
+  // Code points the font has no glyph for get the glyph for '?'
   const Glyph &
-  get_glyph(char c);
+  get_glyph(uint32_t codepoint) const;
+
+  // Whether the glyph is drawn from the atlas rather than a block
+  bool
+  is_atlas_glyph(uint32_t codepoint) const;
+
+  /* The bitmap of a glyph from a block, decompressing the block if it isn't
+     already. Null for atlas glyphs, for glyphs the font doesn't have, and
+     when the block is corrupt. The pointer is good until the CPU data is
+     released. */
+  const unsigned char *
+  get_glyph_bitmap(uint32_t codepoint);
+
+  // Largest bitmap of any glyph in a block
+  uint32_t
+  get_max_block_glyph_width() const;
+
+  uint32_t
+  get_max_block_glyph_height() const;
 
-  const Kerning &
-  get_kerning(char a, char b);
+  // Only pairs of characters below U+0100 are kerned
+  Kerning
+  get_kerning(uint32_t a, uint32_t b) const;
+
+  uint32_t
+  get_atlas_width() const;
+
+  uint32_t
+  get_atlas_height() const;
 
 #ifdef GAME
   void
   generate_textures();
 
   Texture *
-  get_texture(char c);
+  get_texture();
 #endif
 
   std::string
@@ -157,9 +338,24 @@ public:
   std::string
   get_type() const;
 
+  size_t
+  get_cpu_size() const;
+
+  size_t
+  get_gpu_size() const;
+
+  // Frees the decompressed glyph blocks
+  void
+  release_cpu_data();
+
   static FontFace *
   from_data(const char *data, uint32_t length);
 
+  // Like from_data(), but the compressed glyph blocks are referenced instead
+  // of copied
+  static FontFace *
+  view_data(const char *data, uint32_t length);
+
 #ifdef RESOURCE_IMPORTER
   uint32_t
   append_to(std::ostream &out) const;
@@ -169,6 +365,9 @@ public:
 class Text : public Resource
 {
   std::string text;
+
+  // Either refers to text or to borrowed memory
+  std::string_view contents;
 public:
   Text(std::string path);
 
@@ -176,7 +375,7 @@ public:
 
   ~Text();
 
-  const std::string &
+  std::string_view
   get_text() const;
 
   Resource *
@@ -185,9 +384,15 @@ public:
   std::string
   get_type() const;
 
+  size_t
+  get_cpu_size() const;
+
   static Text *
   from_data(const char *data, uint32_t length);
 
+  static Text *
+  view_data(const char *data, uint32_t length);
+
 #ifdef RESOURCE_IMPORTER
   uint32_t
   append_to(std::ostream &out) const;
@@ -216,6 +421,18 @@ public:
   std::string
   get_type() const;
 
+  size_t
+  get_cpu_size() const;
+
+  // Drops the decoded samples, keeping only the compressed data
+  void
+  release_cpu_data();
+
+  // Decodes the samples again if they were released. Has to be done before
+  // the track is played.
+  void
+  decode_samples();
+
   unsigned int
   get_channels() const;
 
@@ -246,13 +463,42 @@ struct Vertex
   Vertex(Vec3 _position, Vec2 _texture_coordinates, Vec3 _normal);
 };
 
+/* Half the size of a Vertex, and laid out so that it can be uploaded as is.
+   Positions are quantized to 16 bits within the bounds of their mesh, the
+   texture coordinates are half floats, and the normal is packed as signed
+   normalized 10 bit components (GL_INT_2_10_10_10_REV). */
+struct PackedVertex
+{
+  uint16_t position[3];
+  uint16_t padding;
+  uint16_t texture_coordinates[2];
+  uint32_t normal;
+};
+
 using VertexVector = std::vector<Vertex>;
 using IndexVector = std::vector<unsigned int>;
 
+/* A range of indices drawn with one material. Imported scenes get one range
+   for each mesh in the file, sorted so that ranges sharing a material are
+   next to each other. */
 struct MaterialData
 {
   Vec3 diffuse_color;
-  uint32_t vertices;
+  uint32_t first_index;
+  uint32_t index_count;
+
+  // Which of the imported meshes the range came from
+  uint32_t submesh;
+  uint32_t material;
+};
+
+/* A simplified version of a mesh. It uses the same vertices, and its ranges
+   point at indices stored after the full mesh's. */
+struct LodData
+{
+  // How far the surface may have moved from the full mesh, in model space
+  float error;
+  std::vector<MaterialData> materials;
 };
 
 struct Mesh
@@ -260,12 +506,67 @@ struct Mesh
   VertexVector vertices;
   IndexVector indices;
 
+  /* Meshes loaded straight out of a mapped bundle reference the mapping here
+     and leave the vectors above empty. */
+  std::span<const Vertex> vertex_view;
+  std::span<const unsigned int> index_view;
+
+  /* Packed meshes keep their vertices here instead, and their indices too if
+     they all fit in 16 bits. Positions are relative to the bounds. */
+  std::vector<PackedVertex> packed_vertices;
+  std::vector<uint16_t> short_indices;
+  std::span<const PackedVertex> packed_vertex_view;
+  std::span<const uint16_t> short_index_view;
+  Vec3 bounds_origin;
+  Vec3 bounds_extent;
+
   std::vector<MaterialData> materials;
 
+  // From the finest level to the coarsest
+  std::vector<LodData> lods;
+
   Mesh();
 
   Mesh(const VertexVector &_vertices, const IndexVector &_indices);
 
+  std::span<const Vertex>
+  get_vertices() const;
+
+  std::span<const unsigned int>
+  get_indices() const;
+
+  std::span<const PackedVertex>
+  get_packed_vertices() const;
+
+  std::span<const uint16_t>
+  get_short_indices() const;
+
+  bool
+  is_packed() const;
+
+  uint32_t
+  get_vertex_count() const;
+
+  // Whichever index format the mesh uses
+  uint32_t
+  get_index_count() const;
+
+  // Maps packed positions, which are in [0, 1], back to the model's space
+  Mat4
+  get_position_transform() const;
+
+  // Picks the coarsest level within the allowed error, where 0 is the full
+  // mesh and the rest are offset by one into lods
+  uint32_t
+  select_lod(float max_error) const;
+
+  const std::vector<MaterialData> &
+  get_lod_materials(uint32_t lod) const;
+
+  // Replaces the vertices and indices with their packed forms
+  void
+  pack();
+
   static Mesh *
   primitive_quad();
 
@@ -291,9 +592,15 @@ public:
   std::string
   get_type() const;
 
+  size_t
+  get_cpu_size() const;
+
   static Scene *
   from_data(const char *data, uint32_t length);
 
+  static Scene *
+  view_data(const char *data, uint32_t length);
+
   Mesh *
   get_mesh();
 
@@ -303,43 +610,377 @@ public:
 #endif
 };
 
-class ResourceBundle
+/* Shared ownership of a resource of a known type. Handles can be passed
+   between bundles and screens without copying the resource, which is freed
+   along with the last handle to it. */
+template <typename T>
+class ResourceHandle
 {
-  std::map<std::string, Resource *> resources;
+  std::shared_ptr<T> resource;
+public:
+  ResourceHandle() :
+    resource()
+  {
+
+  }
 
-  struct HeaderResourceDescriptor
+  // Takes ownership of the resource
+  explicit ResourceHandle(T *_resource) :
+    resource(_resource)
   {
-    std::string resource_name;
-    std::string resource_type;
-    uint32_t offset;
-    uint32_t compressed_size;
-    uint32_t size;
+
+  }
+
+  ResourceHandle(std::shared_ptr<T> _resource) :
+    resource(std::move(_resource))
+  {
+
+  }
+
+  // Handles to a derived type convert to handles to its base
+  template <typename U>
+  ResourceHandle(const ResourceHandle<U> &other) :
+    resource(other.get_shared())
+  {
+
+  }
+
+  T *
+  get() const
+  {
+    return resource.get();
+  }
+
+  T *
+  operator->() const
+  {
+    return resource.get();
+  }
+
+  T &
+  operator*() const
+  {
+    return *resource;
+  }
+
+  explicit operator bool() const
+  {
+    return resource != nullptr;
+  }
+
+  const std::shared_ptr<T> &
+  get_shared() const
+  {
+    return resource;
+  }
+
+  // Empty if the resource isn't a U
+  template <typename U>
+  ResourceHandle<U>
+  as() const
+  {
+    return ResourceHandle<U>(std::dynamic_pointer_cast<U>(resource));
+  }
+};
+
+template <typename T, typename... Args>
+ResourceHandle<T>
+make_resource(Args &&... args)
+{
+  return ResourceHandle<T>(std::make_shared<T>(std::forward<Args>(args)...));
+}
+
+class ResourceBundle
+{
+public:
+  // How the data of an entry is compressed in the bundle
+  enum Codec
+  {
+    CodecStore = 0, // uncompressed, and used in place when possible
+    CodecDeflate = 1,
+    CodecLZ = 2, // much faster to decode than deflate, at a lower ratio
+    CodecDeflateDictionary = 3, // deflate primed with the bundle's dictionary
+    CodecAuto = 0xff // chosen when writing, based on the type of resource
   };
+private:
+  enum EntryFlags
+  {
+    EntryFlagStored = 0x1, // versions 2 and 3 only, replaced by the codec
+
+    /* The entry is split into chunks that are compressed independently, so
+       any part of it can be read without decoding what comes before. */
+    EntryFlagChunked = 0x2,
 
-  struct Header
+    /* The codec was picked when the entry was written rather than asked
+       for, so it is picked again whenever the entry is rewritten. */
+    EntryFlagAutomaticCodec = 0x4
+  };
+
+  struct Entry
   {
-    uint32_t bundle_version;
-    std::vector<HeaderResourceDescriptor> entries;
+    std::string name;
+    uint64_t name_hash;
+    uint32_t type_tag;
+    uint32_t flags; // only present from bundle version 2
+    uint32_t codec; // only present from bundle version 4
+    uint64_t offset;
+    uint64_t compressed_size;
+    uint64_t size;
+
+    // Empty until the entry is first requested
+    ResourceHandle<Resource> resource;
+    uint64_t last_used;
+
+    // Added or replaced since the bundle was read
+    bool modified;
+
+    // Couldn't be decoded, so requests for it fail without trying again
+    bool failed;
   };
+
+  // Counts requests across every bundle, to tell which entries were used last
+  static uint64_t use_clock;
+
+  // File the bundle was read from, if any
+  std::string path;
+  uint32_t version;
+
+  // Number of tables appended to the file since it was last written whole
+  uint32_t journal_length;
+
+  /* Only the table of contents is read when a bundle is opened. The file is
+     mapped so that entries can be decompressed the first time they are
+     requested, and stored entries can be used in place. */
+  std::shared_ptr<MappedFile> mapping;
+  std::vector<Entry> entries;
+
+  /* Small entries share a dictionary trained when the bundle is written, so
+     they don't each start compressing from nothing. It is a stored entry of
+     its own, and refers to the mapping. */
+  std::span<const unsigned char> dictionary;
+
+  /* Open addressing table keyed on the name hash, so lookups don't need to
+     allocate or compare more than one name. Each slot holds an index into
+     entries plus one, and zero marks an empty slot. */
+  std::vector<uint32_t> name_index;
+
+  void
+  open();
+
+  // Reads the table of the file again after it has been updated, keeping the
+  // resources that have already been loaded
+  void
+  reopen();
+
+  void
+  read_table(uint32_t bundle_version);
+
+  // Bundle versions 1 and 2 name types and entries inline in the table
+  void
+  read_legacy_table(uint32_t bundle_version);
+
+  void
+  index_entry(uint32_t i);
+
+  void
+  rebuild_index();
+
+  Entry *
+  find_entry(std::string_view name);
+
+  // Null if the entry doesn't fit in the mapping
+  const char *
+  get_entry_data(const Entry &entry) const;
+
+  bool
+  decode(uint32_t codec, const char *src, size_t src_size, unsigned char *dst,
+    size_t dst_size) const;
+
+  // Entries that aren't chunked are treated as a single chunk
+  uint64_t
+  get_chunk_size(const Entry &entry) const;
+
+  bool
+  read_chunk(const Entry &entry, uint64_t chunk, unsigned char *dst) const;
+
+  // Resources that borrow from the mapping keep it alive
+  ResourceHandle<Resource>
+  load_entry(const Entry &entry);
+
+#ifdef RESOURCE_IMPORTER
+  /* Serializes and compresses the resources of the table, and writes them
+     out in table order. begin_body() is called once the table is final (a
+     dictionary entry may have been added to the front), and returns the
+     offset in the file that the body starts at. Small entries are compressed
+     with the given dictionary, or with one trained for them if train is set.
+     Fills in where each entry ended up. */
+  static void
+  write_body(std::ostream &out, std::vector<Entry> &table,
+    std::span<const unsigned char> shared_dictionary, bool train,
+    std::function<uint64_t(const std::vector<Entry> &)> begin_body,
+    WorkerPool *pool);
+
+  static uint32_t
+  get_string_table_size(const std::vector<Entry> &table);
+
+  // Entry descriptors followed by the string table
+  static void
+  write_table(std::ostream &out, const std::vector<Entry> &table);
+#endif
 public:
+  enum LoadMode
+  {
+    LoadOnDemand, // entries are decoded the first time they are requested
+    LoadParallel // every entry is decoded up front across a worker pool
+  };
+
+  struct ResidentResource
+  {
+    std::string_view name;
+    Resource *resource;
+    uint64_t last_used; // larger values were requested more recently
+
+    // Something other than the bundle holds a handle to the resource
+    bool shared;
+  };
+
+  // Reads the decoded contents of an entry one chunk at a time
+  class EntryStreamBuffer : public std::streambuf
+  {
+    const ResourceBundle *bundle;
+    const Entry *entry;
+
+    std::vector<char> chunk_data;
+    uint64_t chunk_start; // position in the entry of the get area
+
+    bool
+    load(uint64_t position);
+  protected:
+    int_type
+    underflow();
+
+    pos_type
+    seekoff(off_type off, std::ios_base::seekdir dir,
+      std::ios_base::openmode which);
+
+    pos_type
+    seekpos(pos_type pos, std::ios_base::openmode which);
+  public:
+    EntryStreamBuffer(const ResourceBundle *_bundle, const Entry *_entry);
+  };
+
+  class EntryStream : public std::istream
+  {
+    EntryStreamBuffer buffer;
+  public:
+    EntryStream(const ResourceBundle *_bundle, const Entry *_entry);
+  };
+
   ResourceBundle();
 
-  ResourceBundle(std::string path);
+  ResourceBundle(std::string path, LoadMode mode = LoadOnDemand);
 
   ~ResourceBundle();
 
+  /* The bundle keeps a handle to every resource it has loaded, so the pointer
+     stays valid for as long as the bundle does, unless the resource is
+     unloaded. Hold a handle to keep a resource around. */
   Resource *
-  get_resource(std::string name);
+  get_resource(std::string_view name);
+
+  ResourceHandle<Resource>
+  get_handle(std::string_view name);
+
+  // Empty if there is no such resource or it isn't a T
+  template <typename T>
+  ResourceHandle<T>
+  get(std::string_view name)
+  {
+    return get_handle(name).as<T>();
+  }
+
+  // Decodes the named resources now instead of on first use. If a pool is
+  // given, the entries are decoded on it in parallel.
+  void
+  preload(const std::vector<std::string> &names, WorkerPool *pool = nullptr);
+
+  void
+  preload_all(WorkerPool *pool = nullptr);
+
+  std::vector<std::string>
+  get_resource_names() const;
+
+  /* Decodes an entry without keeping it. Unlike get_resource(), this can be
+     called from several threads at once, as long as nothing is added to the
+     bundle in the meantime. */
+  ResourceHandle<Resource>
+  decode_resource(std::string_view name);
+
+  // Keeps a resource from decode_resource(), unless the entry was loaded in
+  // the meantime. Returns whichever one the bundle ends up with.
+  ResourceHandle<Resource>
+  insert_decoded(std::string_view name, ResourceHandle<Resource> resource);
+
+  std::vector<ResidentResource>
+  get_resident_resources() const;
+
+  // Drops the bundle's handle to a resource. It's loaded again the next time
+  // it is requested.
+  void
+  unload(std::string_view name);
+
+  // Size of the decoded contents of an entry, or 0 if there is no such entry
+  uint64_t
+  get_entry_size(std::string_view name);
+
+  /* Copies part of the decoded contents of an entry without decoding the
+     whole thing, as long as the entry is stored or chunked. Returns the
+     number of bytes read. */
+  size_t
+  read_range(std::string_view name, uint64_t offset, char *out, size_t length);
+
+  // Null if there is no such entry. The stream refers to the bundle, so it
+  // has to be deleted first.
+  EntryStream *
+  open_entry(std::string_view name);
+
+  // Stored resources can be used straight out of the mapped file when loaded.
+  // The bundle shares ownership of the resource.
+  void
+  add_resource(std::string name, ResourceHandle<Resource> resource,
+    Codec codec = CodecAuto);
+
+  // Adds a copy of the resource
+  void
+  add_resource(std::string name, const Resource *resource,
+    Codec codec = CodecAuto);
 
   void
-  add_resource(std::string name, const Resource *resource);
+  remove_resource(std::string_view name);
+
+  uint32_t
+  get_journal_length() const;
 
 #ifdef RESOURCE_IMPORTER
+  // Resources are serialized and compressed in parallel on the given pool, or
+  // on a temporary one using every core if none is given.
+  void
+  write_to(std::string path, WorkerPool *pool = nullptr);
+
+  void
+  write_to(std::ostream &out, WorkerPool *pool = nullptr);
+
+  /* Saves the entries added, replaced or removed since the bundle was read
+     by appending them to its file, along with a new table. The space taken
+     by what they replace isn't reclaimed until the bundle is compacted.
+     Bundles that weren't read from a file of the current version are
+     written whole instead. */
   void
-  write_to(std::string path);
+  append_changes(WorkerPool *pool = nullptr);
 
+  // Rewrites the file the bundle was read from without any dead space
   void
-  write_to(std::ostream &out);
+  compact(WorkerPool *pool = nullptr);
 #endif
 };
 
@@ -0,0 +1,165 @@
+#include "core/resource_cache.h"
+
+#include <algorithm>
+
+ResourceCache * ResourceCache::instance = nullptr;
+
+ResourceCache::ResourceCache(size_t _cpu_budget, size_t _gpu_budget) :
+  cpu_budget(_cpu_budget), gpu_budget(_gpu_budget), bundles(), policies()
+{
+  policies["image"] = PolicyReleaseAfterUpload;
+  policies["font_face"] = PolicyReleaseAfterUpload;
+  policies["audiotrack"] = PolicyCompressedOnly;
+}
+
+ResourceCache::~ResourceCache()
+{
+
+}
+
+void
+ResourceCache::set_instance(ResourceCache *_instance)
+{
+  instance = _instance;
+}
+
+ResourceCache *
+ResourceCache::get()
+{
+  return instance;
+}
+
+void
+ResourceCache::set_budgets(size_t _cpu_budget, size_t _gpu_budget)
+{
+  cpu_budget = _cpu_budget;
+  gpu_budget = _gpu_budget;
+}
+
+void
+ResourceCache::set_policy(std::string type, Policy policy)
+{
+  policies[type] = policy;
+}
+
+ResourceCache::Policy
+ResourceCache::get_policy(const std::string &type) const
+{
+  std::map<std::string, Policy>::const_iterator policy = policies.find(type);
+  if (policy == policies.end())
+    return PolicyKeep;
+  return policy->second;
+}
+
+void
+ResourceCache::add_bundle(std::string label, ResourceBundle *bundle)
+{
+  TrackedBundle tracked = {};
+  tracked.label = label;
+  tracked.bundle = bundle;
+  bundles.push_back(tracked);
+}
+
+void
+ResourceCache::remove_bundle(ResourceBundle *bundle)
+{
+  bundles.erase(std::remove_if(bundles.begin(), bundles.end(),
+    [bundle](const TrackedBundle &tracked) {
+      return tracked.bundle == bundle;
+    }), bundles.end());
+}
+
+ResourceCache::Usage
+ResourceCache::get_usage(const ResourceBundle *bundle) const
+{
+  Usage usage = {};
+  for (const ResourceBundle::ResidentResource &r :
+    bundle->get_resident_resources())
+  {
+    usage.cpu_bytes += r.resource->get_cpu_size();
+    usage.gpu_bytes += r.resource->get_gpu_size();
+  }
+  return usage;
+}
+
+ResourceCache::Usage
+ResourceCache::get_usage() const
+{
+  Usage usage = {};
+  for (const TrackedBundle &tracked : bundles)
+  {
+    Usage bundle_usage = get_usage(tracked.bundle);
+    usage.cpu_bytes += bundle_usage.cpu_bytes;
+    usage.gpu_bytes += bundle_usage.gpu_bytes;
+  }
+  return usage;
+}
+
+std::vector<std::pair<std::string, ResourceCache::Usage>>
+ResourceCache::get_usage_by_bundle() const
+{
+  std::vector<std::pair<std::string, Usage>> usage;
+  for (const TrackedBundle &tracked : bundles)
+    usage.push_back(std::make_pair(tracked.label, get_usage(tracked.bundle)));
+  return usage;
+}
+
+void
+ResourceCache::trim()
+{
+  struct Candidate
+  {
+    ResourceBundle *bundle;
+    ResourceBundle::ResidentResource resident;
+    size_t cpu_bytes;
+    size_t gpu_bytes;
+  };
+
+  Usage usage = {};
+  std::vector<Candidate> candidates;
+  for (const TrackedBundle &tracked : bundles)
+  {
+    for (const ResourceBundle::ResidentResource &r :
+      tracked.bundle->get_resident_resources())
+    {
+      Policy policy = get_policy(r.resource->get_type());
+      if (policy == PolicyReleaseAfterUpload
+        || (policy == PolicyCompressedOnly && !r.shared))
+        r.resource->release_cpu_data();
+
+      Candidate candidate = {};
+      candidate.bundle = tracked.bundle;
+      candidate.resident = r;
+      candidate.cpu_bytes = r.resource->get_cpu_size();
+      candidate.gpu_bytes = r.resource->get_gpu_size();
+      usage.cpu_bytes += candidate.cpu_bytes;
+      usage.gpu_bytes += candidate.gpu_bytes;
+
+      if (policy != PolicyPinned && !r.shared)
+        candidates.push_back(candidate);
+    }
+  }
+
+  if (usage.cpu_bytes <= cpu_budget && usage.gpu_bytes <= gpu_budget)
+    return;
+
+  // Unload the least recently used first
+  std::sort(candidates.begin(), candidates.end(),
+    [](const Candidate &a, const Candidate &b) {
+      return a.resident.last_used < b.resident.last_used;
+    });
+  for (const Candidate &candidate : candidates)
+  {
+    bool over_cpu = usage.cpu_bytes > cpu_budget;
+    bool over_gpu = usage.gpu_bytes > gpu_budget;
+    if (!over_cpu && !over_gpu)
+      break;
+    if (!(over_cpu && candidate.cpu_bytes > 0)
+      && !(over_gpu && candidate.gpu_bytes > 0))
+      continue;
+
+    usage.cpu_bytes -= candidate.cpu_bytes;
+    usage.gpu_bytes -= candidate.gpu_bytes;
+    candidate.bundle->unload(candidate.resident.name);
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef RESOURCE_CACHE_H
+#define RESOURCE_CACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "core/resource.h"
+
+/* Keeps the resources loaded from bundles within a memory budget. Once per
+   frame, trim() frees data each type's policy says isn't needed and unloads
+   the least recently used resources until the budgets are met. Unloaded
+   resources are loaded from their bundle again the next time they are
+   requested. Resources that anything outside their bundle holds a handle to
+   are never unloaded. */
+class ResourceCache
+{
+public:
+  enum Policy
+  {
+    PolicyKeep, // kept as loaded until unloaded
+    PolicyReleaseAfterUpload, // CPU copy freed once it's on the GPU
+    PolicyCompressedOnly, // decoded data freed while nothing is using it
+    PolicyPinned // never unloaded
+  };
+
+  struct Usage
+  {
+    size_t cpu_bytes;
+    size_t gpu_bytes;
+  };
+private:
+  static ResourceCache *instance;
+
+  struct TrackedBundle
+  {
+    std::string label;
+    ResourceBundle *bundle;
+  };
+
+  size_t cpu_budget;
+  size_t gpu_budget;
+
+  std::vector<TrackedBundle> bundles;
+
+  // Keyed on Resource::get_type()
+  std::map<std::string, Policy> policies;
+public:
+  ResourceCache(size_t _cpu_budget, size_t _gpu_budget);
+
+  ~ResourceCache();
+
+  static void
+  set_instance(ResourceCache *_instance);
+
+  static ResourceCache *
+  get();
+
+  void
+  set_budgets(size_t _cpu_budget, size_t _gpu_budget);
+
+  void
+  set_policy(std::string type, Policy policy);
+
+  Policy
+  get_policy(const std::string &type) const;
+
+  // The bundle has to be removed before it is deleted
+  void
+  add_bundle(std::string label, ResourceBundle *bundle);
+
+  void
+  remove_bundle(ResourceBundle *bundle);
+
+  Usage
+  get_usage(const ResourceBundle *bundle) const;
+
+  Usage
+  get_usage() const;
+
+  // Resident bytes of every bundle, by label
+  std::vector<std::pair<std::string, Usage>>
+  get_usage_by_bundle() const;
+
+  void
+  trim();
+};
+
+#endif
@@ -68,10 +68,29 @@ struct BundleCache
   std::map<std::string, BundleCacheEntry> bundles;
 };
 
-void
+// Appending to a bundle leaves what was replaced behind, so once it has been
+// appended to this many times it is rewritten
+const uint32_t max_journal_length = 8;
+
+Hash
+hash_options(const json &resource_data)
+{
+  std::string contents = resource_data.dump();
+  std::vector<unsigned char> hash = std::vector<unsigned char>(picosha2::k_digest_size);
+  picosha2::hash256(contents.begin(), contents.end(), hash.begin(), hash.end());
+  return hash;
+}
+
+/* Resources that are already in the bundle are left alone if neither their
+   file nor how they are listed changed since the bundle was last built.
+   Returns whether any resource was added to the bundle. */
+bool
 add_resource_list_to_bundle(ResourceBundle *bundle, std::string bundle_name,
-  BundleCacheEntry &new_bundle_entry, const json &resource_list)
+  const BundleCacheEntry *old_bundle_entry, BundleCacheEntry &new_bundle_entry,
+  const json &resource_list)
 {
+  bool added = false;
+
   // Iterate through the resources listed in the bundle
   for (const auto &resource_data_kv : resource_list.items())
   {
@@ -82,41 +101,127 @@ add_resource_list_to_bundle(ResourceBundle *bundle, std::string bundle_name,
     if (resource_data.contains("path"))
       resource_path = std::string(RESOURCE_IMPORT_PATH) + "raw/"
         + std::string(resource_data["path"]);
-    Resource *resource = nullptr;
+    ResourceHandle<Resource> resource = ResourceHandle<Resource>();
 
     ResourceCacheEntry new_resource_entry = ResourceCacheEntry();
     new_resource_entry.name = resource_name;
+    new_resource_entry.file_hash = hash_file(resource_path);
+    new_resource_entry.options_hash = hash_options(resource_data);
+    new_bundle_entry.resources[resource_name] = new_resource_entry;
+
+    if (old_bundle_entry != nullptr && bundle->get_entry_size(resource_name) > 0)
+    {
+      std::map<std::string, ResourceCacheEntry>::const_iterator old_resource_entry
+        = old_bundle_entry->resources.find(resource_name);
+      if (old_resource_entry != old_bundle_entry->resources.end()
+        && old_resource_entry->second.file_hash == new_resource_entry.file_hash
+        && old_resource_entry->second.options_hash == new_resource_entry.options_hash)
+      {
+        std::cout << "Resource " + resource_name + " in bundle " + bundle_name
+          + " is up to date" << std::endl;
+        continue;
+      }
+    }
 
     std::cout << "Adding resource " + resource_name + " (" + resource_type
       + ")" + " to bundle " + bundle_name << std::endl;
 
     if (resource_type == "image")
     {
+      Image *image = nullptr;
       if (resource_path.length() > 0)
       {
-        resource = new Image(resource_path);
+        image = new Image(resource_path);
       }
       else
       {
         const json &options = resource_data["options"];
-        resource = render_bitmap_from_json(options);
+        image = render_bitmap_from_json(options);
+      }
+
+      /* "mipmaps" bakes a mip chain into the image, filtered with "box" or
+         "kaiser" (true picks kaiser). Color is filtered in linear light
+         unless "srgb" is false, and "alpha_coverage" keeps as many pixels
+         above that alpha as in the full image. */
+      if (resource_data.contains("mipmaps"))
+      {
+        const json &mipmaps = resource_data["mipmaps"];
+        MipmapOptions options = MipmapOptions();
+        options.filter = MipmapFilterKaiser;
+        if (mipmaps.is_string() && mipmaps.get<std::string>() == "box")
+          options.filter = MipmapFilterBox;
+        options.srgb = resource_data.value("srgb", image->get_channels() >= 3);
+        options.alpha_coverage_threshold = resource_data.value("alpha_coverage", 0.0f);
+
+        if (!mipmaps.is_boolean() || mipmaps.get<bool>())
+        {
+          image->generate_mipmaps(options);
+          std::cout << "Generated " << image->get_levels() << " mip levels for "
+            + resource_name << std::endl;
+        }
+      }
+
+      /* Images can be block compressed, with "compression" naming a format
+         or "auto", and "quality" trading import time for accuracy. */
+      std::string compression = resource_data.value("compression", "");
+      if (compression.length() > 0)
+      {
+        TextureQuality quality = TextureQualityNormal;
+        std::string quality_name = resource_data.value("quality", "");
+        if (quality_name == "fast")
+          quality = TextureQualityFast;
+        else if (quality_name == "high")
+          quality = TextureQualityHigh;
+
+        TextureFormat format = TextureFormatRaw;
+        if (compression == "auto")
+          format = choose_texture_format(image->get_channels(), quality);
+        else if (compression == "bc1")
+          format = TextureFormatBC1;
+        else if (compression == "bc3")
+          format = TextureFormatBC3;
+        else if (compression == "bc4")
+          format = TextureFormatBC4;
+        else if (compression == "bc7")
+          format = TextureFormatBC7;
+        else
+          std::cout << "Unknown compression " + compression + " for "
+            + resource_name + ", leaving it uncompressed" << std::endl;
+
+        if (format != TextureFormatRaw)
+        {
+          float psnr = image->compress(format, quality);
+          std::cout << "Compressed " + resource_name + " to " + compression
+            + ", PSNR " << psnr << " dB" << std::endl;
+        }
       }
+
+      resource = ResourceHandle<Resource>(image);
     }
     else if (resource_type == "font")
     {
-      resource = new FontFace(resource_path);
+      /* Glyphs beyond ASCII are listed in "ranges" as pairs of the first and
+         last code point, e.g. [[160, 255], [1024, 1279]] */
+      std::vector<std::pair<uint32_t, uint32_t>> ranges
+        = std::vector<std::pair<uint32_t, uint32_t>>();
+      if (resource_data.contains("ranges"))
+      {
+        for (const json &range : resource_data["ranges"])
+          ranges.push_back({ range[0].get<uint32_t>(), range[1].get<uint32_t>() });
+      }
+      resource = make_resource<FontFace>(resource_path, ranges);
     }
     else if (resource_type == "text")
     {
-      resource = new Text(resource_path);
+      resource = make_resource<Text>(resource_path);
     }
     else if (resource_type == "audio")
     {
-      resource = new AudioTrack(resource_path);
+      resource = make_resource<AudioTrack>(resource_path);
     }
     else if (resource_type == "scene")
     {
-      resource = new Scene(resource_path);
+      resource = make_resource<Scene>(resource_path);
     }
     else
     {
@@ -124,12 +229,28 @@ add_resource_list_to_bundle(ResourceBundle *bundle, std::string bundle_name,
         + ": unsupported type" << std::endl;
     }
 
-    bundle->add_resource(resource_name, resource);
-    delete resource;
-
-    new_resource_entry.file_hash = hash_file(resource_path);
-    new_bundle_entry.resources[resource_name] = new_resource_entry;
+    // A codec can be picked per resource. Resources marked "store" are
+    // written uncompressed so the game can use them straight out of the
+    // mapped bundle.
+    ResourceBundle::Codec codec = ResourceBundle::CodecAuto;
+    std::string codec_name = resource_data.value("codec", "");
+    if (codec_name == "store" || resource_data.value("store", false))
+      codec = ResourceBundle::CodecStore;
+    else if (codec_name == "deflate")
+      codec = ResourceBundle::CodecDeflate;
+    else if (codec_name == "lz")
+      codec = ResourceBundle::CodecLZ;
+    else if (codec_name.length() > 0)
+      std::cout << "Unknown codec " + codec_name + " for " + resource_name
+        + ", choosing one automatically" << std::endl;
+    if (resource)
+    {
+      bundle->add_resource(resource_name, resource, codec);
+      added = true;
+    }
   }
+
+  return added;
 }
 
 int
@@ -171,10 +292,12 @@ main(int argc, const char **argv)
           json resource_data = resource_data_kv.value();
           std::string resource_name = resource_data["name"];
           std::string file_hash = resource_data["file_hash"];
+          std::string options_hash = resource_data.value("options_hash", "");
 
           ResourceCacheEntry resource_cache;
           resource_cache.name = resource_name;
           resource_cache.file_hash = hex_to_hash(file_hash);
+          resource_cache.options_hash = hex_to_hash(options_hash);
 
           bundle_cache.resources[resource_name] = resource_cache;
         }
@@ -195,70 +318,28 @@ main(int argc, const char **argv)
     // TODO: cache the local filesystem timestamps to avoid reading the files
     // each time.
 
-    // Iterate through the resources in the bundle and check the hashes
-    /*bool hashes_match = true;
-    if (!force_import)
+    /* A bundle that was built before only has the resources that changed
+       since appended to it. Anything else is written from scratch. */
+    std::string bundle_path = std::string(RESOURCE_IMPORT_PATH) + "processed/"
+      + bundle_name + ".rbz";
+    const BundleCacheEntry *old_bundle_entry = nullptr;
+    ResourceBundle *bundle = nullptr;
+    if (!force_import && cache.bundles.find(bundle_name) != cache.bundles.end()
+      && std::filesystem::exists(bundle_path))
     {
-      if (cache.bundles.find(bundle_name) == cache.bundles.end())
-      {
-        hashes_match = false;
-      }
-      else
-      {
-        BundleCacheEntry bundle_cache = cache.bundles[bundle_name];
-        for (const auto &resource_data_kv : bundle_data["resources"].items())
-        {
-          json resource_data = resource_data_kv.value();
-          std::string resource_type = resource_data["type"];
-          std::string resource_name = resource_data["name"];
-          std::string resource_path = std::string(RESOURCE_IMPORT_PATH) + "raw/"
-            + std::string(resource_data["path"]);
-
-          if (bundle_cache.resources.find(resource_name) == bundle_cache.resources.end())
-          {
-            hashes_match = false;
-            break;
-          }
-
-          ResourceCacheEntry resource_cache = bundle_cache.resources[resource_name];
-          Hash current_hash = hash_file(resource_path);
-
-          if (current_hash != resource_cache.file_hash)
-          {
-            hashes_match = false;
-            break;
-          }
-        }
-      }
+      old_bundle_entry = &cache.bundles[bundle_name];
+      bundle = new ResourceBundle(bundle_path);
     }
     else
     {
-      hashes_match = false;
+      bundle = new ResourceBundle();
     }
 
-    // If all the hashes expected in the bundle match, so the source files
-    // and options haven't changed since the last build, we can skip if
-    // the compressed resource bundle is present. Make sure to add the cache
-    // entry back.
-    if (hashes_match)
-    {
-      std::cout << "match\n";
-      if (std::filesystem::exists(std::string(RESOURCE_IMPORT_PATH)
-        + "processed/" + bundle_name + ".rbz"))
-      {
-        std::cout << "Bundle " + bundle_name + " is up to date. Skipping." << std::endl;
-        new_cache.bundles[bundle_name] = cache.bundles[bundle_name];
-        continue;
-      }
-    }*/
-
-    ResourceBundle *bundle = new ResourceBundle();
-
     BundleCacheEntry new_bundle_entry = BundleCacheEntry();
     new_bundle_entry.name = bundle_name;
 
-    add_resource_list_to_bundle(bundle, bundle_name,
-      new_bundle_entry, bundle_data["resources"]);
+    bool changed = add_resource_list_to_bundle(bundle, bundle_name,
+      old_bundle_entry, new_bundle_entry, bundle_data["resources"]);
 
     // Iterate through included resource files
     for (const auto &include_kv : bundle_data["include"].items())
@@ -269,12 +350,36 @@ main(int argc, const char **argv)
       file >> include_bundle;
       file.close();
 
-      add_resource_list_to_bundle(bundle, bundle_name,
-        new_bundle_entry, include_bundle["resources"]);
+      if (add_resource_list_to_bundle(bundle, bundle_name, old_bundle_entry,
+        new_bundle_entry, include_bundle["resources"]))
+        changed = true;
     }
 
-    bundle->write_to(std::string(RESOURCE_IMPORT_PATH) + "processed/"
-      + bundle_name + ".rbz");
+    if (old_bundle_entry == nullptr)
+    {
+      bundle->write_to(bundle_path);
+    }
+    else
+    {
+      // Drop whatever is no longer listed
+      for (const std::string &name : bundle->get_resource_names())
+      {
+        if (new_bundle_entry.resources.find(name) == new_bundle_entry.resources.end())
+        {
+          std::cout << "Removing resource " + name + " from bundle "
+            + bundle_name << std::endl;
+          bundle->remove_resource(name);
+          changed = true;
+        }
+      }
+
+      if (!changed)
+        std::cout << "Bundle " + bundle_name + " is up to date" << std::endl;
+      else if (bundle->get_journal_length() + 1 >= max_journal_length)
+        bundle->compact();
+      else
+        bundle->append_changes();
+    }
     delete bundle;
 
     new_cache.bundles[bundle_name] = new_bundle_entry;
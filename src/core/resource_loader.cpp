@@ -0,0 +1,176 @@
+#include "core/resource_loader.h"
+
+#include <chrono>
+
+BundleLoad::BundleLoad() :
+  bundle(nullptr), entries_total(0), entries_decoded(0), ready(false)
+{
+
+}
+
+BundleLoad::~BundleLoad()
+{
+  // Nobody got to take the bundle
+  if (!ready)
+    delete bundle;
+}
+
+bool
+BundleLoad::is_ready() const
+{
+  return ready;
+}
+
+float
+BundleLoad::get_progress() const
+{
+  unsigned int total = entries_total;
+  if (total == 0)
+    return ready ? 1.0f : 0.0f;
+  return float(entries_decoded) / float(total);
+}
+
+ResourceBundle *
+BundleLoad::get_bundle() const
+{
+  if (!ready)
+    return nullptr;
+  return bundle;
+}
+
+ResourceLoader * ResourceLoader::instance = nullptr;
+
+ResourceLoader::ResourceLoader(unsigned int threads) :
+  main_thread_jobs(), pool(threads)
+{
+
+}
+
+ResourceLoader::~ResourceLoader()
+{
+
+}
+
+void
+ResourceLoader::set_instance(ResourceLoader *_instance)
+{
+  instance = _instance;
+}
+
+ResourceLoader *
+ResourceLoader::get()
+{
+  return instance;
+}
+
+std::shared_ptr<BundleLoad>
+ResourceLoader::load_bundle(std::string path,
+  std::function<void(ResourceBundle *)> on_loaded)
+{
+  std::shared_ptr<BundleLoad> load = std::make_shared<BundleLoad>();
+
+  pool.submit([this, load, path, on_loaded]() {
+    // Opening the bundle only maps it and reads the table of contents
+    ResourceBundle *bundle = new ResourceBundle(path);
+    load->bundle = bundle;
+
+    std::shared_ptr<std::vector<std::string>> names =
+      std::make_shared<std::vector<std::string>>(bundle->get_resource_names());
+
+    // Only touched from the main thread
+    std::shared_ptr<size_t> entries_inserted = std::make_shared<size_t>(0);
+
+    std::function<void()> finish = [load, bundle, on_loaded]() {
+      if (on_loaded)
+        on_loaded(bundle);
+      load->ready = true;
+    };
+
+    load->entries_total = names->size();
+    if (names->empty())
+    {
+      run_on_main_thread(finish);
+      return;
+    }
+
+    /* Each entry is its own job, so that other loads can make progress too.
+       Its result is handed to the bundle from the main thread, since the
+       bundle isn't safe to modify from several threads, along with its
+       texture, so that the upload is spread over frames with everything
+       else. The callback runs after the last of them. */
+    for (size_t i = 0; i < names->size(); ++i)
+    {
+      pool.submit([this, load, bundle, names, entries_inserted, i, finish]() {
+        ResourceHandle<Resource> resource = bundle->decode_resource((*names)[i]);
+        ++load->entries_decoded;
+        run_on_main_thread([bundle, names, entries_inserted, i, resource, finish]() {
+          ResourceHandle<Resource> kept = bundle->insert_decoded((*names)[i], resource);
+          ResourceHandle<Image> image = kept.as<Image>();
+          if (image)
+            image->generate_texture();
+          if (++(*entries_inserted) == names->size())
+            finish();
+        });
+      });
+    }
+  });
+
+  return load;
+}
+
+std::shared_future<ResourceHandle<Resource>>
+ResourceLoader::load_resource(ResourceBundle *bundle, std::string name)
+{
+  std::shared_ptr<std::promise<ResourceHandle<Resource>>> result =
+    std::make_shared<std::promise<ResourceHandle<Resource>>>();
+  std::shared_future<ResourceHandle<Resource>> future = result->get_future().share();
+
+  pool.submit([this, bundle, name, result]() {
+    ResourceHandle<Resource> resource = bundle->decode_resource(name);
+    run_on_main_thread([bundle, name, resource, result]() {
+      ResourceHandle<Resource> kept = bundle->insert_decoded(name, resource);
+      ResourceHandle<Image> image = kept.as<Image>();
+      if (image)
+        image->generate_texture();
+      result->set_value(kept);
+    });
+  });
+
+  return future;
+}
+
+std::future<void>
+ResourceLoader::run_on_main_thread(std::function<void()> job)
+{
+  std::packaged_task<void()> task = std::packaged_task<void()>(job);
+  std::future<void> result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(main_thread_mutex);
+    main_thread_jobs.push_back(std::move(task));
+  }
+  return result;
+}
+
+void
+ResourceLoader::update(float budget)
+{
+  std::chrono::time_point<std::chrono::steady_clock> start =
+    std::chrono::steady_clock::now();
+  while (true)
+  {
+    std::packaged_task<void()> job;
+    {
+      std::lock_guard<std::mutex> lock(main_thread_mutex);
+      if (main_thread_jobs.empty())
+        return;
+      job = std::move(main_thread_jobs.front());
+      main_thread_jobs.pop_front();
+    }
+    job();
+
+    float elapsed = float(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count()) / (1000 * 1000);
+    if (elapsed >= budget)
+      return;
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef RESOURCE_LOADER_H
+#define RESOURCE_LOADER_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "core/resource.h"
+#include "core/worker_pool.h"
+
+// Progress of a bundle being opened by the ResourceLoader
+class BundleLoad
+{
+  friend class ResourceLoader;
+
+  ResourceBundle *bundle;
+
+  std::atomic<unsigned int> entries_total;
+  std::atomic<unsigned int> entries_decoded;
+  std::atomic<bool> ready;
+public:
+  BundleLoad();
+
+  ~BundleLoad();
+
+  // Set once every entry has been decoded and the callback has run
+  bool
+  is_ready() const;
+
+  // Fraction of the entries decoded so far
+  float
+  get_progress() const;
+
+  // Null until the load is ready. The bundle then belongs to the caller.
+  ResourceBundle *
+  get_bundle() const;
+};
+
+/* Opens bundles and decodes resources on worker threads. Anything that has to
+   talk to the graphics API is queued for the main thread instead, and run
+   from update() a bounded amount of time per frame, so loading doesn't stall
+   rendering. */
+class ResourceLoader
+{
+  static ResourceLoader *instance;
+
+  std::deque<std::packaged_task<void()>> main_thread_jobs;
+  std::mutex main_thread_mutex;
+
+  // Declared last so that the workers are stopped before the queue goes away
+  WorkerPool pool;
+public:
+  ResourceLoader(unsigned int threads = 0);
+
+  ~ResourceLoader();
+
+  static void
+  set_instance(ResourceLoader *_instance);
+
+  static ResourceLoader *
+  get();
+
+  // Each entry is added to the bundle on the main thread once it has been
+  // decoded, images with their texture. on_loaded is called on the main
+  // thread after the last entry, which makes it the place to build anything
+  // else from the bundle's resources.
+  std::shared_ptr<BundleLoad>
+  load_bundle(std::string path,
+    std::function<void(ResourceBundle *)> on_loaded = nullptr);
+
+  // Decodes one resource of an open bundle. Images also get their texture
+  // created on the main thread before the result is ready.
+  std::shared_future<ResourceHandle<Resource>>
+  load_resource(ResourceBundle *bundle, std::string name);
+
+  std::future<void>
+  run_on_main_thread(std::function<void()> job);
+
+  // Runs queued main thread jobs until the budget (in seconds) is used up.
+  // At least one job runs per call so that loading always moves forward.
+  void
+  update(float budget);
+};
+
+#endif
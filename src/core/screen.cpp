@@ -2,6 +2,7 @@
 #include "core/graphics.h"
 #include "core/state.h"
 #include "core/audio.h"
+#include "core/util.h"
 #include <algorithm>
 
 MenuControl::MenuControl():
@@ -438,16 +439,18 @@ EmptyControl::draw()
 
 MenuButton::MenuButton(std::string _text, Vec2 _origin, Vec2 _size,
   std::function<void()> _target) :
-  MenuControl(_origin, _size), text(_text), target(_target),
+  MenuControl(_origin, _size), text(_text), layout(), target(_target),
   highlighted(false), pressed(false)
 {
-
+  layout.set_alignment(false, true);
+  layout.set_text(text);
 }
 
 void
 MenuButton::set_text(std::string _text)
 {
   text = _text;
+  layout.set_text(text);
 }
 
 void
@@ -468,34 +471,25 @@ MenuButton::update(float time_elapsed)
 void
 MenuButton::draw()
 {
-  Vec2 window_size = GraphicsServer::get()->get_framebuffer_size();
-  TextRenderRequest req = {};
-  req.bounding_box_origin = get_global_offset();
-  req.bounding_box_size = get_size();
-  req.text = text;
-  req.font = EngineState::get()->get_serif();
-  //req.center = true;
-  req.center_vertical = true;
-
+  Vec4 color = Vec4(1);
   if (pressed)
   {
-    req.size = 42;
-    req.color = Vec4(0.5, 0.5, 0.5, 1);
+    layout.set_size(42);
+    color = Vec4(0.5, 0.5, 0.5, 1);
   }
   else if (highlighted)
   {
-    req.size = 42;
+    layout.set_size(42);
     float sine = sin(3.0f * EngineState::get()->get_time());
     float brightness = 0.7f + (0.3f * sine);
-    req.color = Vec4(brightness, brightness, brightness, 1);
+    color = Vec4(brightness, brightness, brightness, 1);
   }
   else
-  {
-    req.size = 36;
-    req.color = Vec4(1);
-  }
+    layout.set_size(36);
 
-  GraphicsServer::get()->draw_text_line(req);
+  layout.set_font(EngineState::get()->get_serif());
+  layout.set_box_size(get_size());
+  GraphicsServer::get()->draw_text_layout(layout, get_global_offset(), color);
 }
 
 void
@@ -522,10 +516,16 @@ MenuButton::handle_event(const MenuControlEvent *event)
 }
 
 MenuSwitch::MenuSwitch(Vec2 _origin, Vec2 _size, std::function<void(bool)> _value_changed) :
-  MenuControl(_origin, _size), value(false), value_changed(_value_changed),
-  highlighted(-1), pressed(-1)
+  MenuControl(_origin, _size), value(false), no_layout(), yes_layout(),
+  value_changed(_value_changed), highlighted(-1), pressed(-1)
 {
+  no_layout.set_size(24);
+  no_layout.set_alignment(true, true);
+  no_layout.set_text("No");
 
+  yes_layout.set_size(24);
+  yes_layout.set_alignment(true, true);
+  yes_layout.set_text("Yes");
 }
 
 void
@@ -637,25 +637,16 @@ MenuSwitch::draw()
       value ? selected_bg : normal_bg);
   }
 
-  TextRenderRequest req = {};
-  req.font = EngineState::get()->get_serif();
-  req.center = true;
-  req.center_vertical = true;
-  req.size = 24;
-  req.color = Vec4(1);
-
   {
-    req.bounding_box_origin = left_box_origin;
-    req.bounding_box_size = left_box_size;
-    req.text = "No";
-    GraphicsServer::get()->draw_text_line(req);
+    no_layout.set_font(EngineState::get()->get_serif());
+    no_layout.set_box_size(left_box_size);
+    GraphicsServer::get()->draw_text_layout(no_layout, left_box_origin, Vec4(1));
   }
 
   {
-    req.bounding_box_origin = right_box_origin;
-    req.bounding_box_size = right_box_size;
-    req.text = "Yes";
-    GraphicsServer::get()->draw_text_line(req);
+    yes_layout.set_font(EngineState::get()->get_serif());
+    yes_layout.set_box_size(right_box_size);
+    GraphicsServer::get()->draw_text_layout(yes_layout, right_box_origin, Vec4(1));
   }
 }
 
@@ -850,10 +841,11 @@ MenuSlider::draw()
 }
 
 MenuSelector::MenuSelector(Vec2 _origin, Vec2 _size, PropertyData *_property) :
-  MenuControl(_origin, _size), property(_property),
+  MenuControl(_origin, _size), property(_property), layout(),
   highlighted(-1), pressed(-1)
 {
-
+  layout.set_size(24);
+  layout.set_alignment(true, true);
 }
 
 void
@@ -979,27 +971,24 @@ MenuSelector::draw()
       normal_bg);
   }
 
-  TextRenderRequest req = {};
-  req.font = EngineState::get()->get_serif();
-  req.center = true;
-  req.center_vertical = true;
-  req.size = 24;
-  req.color = Vec4(1);
-  req.bounding_box_origin = offset + Vec2(dir_button_width + box_separation, 0);
-  req.bounding_box_size =
-    Vec2(get_size().x - 2.0f * (dir_button_width + box_separation), get_size().y);
+  layout.set_font(EngineState::get()->get_serif());
+  layout.set_box_size(
+    Vec2(get_size().x - 2.0f * (dir_button_width + box_separation), get_size().y));
   {
     const EnumData &en = std::get<EnumData>(property->data);
-    req.text = en.choices[en.current].text;
+    layout.set_text(en.choices[en.current].text);
   }
-  GraphicsServer::get()->draw_text_line(req);
+  GraphicsServer::get()->draw_text_layout(layout,
+    offset + Vec2(dir_button_width + box_separation, 0), Vec4(1));
 }
 
 TextLine::TextLine(Vec2 _origin, Vec2 _size, std::string _text) :
   MenuControl(_origin, _size), text(_text), highlighted(false), pressed(false),
-  cursor_pos(0)
+  cursor_pos(0), layout()
 {
-
+  layout.set_size(16);
+  layout.set_alignment(false, true);
+  layout.set_text(text);
 }
 
 void
@@ -1026,30 +1015,42 @@ TextLine::handle_event(const MenuControlEvent *event)
     Key key = event->key;
     bool pressed = event->pressed;
 
-    if (key == Key::KeyLeft && pressed == true)
+    // The cursor moves over whole UTF-8 sequences
+    uint32_t previous = cursor_pos;
+    if (previous > 0)
     {
-      if (cursor_pos > 0)
-        cursor_pos -= 1;
+      previous -= 1;
+      while (previous > 0 && (uint8_t(text[previous]) & 0xc0) == 0x80)
+        previous -= 1;
     }
+
+    if (key == Key::KeyLeft && pressed == true)
+      cursor_pos = previous;
     else if (key == Key::KeyRight && pressed == true)
     {
       if (cursor_pos < text.length())
-        cursor_pos += 1;
+      {
+        size_t next = cursor_pos;
+        decode_utf8(text, next);
+        cursor_pos = uint32_t(next);
+      }
     }
     else if (key == Key::KeyBackspace && pressed == true)
     {
       if (cursor_pos > 0)
       {
-        text.erase(cursor_pos - 1, 1);
-        cursor_pos -= 1;
+        text.erase(previous, cursor_pos - previous);
+        cursor_pos = previous;
+        layout.set_text(text);
       }
     }
   }
   else if (event->type == MenuControlEventTypeChar)
   {
-    unsigned int codepoint = event->codepoint;
-    text.insert(cursor_pos, 1, (char)codepoint);
-    cursor_pos += 1;
+    std::string sequence = encode_utf8(event->codepoint);
+    text.insert(cursor_pos, sequence);
+    cursor_pos += sequence.length();
+    layout.set_text(text);
   }
   else if (event->type == MenuControlEventTypeMouseButton)
   {
@@ -1091,25 +1092,23 @@ TextLine::draw()
       normal_bg);
 
   {
-    TextRenderRequest req = {};
-    req.font = EngineState::get()->get_serif();
-    req.center = false;
-    req.center_vertical = true;
-    req.size = 16;
-    req.color = Vec4(0, 0, 0, 1);
-    req.bounding_box_origin = offset + Vec2(8, 0);
-    req.bounding_box_size = get_size() - Vec2(16, 0);
-    req.text = text;
-    req.mask_bounds = true;
+    Vec2 text_origin = offset + Vec2(8, 0);
+    layout.set_font(EngineState::get()->get_serif());
+    layout.set_box_size(get_size() - Vec2(16, 0));
 
-    req.cursor = is_focused();
-    req.cursor_pos = cursor_pos;
+    GraphicsServer::get()->clear_stencil_buffer();
+    GraphicsServer::get()->draw_stencil_rect(text_origin, get_size() - Vec2(16, 0));
+    GraphicsServer::get()->draw_text_layout(layout, text_origin, Vec4(0, 0, 0, 1));
+
+    if (is_focused())
     {
       float sine = sin(5.0f * EngineState::get()->get_time());
       float x = sine * sine;
-      req.cursor_color = Vec4(1, 1, 1, x);
+      GraphicsServer::get()->draw_color_rect(text_origin
+        + layout.get_cursor_position(cursor_pos) - Vec2(1, 0),
+        Vec2(2, layout.get_cap_height()), Vec4(1, 1, 1, x));
     }
-    GraphicsServer::get()->draw_text_line(req);
+    GraphicsServer::get()->clear_stencil_buffer();
   }
 }
 
@@ -3,6 +3,7 @@
 
 #include "input.h"
 #include "state.h"
+#include "text_layout.h"
 
 enum MenuControlEventType
 {
@@ -237,6 +238,7 @@ public:
   };
 private:
   std::string text;
+  TextLayout layout;
 
   std::function<void()> target;
 
@@ -274,6 +276,9 @@ class MenuSwitch : public MenuControl
 {
   bool value;
 
+  TextLayout no_layout;
+  TextLayout yes_layout;
+
   std::function<void(bool)> value_changed;
 
   int highlighted;
@@ -356,6 +361,7 @@ public:
 class MenuSelector : public MenuControl
 {
   PropertyData *property;
+  TextLayout layout;
 
   int highlighted;
   int pressed;
@@ -375,7 +381,8 @@ public:
 class TextLine : public MenuControl
 {
   std::string text;
-  uint32_t cursor_pos;
+  uint32_t cursor_pos; // in bytes, always at the start of a UTF-8 sequence
+  TextLayout layout;
 
   bool highlighted;
   bool pressed;
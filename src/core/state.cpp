@@ -1,7 +1,9 @@
 #include "core/state.h"
 #include "core/graphics.h"
+#include "core/glyph_cache.h"
 #include "core/input.h"
 #include "core/resource.h"
+#include "core/resource_cache.h"
 #include "core/util.h"
 #include "core/screen.h"
 
@@ -99,38 +101,46 @@ PropertyData::from_json(const json &spec)
   return data;
 }
 
-BoundFont::BoundFont(FontFace *_face) :
-  face(_face), textures()
+BoundFont::BoundFont(ResourceHandle<FontFace> _face) :
+  face(_face), texture(nullptr), glyph_cache(nullptr)
 {
   face->generate_textures();
-  std::string chars = face->get_chars();
-  for (char c : chars)
-  {
-    Texture *t = face->get_texture(c);
-    BoundTexture *bound = GraphicsServer::get()->bind(t);
-    textures[c] = bound;
-  }
+  texture = face->get_texture()->get_binding();
+  glyph_cache = new GlyphCache(face.get());
 }
 
 BoundFont::~BoundFont()
 {
-  std::string chars = face->get_chars();
-  for (char c : chars)
-  {
-    delete textures[c];
-  }
+  delete glyph_cache;
 }
 
 FontFace *
 BoundFont::get_font()
 {
-  return face;
+  return face.get();
 }
 
 BoundTexture *
-BoundFont::get_bound_texture(char c)
+BoundFont::get_bound_texture()
+{
+  return texture;
+}
+
+const BoundTexture *
+BoundFont::get_glyph_texture(uint32_t codepoint, Vec4 &uv_rect)
 {
-  return textures[c];
+  if (!face->has_glyph(codepoint))
+    codepoint = '?';
+  if (!face->is_atlas_glyph(codepoint))
+    return glyph_cache->get(codepoint, uv_rect);
+
+  const Glyph &glyph = face->get_glyph(codepoint);
+  if (glyph.bitmap_width == 0 || glyph.bitmap_height == 0)
+    return nullptr;
+  Vec2 atlas_size = Vec2(face->get_atlas_width(), face->get_atlas_height());
+  uv_rect = Vec4(glyph.atlas_x / atlas_size.x, glyph.atlas_y / atlas_size.y,
+    glyph.bitmap_width / atlas_size.x, glyph.bitmap_height / atlas_size.y);
+  return texture;
 }
 
 EngineState * EngineState::instance = nullptr;
@@ -140,37 +150,65 @@ EngineState::EngineState() :
   current_screen(nullptr),
   ref(std::chrono::steady_clock::now()),
   last_update(ref),
+  font_bundle(nullptr),
+  global_bundle(nullptr),
+  serif(nullptr),
+  sans(nullptr),
   properties()
 {
-  font_bundle = new ResourceBundle(local_to_absolute_path("resources/fonts.rbz"));
-  global_bundle = new ResourceBundle(local_to_absolute_path("resources/global.rbz"));
+  /* Decode the bundles in the background; the screens can draw while they
+     load. */
+  ResourceLoader *loader = ResourceLoader::get();
+  font_load = loader->load_bundle(
+    local_to_absolute_path("resources/fonts.rbz"),
+    std::bind(&EngineState::fonts_loaded, this, std::placeholders::_1));
+  global_load = loader->load_bundle(
+    local_to_absolute_path("resources/global.rbz"),
+    std::bind(&EngineState::globals_loaded, this, std::placeholders::_1));
+}
 
-  serif = new BoundFont(reinterpret_cast<FontFace *>(font_bundle->get_resource("serif")));
-  sans = new BoundFont(reinterpret_cast<FontFace *>(font_bundle->get_resource("sans")));
+EngineState::~EngineState()
+{
+  delete serif;
+  delete sans;
 
-  {
-    json settings_data =
-      json::parse(((Text *)global_bundle->get_resource("default_settings"))->get_text());
+  if (font_bundle != nullptr)
+    ResourceCache::get()->remove_bundle(font_bundle);
+  if (global_bundle != nullptr)
+    ResourceCache::get()->remove_bundle(global_bundle);
 
-    for (const auto &setting_entry_kv : settings_data["settings"].items())
-    {
-      const json &setting_entry = setting_entry_kv.value();
-      std::string name = setting_entry["name"];
-      properties[name] = PropertyData::from_json(setting_entry);
-    }
+  delete font_bundle;
+  delete global_bundle;
+}
 
-    properties["is_fullscreen"].changed_callback =
-      std::bind(&EngineState::fullscreen_changed, this, std::placeholders::_1);
-  }
+void
+EngineState::fonts_loaded(ResourceBundle *bundle)
+{
+  font_bundle = bundle;
+  ResourceCache::get()->add_bundle("fonts", font_bundle);
+
+  serif = new BoundFont(font_bundle->get<FontFace>("serif"));
+  sans = new BoundFont(font_bundle->get<FontFace>("sans"));
 }
 
-EngineState::~EngineState()
+void
+EngineState::globals_loaded(ResourceBundle *bundle)
 {
-  delete font_bundle;
-  delete global_bundle;
+  global_bundle = bundle;
+  ResourceCache::get()->add_bundle("global", global_bundle);
 
-  delete serif;
-  delete sans;
+  json settings_data =
+    json::parse(global_bundle->get<Text>("default_settings")->get_text());
+
+  for (const auto &setting_entry_kv : settings_data["settings"].items())
+  {
+    const json &setting_entry = setting_entry_kv.value();
+    std::string name = setting_entry["name"];
+    properties[name] = PropertyData::from_json(setting_entry);
+  }
+
+  properties["is_fullscreen"].changed_callback =
+    std::bind(&EngineState::fullscreen_changed, this, std::placeholders::_1);
 }
 
 void
@@ -209,6 +247,18 @@ EngineState::get_time() const
   return float(milliseconds) / 1000.0f;
 }
 
+bool
+EngineState::is_loaded() const
+{
+  return font_load->is_ready() && global_load->is_ready();
+}
+
+float
+EngineState::get_loading_progress() const
+{
+  return 0.5f * (font_load->get_progress() + global_load->get_progress());
+}
+
 BoundFont *
 EngineState::get_sans()
 {
@@ -10,6 +10,7 @@
 class Screen;
 
 #include "core/resource.h"
+#include "core/resource_loader.h"
 #include <json.hpp>
 using json = nlohmann::json;
 
@@ -104,13 +105,19 @@ public:
 };
 
 class BoundTexture;
+class GlyphCache;
 
 class BoundFont
 {
-  FontFace *face;
-  std::map<char, BoundTexture *> textures;
+  ResourceHandle<FontFace> face;
+
+  // Every glyph in the atlas lives in the one texture, which the face owns
+  BoundTexture *texture;
+
+  // Glyphs outside the atlas, uploaded as they are drawn
+  GlyphCache *glyph_cache;
 public:
-  BoundFont(FontFace *_face);
+  BoundFont(ResourceHandle<FontFace> _face);
 
   ~BoundFont();
 
@@ -118,7 +125,13 @@ public:
   get_font();
 
   BoundTexture *
-  get_bound_texture(char c);
+  get_bound_texture();
+
+  /* The texture to draw a code point's glyph from, and the part of it the
+     glyph covers. Code points the font doesn't have are drawn as '?'. Null
+     when there is nothing to draw, as for a space. */
+  const BoundTexture *
+  get_glyph_texture(uint32_t codepoint, Vec4 &uv_rect);
 };
 
 class EngineState
@@ -132,6 +145,9 @@ class EngineState
 
   Screen *current_screen;
 
+  std::shared_ptr<BundleLoad> font_load;
+  std::shared_ptr<BundleLoad> global_load;
+
   ResourceBundle *font_bundle;
   ResourceBundle *global_bundle;
 
@@ -142,6 +158,12 @@ class EngineState
 
   void
   fullscreen_changed(PropertyData *prop);
+
+  void
+  fonts_loaded(ResourceBundle *bundle);
+
+  void
+  globals_loaded(ResourceBundle *bundle);
 public:
   EngineState();
 
@@ -159,6 +181,14 @@ public:
   float
   get_time() const;
 
+  // Whether the fonts and global resources have finished loading
+  bool
+  is_loaded() const;
+
+  float
+  get_loading_progress() const;
+
+  // These are null until the fonts have loaded
   BoundFont *
   get_sans();
 
@@ -0,0 +1,323 @@
+#include "core/text_layout.h"
+#include "core/resource.h"
+#include "core/state.h"
+#include "core/util.h"
+
+#include <algorithm>
+#include <cstdint>
+
+TextLayout::TextLayout() :
+  text(), font(nullptr), size(0), box_size(), wrap(false), center(false),
+  center_vertical(false), characters(), lines(), dirty_from(SIZE_MAX),
+  aligned(true)
+{
+
+}
+
+void
+TextLayout::invalidate(size_t first_character)
+{
+  dirty_from = std::min(dirty_from, first_character);
+}
+
+void
+TextLayout::layout_from(size_t first_character)
+{
+  // TODO: this should be calculated by the font face object
+  float scale_factor = size / (64.0f * 64.0f);
+  float texture_padding = 8; // 'spread' value in SDF generation
+
+  FontFace *face = font->get_font();
+
+  // Everything before the first character was laid out from the same text
+  first_character = std::min(first_character, characters.size());
+  size_t offset = 0;
+  if (first_character < characters.size())
+    offset = characters[first_character].offset;
+  else if (first_character > 0)
+  {
+    offset = characters[first_character - 1].offset;
+    decode_utf8(text, offset);
+  }
+  characters.resize(first_character);
+  while (!lines.empty() && lines.back().first_character >= first_character
+    && (wrap || first_character == 0))
+    lines.pop_back();
+
+  /* Wrapped text is only ever laid out again from the start of a line, but
+     a single line can pick up from any character. */
+  float pen = 0.0f;
+  uint32_t previous = 0;
+  if (!wrap && !lines.empty())
+  {
+    Line &line = lines.back();
+    line.character_count = first_character - line.first_character;
+    if (line.character_count > 0)
+    {
+      pen = characters.back().pen + characters.back().advance;
+      previous = characters.back().codepoint;
+    }
+    line.width = pen;
+  }
+  else
+    lines.push_back(Line{ first_character, 0, 0.0f, Vec2() });
+
+  while (offset < text.length())
+  {
+    Character character = Character();
+    character.offset = offset;
+    character.codepoint = decode_utf8(text, offset);
+    const Glyph &glyph = face->get_glyph(character.codepoint);
+
+    bool newline = wrap && character.codepoint == '\n';
+    float advance = newline ? 0.0f : scale_factor * glyph.horizontal_advance;
+
+    // Move to the next line when this glyph won't fit in the box
+    if (wrap && !newline && lines.back().character_count > 0
+      && pen + advance > box_size.x)
+    {
+      lines.push_back(Line{ characters.size(), 0, 0.0f, Vec2() });
+      pen = 0.0f;
+      previous = 0;
+    }
+
+    character.pen = pen;
+    character.advance = advance;
+    if (!newline && glyph.bitmap_width > 0 && glyph.bitmap_height > 0)
+    {
+      // We are scaling (glyph.bitmap_height - (2 * texture_padding)) bitmap pixels
+      // to be scale_factor * glyph.height visible pixels tall
+      float size_scale = (scale_factor * glyph.height) /
+        (float(glyph.bitmap_height) - (2 * texture_padding));
+      character.quad_size = size_scale * Vec2(glyph.bitmap_width,
+        glyph.bitmap_height);
+
+      // We also have to displace the origin of the quad by (-8, -8) bitmap pixels
+      FontFace::Kerning kern = {};
+      if (lines.back().character_count > 0)
+        kern = face->get_kerning(previous, character.codepoint);
+      character.quad_origin = scale_factor * Vec2(glyph.horizontal_bearing_x + kern.x,
+        -glyph.height + glyph.horizontal_bearing_y + kern.y);
+      character.quad_origin += -scale_factor * Vec2(texture_padding * (float(glyph.width) / float(glyph.bitmap_width)),
+        texture_padding * (float(glyph.height) / float(glyph.bitmap_height)));
+
+      character.texture = font->get_glyph_texture(character.codepoint,
+        character.uv_rect);
+      character.cached = character.texture != nullptr
+        && face->has_glyph(character.codepoint)
+        && !face->is_atlas_glyph(character.codepoint);
+    }
+
+    characters.push_back(character);
+    lines.back().character_count += 1;
+    pen += advance;
+    lines.back().width = pen;
+    previous = character.codepoint;
+
+    if (newline)
+    {
+      lines.push_back(Line{ characters.size(), 0, 0.0f, Vec2() });
+      pen = 0.0f;
+      previous = 0;
+    }
+  }
+}
+
+void
+TextLayout::align_lines()
+{
+  float cap_height = get_cap_height();
+  for (size_t i = 0; i < lines.size(); ++i)
+  {
+    Line &line = lines[i];
+    line.origin = Vec2();
+    if (center)
+      line.origin.x = (1.0f / 2.0f) * (box_size.x - line.width);
+
+    // TODO: Be able to adjust default leading (1.2)?
+    if (wrap)
+      line.origin.y = box_size.y - float(i + 1) * 1.2f * size;
+
+    // We want the vertical center of the text to be the same as the vertical
+    // center of the bounding box.
+    if (center_vertical)
+      line.origin.y += ((1.0f / 2.0f) * box_size.y) - ((1.0f / 2.0f) * cap_height);
+  }
+}
+
+void
+TextLayout::set_font(BoundFont *_font)
+{
+  if (_font == font)
+    return;
+  font = _font;
+  invalidate(0);
+}
+
+void
+TextLayout::set_size(float _size)
+{
+  if (_size == size)
+    return;
+  size = _size;
+  invalidate(0);
+}
+
+void
+TextLayout::set_box_size(Vec2 _box_size)
+{
+  if (_box_size.x == box_size.x && _box_size.y == box_size.y)
+    return;
+
+  // Only wrapping depends on the width of the box
+  if (wrap && _box_size.x != box_size.x)
+    invalidate(0);
+  box_size = _box_size;
+  aligned = false;
+}
+
+void
+TextLayout::set_wrap(bool _wrap)
+{
+  if (_wrap == wrap)
+    return;
+  wrap = _wrap;
+  invalidate(0);
+}
+
+void
+TextLayout::set_alignment(bool _center, bool _center_vertical)
+{
+  if (_center == center && _center_vertical == center_vertical)
+    return;
+  center = _center;
+  center_vertical = _center_vertical;
+  aligned = false;
+}
+
+void
+TextLayout::set_text(const std::string &_text)
+{
+  if (_text == text)
+    return;
+
+  size_t common = 0;
+  while (common < text.length() && common < _text.length()
+    && text[common] == _text[common])
+    common += 1;
+  text = _text;
+
+  // The last character starting at or before the change may run into it
+  std::vector<Character>::const_iterator after = std::upper_bound(
+    characters.begin(), characters.end(), common,
+    [](size_t offset, const Character &character)
+    {
+      return offset < character.offset;
+    });
+  size_t first_character = (after == characters.begin()) ? 0
+    : size_t(after - characters.begin()) - 1;
+
+  /* Lines are broken greedily, so the lines before the change stay as they
+     are, except that the line just before may now fit more of the text. */
+  if (wrap && !lines.empty())
+  {
+    std::vector<Line>::const_iterator line = std::upper_bound(lines.begin(),
+      lines.end(), first_character,
+      [](size_t character, const Line &line)
+      {
+        return character < line.first_character;
+      });
+    size_t index = (line == lines.begin()) ? 0
+      : size_t(line - lines.begin()) - 1;
+    if (index > 0)
+      index -= 1;
+    first_character = lines[index].first_character;
+  }
+  invalidate(first_character);
+}
+
+void
+TextLayout::update()
+{
+  if (dirty_from == SIZE_MAX && aligned)
+    return;
+
+  // The font may still be loading
+  if (font == nullptr)
+  {
+    characters.clear();
+    lines.clear();
+  }
+  else
+  {
+    if (dirty_from != SIZE_MAX)
+      layout_from(dirty_from);
+    align_lines();
+  }
+  dirty_from = SIZE_MAX;
+  aligned = true;
+}
+
+const std::string &
+TextLayout::get_text() const
+{
+  return text;
+}
+
+BoundFont *
+TextLayout::get_font() const
+{
+  return font;
+}
+
+const std::vector<TextLayout::Character> &
+TextLayout::get_characters() const
+{
+  return characters;
+}
+
+const std::vector<TextLayout::Line> &
+TextLayout::get_lines() const
+{
+  return lines;
+}
+
+float
+TextLayout::get_cap_height() const
+{
+  if (font == nullptr)
+    return 0.0f;
+  float scale_factor = size / (64.0f * 64.0f);
+  return scale_factor * font->get_font()->get_glyph('B').height;
+}
+
+Vec2
+TextLayout::get_cursor_position(size_t offset) const
+{
+  if (lines.empty())
+    return Vec2();
+
+  std::vector<Character>::const_iterator found = std::lower_bound(
+    characters.begin(), characters.end(), offset,
+    [](const Character &character, size_t offset)
+    {
+      return character.offset < offset;
+    });
+  if (found == characters.end())
+  {
+    const Line &last = lines.back();
+    float pen = 0.0f;
+    if (last.character_count > 0)
+      pen = characters.back().pen + characters.back().advance;
+    return last.origin + Vec2(pen, 0);
+  }
+
+  size_t index = size_t(found - characters.begin());
+  std::vector<Line>::const_iterator line = std::upper_bound(lines.begin(),
+    lines.end(), index,
+    [](size_t character, const Line &line)
+    {
+      return character < line.first_character;
+    });
+  return (line - 1)->origin + Vec2(found->pen, 0);
+}
@@ -0,0 +1,125 @@
+#ifndef TEXT_LAYOUT_H
+#define TEXT_LAYOUT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/linear_algebra.h"
+
+class BoundFont;
+class BoundTexture;
+
+/* Where every glyph of a block of text goes, worked out once and kept until
+   the text or how it is set changes. Changing the text only lays out again
+   from the line the change starts on. Positions are relative to the bottom
+   left of the box the text is set in. */
+class TextLayout
+{
+public:
+  struct Character
+  {
+    // Where its UTF-8 sequence starts in the text
+    size_t offset;
+    uint32_t codepoint;
+
+    // The pen position along the line, and how far it moves past this glyph
+    float pen;
+    float advance;
+
+    // Relative to the pen on the baseline
+    Vec2 quad_origin;
+    Vec2 quad_size;
+
+    /* Glyphs in the atlas keep their place in it, so those are looked up
+       here. Glyphs from the glyph cache can lose their slot, so those are
+       looked up again every time they are drawn. Null when there is
+       nothing to draw. */
+    const BoundTexture *texture;
+    Vec4 uv_rect;
+    bool cached;
+  };
+
+  struct Line
+  {
+    size_t first_character;
+    size_t character_count;
+    float width;
+
+    // The start of the line's baseline
+    Vec2 origin;
+  };
+private:
+  std::string text;
+  BoundFont *font;
+  float size;
+  Vec2 box_size;
+  bool wrap;
+  bool center;
+  bool center_vertical;
+
+  std::vector<Character> characters;
+  std::vector<Line> lines;
+
+  // The first character that needs laying out again, or SIZE_MAX if none do
+  size_t dirty_from;
+
+  // Whether the lines are placed for the current box and alignment
+  bool aligned;
+
+  void
+  invalidate(size_t first_character);
+
+  void
+  layout_from(size_t first_character);
+
+  void
+  align_lines();
+public:
+  TextLayout();
+
+  void
+  set_font(BoundFont *_font);
+
+  void
+  set_size(float _size);
+
+  void
+  set_box_size(Vec2 _box_size);
+
+  // Break lines to fit in the box, or keep everything on the one line
+  void
+  set_wrap(bool _wrap);
+
+  void
+  set_alignment(bool _center, bool _center_vertical);
+
+  void
+  set_text(const std::string &_text);
+
+  // Lays out whatever has changed since the last update
+  void
+  update();
+
+  const std::string &
+  get_text() const;
+
+  BoundFont *
+  get_font() const;
+
+  const std::vector<Character> &
+  get_characters() const;
+
+  const std::vector<Line> &
+  get_lines() const;
+
+  // The height of a capital letter, which the cursor is drawn to
+  float
+  get_cap_height() const;
+
+  // Where a cursor before the character at a byte offset goes
+  Vec2
+  get_cursor_position(size_t offset) const;
+};
+
+#endif
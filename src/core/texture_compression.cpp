@@ -0,0 +1,978 @@
+#include "core/texture_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+uint32_t
+get_block_size(TextureFormat format)
+{
+  if (format == TextureFormatBC1 || format == TextureFormatBC4)
+    return 8;
+  return 16;
+}
+
+// Weights BC7 interpolates with, out of 64, for 2, 3 and 4 bit indices
+const int bc7_weights_2[4] = {0, 21, 43, 64};
+const int bc7_weights_3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+const int bc7_weights_4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// BC7 blocks are one long little endian bit string
+struct BitReader
+{
+  const unsigned char *data;
+  uint32_t position;
+
+  uint32_t
+  read(uint32_t count)
+  {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      uint32_t bit = (data[(position + i) >> 3] >> ((position + i) & 7)) & 1;
+      value |= bit << i;
+    }
+    position += count;
+    return value;
+  }
+};
+
+void
+unpack_565(uint16_t color, int rgb[3])
+{
+  int r = (color >> 11) & 0x1f;
+  int g = (color >> 5) & 0x3f;
+  int b = color & 0x1f;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+/* BC1 blocks with the endpoints in increasing order have three colors and a
+   transparent black. The color half of a BC3 block always has four. */
+void
+bc1_palette(uint16_t c0, uint16_t c1, bool force_four_colors, int palette[4][4])
+{
+  unpack_565(c0, palette[0]);
+  unpack_565(c1, palette[1]);
+  palette[0][3] = 255;
+  palette[1][3] = 255;
+  for (unsigned int c = 0; c < 3; ++c)
+  {
+    if (c0 > c1 || force_four_colors)
+    {
+      palette[2][c] = ((2 * palette[0][c]) + palette[1][c] + 1) / 3;
+      palette[3][c] = (palette[0][c] + (2 * palette[1][c]) + 1) / 3;
+    }
+    else
+    {
+      palette[2][c] = (palette[0][c] + palette[1][c] + 1) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  palette[2][3] = 255;
+  palette[3][3] = (c0 > c1 || force_four_colors) ? 255 : 0;
+}
+
+// With a0 > a1 there are six interpolated values, otherwise four plus 0, 255
+void
+bc4_palette(int a0, int a1, int palette[8])
+{
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1)
+  {
+    for (int i = 1; i < 7; ++i)
+      palette[i + 1] = (((7 - i) * a0) + (i * a1) + 3) / 7;
+  }
+  else
+  {
+    for (int i = 1; i < 5; ++i)
+      palette[i + 1] = (((5 - i) * a0) + (i * a1) + 2) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+int
+bc7_interpolate(int e0, int e1, int weight)
+{
+  return (((64 - weight) * e0) + (weight * e1) + 32) >> 6;
+}
+
+void
+decode_bc1(const unsigned char *block, bool force_four_colors,
+  unsigned char pixels[16][4])
+{
+  uint16_t c0 = uint16_t(block[0] | (block[1] << 8));
+  uint16_t c1 = uint16_t(block[2] | (block[3] << 8));
+  uint32_t indices = uint32_t(block[4]) | (uint32_t(block[5]) << 8)
+    | (uint32_t(block[6]) << 16) | (uint32_t(block[7]) << 24);
+
+  int palette[4][4];
+  bc1_palette(c0, c1, force_four_colors, palette);
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    const int *color = palette[(indices >> (2 * i)) & 0x3];
+    for (unsigned int c = 0; c < 4; ++c)
+      pixels[i][c] = (unsigned char)color[c];
+  }
+}
+
+void
+decode_bc4(const unsigned char *block, unsigned char values[16])
+{
+  int palette[8];
+  bc4_palette(block[0], block[1], palette);
+
+  uint64_t indices = 0;
+  for (unsigned int i = 0; i < 6; ++i)
+    indices |= uint64_t(block[2 + i]) << (8 * i);
+  for (unsigned int i = 0; i < 16; ++i)
+    values[i] = (unsigned char)palette[(indices >> (3 * i)) & 0x7];
+}
+
+void
+decode_bc7(const unsigned char *block, unsigned char pixels[16][4])
+{
+  unsigned int mode = 0;
+  while (mode < 8 && (block[0] & (1 << mode)) == 0)
+    mode += 1;
+
+  memset(pixels, 0, sizeof(unsigned char) * 16 * 4);
+  BitReader bits = {block, mode + 1};
+
+  if (mode == 6)
+  {
+    int endpoints[2][4];
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      endpoints[0][c] = int(bits.read(7));
+      endpoints[1][c] = int(bits.read(7));
+    }
+    int p0 = int(bits.read(1));
+    int p1 = int(bits.read(1));
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+      endpoints[0][c] = (endpoints[0][c] << 1) | p0;
+      endpoints[1][c] = (endpoints[1][c] << 1) | p1;
+    }
+
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+      // The first index has an implicit leading zero
+      int weight = bc7_weights_4[bits.read(i == 0 ? 3 : 4)];
+      for (unsigned int c = 0; c < 4; ++c)
+        pixels[i][c] = (unsigned char)bc7_interpolate(endpoints[0][c], endpoints[1][c], weight);
+    }
+  }
+  else if (mode == 4 || mode == 5)
+  {
+    // Color and alpha are interpolated separately, with their own indices
+    uint32_t rotation = bits.read(2);
+    uint32_t index_selection = (mode == 4) ? bits.read(1) : 0;
+    uint32_t color_bits = (mode == 4) ? 5 : 7;
+    uint32_t alpha_bits = (mode == 4) ? 6 : 8;
+
+    int endpoints[2][4];
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+      for (unsigned int e = 0; e < 2; ++e)
+      {
+        int value = int(bits.read(color_bits));
+        endpoints[e][c] = (value << (8 - color_bits)) | (value >> ((2 * color_bits) - 8));
+      }
+    }
+    for (unsigned int e = 0; e < 2; ++e)
+    {
+      int value = int(bits.read(alpha_bits));
+      endpoints[e][3] = (alpha_bits == 8) ? value
+        : ((value << (8 - alpha_bits)) | (value >> ((2 * alpha_bits) - 8)));
+    }
+
+    // Mode 4 has 2 and 3 bit index sets, mode 5 two 2 bit sets
+    uint32_t first_bits = 2;
+    uint32_t second_bits = (mode == 4) ? 3 : 2;
+    int first[16];
+    int second[16];
+    for (unsigned int i = 0; i < 16; ++i)
+      first[i] = int(bits.read(i == 0 ? first_bits - 1 : first_bits));
+    for (unsigned int i = 0; i < 16; ++i)
+      second[i] = int(bits.read(i == 0 ? second_bits - 1 : second_bits));
+
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+      int color_weight = 0;
+      int alpha_weight = 0;
+      if (mode == 5)
+      {
+        color_weight = bc7_weights_2[first[i]];
+        alpha_weight = bc7_weights_2[second[i]];
+      }
+      else if (index_selection == 0)
+      {
+        color_weight = bc7_weights_2[first[i]];
+        alpha_weight = bc7_weights_3[second[i]];
+      }
+      else
+      {
+        color_weight = bc7_weights_3[second[i]];
+        alpha_weight = bc7_weights_2[first[i]];
+      }
+
+      for (unsigned int c = 0; c < 3; ++c)
+        pixels[i][c] = (unsigned char)bc7_interpolate(endpoints[0][c], endpoints[1][c], color_weight);
+      pixels[i][3] = (unsigned char)bc7_interpolate(endpoints[0][3], endpoints[1][3], alpha_weight);
+      if (rotation > 0)
+        std::swap(pixels[i][3], pixels[i][rotation - 1]);
+    }
+  }
+}
+
+}
+
+bool
+is_compressed_format(TextureFormat format)
+{
+  return format == TextureFormatBC1 || format == TextureFormatBC3
+    || format == TextureFormatBC4 || format == TextureFormatBC7;
+}
+
+size_t
+get_texture_data_size(TextureFormat format, uint32_t width, uint32_t height,
+  uint32_t channels, uint32_t levels)
+{
+  size_t size = 0;
+  for (uint32_t level = 0; level < levels; ++level)
+  {
+    uint32_t level_width = std::max(width >> level, uint32_t(1));
+    uint32_t level_height = std::max(height >> level, uint32_t(1));
+    if (!is_compressed_format(format))
+    {
+      size += size_t(level_width) * level_height * channels;
+    }
+    else
+    {
+      size_t blocks = size_t((level_width + 3) / 4) * ((level_height + 3) / 4);
+      size += blocks * get_block_size(format);
+    }
+  }
+  return size;
+}
+
+void
+decompress_texture(const unsigned char *blocks, TextureFormat format,
+  uint32_t width, uint32_t height, uint32_t channels, unsigned char *pixels)
+{
+  uint32_t block_size = get_block_size(format);
+  uint32_t blocks_x = (width + 3) / 4;
+  uint32_t blocks_y = (height + 3) / 4;
+  for (uint32_t by = 0; by < blocks_y; ++by)
+  {
+    for (uint32_t bx = 0; bx < blocks_x; ++bx)
+    {
+      const unsigned char *block = &blocks[((by * blocks_x) + bx) * block_size];
+      unsigned char decoded[16][4];
+      if (format == TextureFormatBC1)
+      {
+        decode_bc1(block, false, decoded);
+      }
+      else if (format == TextureFormatBC3)
+      {
+        unsigned char alpha[16];
+        decode_bc4(block, alpha);
+        decode_bc1(block + 8, true, decoded);
+        for (unsigned int i = 0; i < 16; ++i)
+          decoded[i][3] = alpha[i];
+      }
+      else if (format == TextureFormatBC4)
+      {
+        unsigned char values[16];
+        decode_bc4(block, values);
+        for (unsigned int i = 0; i < 16; ++i)
+        {
+          decoded[i][0] = values[i];
+          decoded[i][1] = values[i];
+          decoded[i][2] = values[i];
+          decoded[i][3] = 255;
+        }
+      }
+      else
+      {
+        decode_bc7(block, decoded);
+      }
+
+      // Single channel images keep red, and grey with alpha keeps both
+      for (uint32_t i = 0; i < 16; ++i)
+      {
+        uint32_t x = (bx * 4) + (i % 4);
+        uint32_t y = (by * 4) + (i / 4);
+        if (x >= width || y >= height)
+          continue;
+
+        unsigned char *pixel = &pixels[((size_t(y) * width) + x) * channels];
+        if (channels == 2)
+        {
+          pixel[0] = decoded[i][0];
+          pixel[1] = decoded[i][3];
+        }
+        else
+        {
+          for (uint32_t c = 0; c < channels && c < 4; ++c)
+            pixel[c] = decoded[i][c];
+        }
+      }
+    }
+  }
+}
+
+float
+compute_psnr(const unsigned char *a, const unsigned char *b, uint32_t width,
+  uint32_t height, uint32_t channels)
+{
+  size_t count = size_t(width) * height * channels;
+  if (count == 0)
+    return 0.0f;
+
+  double squared_error = 0.0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    double difference = double(a[i]) - double(b[i]);
+    squared_error += difference * difference;
+  }
+
+  // Identical images get a finite but very high score
+  double mse = squared_error / double(count);
+  if (mse <= 0.0)
+    return 100.0f;
+  return float(10.0 * std::log10((255.0 * 255.0) / mse));
+}
+
+#ifdef RESOURCE_IMPORTER
+namespace
+{
+
+// Edge blocks repeat the last row and column of the image
+void
+fetch_block(const unsigned char *pixels, uint32_t width, uint32_t height,
+  uint32_t channels, uint32_t bx, uint32_t by, unsigned char block[16][4])
+{
+  for (uint32_t i = 0; i < 16; ++i)
+  {
+    uint32_t x = std::min((bx * 4) + (i % 4), width - 1);
+    uint32_t y = std::min((by * 4) + (i / 4), height - 1);
+    const unsigned char *pixel = &pixels[((size_t(y) * width) + x) * channels];
+    if (channels == 1 || channels == 2)
+    {
+      block[i][0] = pixel[0];
+      block[i][1] = pixel[0];
+      block[i][2] = pixel[0];
+      block[i][3] = (channels == 2) ? pixel[1] : 255;
+    }
+    else
+    {
+      block[i][0] = pixel[0];
+      block[i][1] = pixel[1];
+      block[i][2] = pixel[2];
+      block[i][3] = (channels == 4) ? pixel[3] : 255;
+    }
+  }
+}
+
+/* Finds the line through the colors that best fits them, as their mean and
+   the principal axis of their covariance */
+template <unsigned int N>
+void
+fit_line(const float colors[16][4], const bool *used, unsigned int iterations,
+  float mean[N], float axis[N])
+{
+  unsigned int count = 0;
+  for (unsigned int c = 0; c < N; ++c)
+    mean[c] = 0.0f;
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    if (used != nullptr && !used[i])
+      continue;
+    for (unsigned int c = 0; c < N; ++c)
+      mean[c] += colors[i][c];
+    count += 1;
+  }
+  for (unsigned int c = 0; c < N; ++c)
+    mean[c] /= float(std::max(count, 1u));
+
+  float covariance[N][N] = {};
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    if (used != nullptr && !used[i])
+      continue;
+    for (unsigned int j = 0; j < N; ++j)
+    {
+      for (unsigned int k = 0; k < N; ++k)
+        covariance[j][k] += (colors[i][j] - mean[j]) * (colors[i][k] - mean[k]);
+    }
+  }
+
+  // Power iteration, starting from the channel that varies the most
+  unsigned int widest = 0;
+  for (unsigned int c = 1; c < N; ++c)
+  {
+    if (covariance[c][c] > covariance[widest][widest])
+      widest = c;
+  }
+  for (unsigned int c = 0; c < N; ++c)
+    axis[c] = covariance[widest][c];
+
+  for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+  {
+    float next[N] = {};
+    float length = 0.0f;
+    for (unsigned int j = 0; j < N; ++j)
+    {
+      for (unsigned int k = 0; k < N; ++k)
+        next[j] += covariance[j][k] * axis[k];
+      length = std::max(length, std::abs(next[j]));
+    }
+    if (length <= 0.0f)
+      break;
+    for (unsigned int c = 0; c < N; ++c)
+      axis[c] = next[c] / length;
+  }
+
+  float length = 0.0f;
+  for (unsigned int c = 0; c < N; ++c)
+    length += axis[c] * axis[c];
+  length = std::sqrt(length);
+  for (unsigned int c = 0; c < N; ++c)
+    axis[c] = (length > 0.0f) ? axis[c] / length : 0.0f;
+}
+
+/* The ends of the colors' projection onto the line. Lower quality settings
+   don't iterate as much, which leaves a rougher axis. */
+template <unsigned int N>
+void
+fit_endpoints(const float colors[16][4], const bool *used, unsigned int iterations,
+  float e0[N], float e1[N])
+{
+  float mean[N];
+  float axis[N];
+  fit_line<N>(colors, used, iterations, mean, axis);
+
+  float low = 0.0f;
+  float high = 0.0f;
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    if (used != nullptr && !used[i])
+      continue;
+    float t = 0.0f;
+    for (unsigned int c = 0; c < N; ++c)
+      t += (colors[i][c] - mean[c]) * axis[c];
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+
+  for (unsigned int c = 0; c < N; ++c)
+  {
+    e0[c] = std::clamp(mean[c] + (high * axis[c]), 0.0f, 255.0f);
+    e1[c] = std::clamp(mean[c] + (low * axis[c]), 0.0f, 255.0f);
+  }
+}
+
+/* Least squares endpoints for colors that were assigned the given positions
+   along the line, from 0 at the first endpoint to 1 at the second. Returns
+   false when every color is at the same position. */
+template <unsigned int N>
+bool
+refit_endpoints(const float colors[16][4], const bool *used, const float t[16],
+  float e0[N], float e1[N])
+{
+  float aa = 0.0f;
+  float ab = 0.0f;
+  float bb = 0.0f;
+  float ax[N] = {};
+  float bx[N] = {};
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    if (used != nullptr && !used[i])
+      continue;
+    float a = 1.0f - t[i];
+    float b = t[i];
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (unsigned int c = 0; c < N; ++c)
+    {
+      ax[c] += a * colors[i][c];
+      bx[c] += b * colors[i][c];
+    }
+  }
+
+  float determinant = (aa * bb) - (ab * ab);
+  if (std::abs(determinant) < 1e-6f)
+    return false;
+  for (unsigned int c = 0; c < N; ++c)
+  {
+    e0[c] = std::clamp(((bb * ax[c]) - (ab * bx[c])) / determinant, 0.0f, 255.0f);
+    e1[c] = std::clamp(((aa * bx[c]) - (ab * ax[c])) / determinant, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+uint16_t
+quantize_565(const float color[3])
+{
+  int r = std::clamp(int(std::lround(color[0] * 31.0f / 255.0f)), 0, 31);
+  int g = std::clamp(int(std::lround(color[1] * 63.0f / 255.0f)), 0, 63);
+  int b = std::clamp(int(std::lround(color[2] * 31.0f / 255.0f)), 0, 31);
+  return uint16_t((r << 11) | (g << 5) | b);
+}
+
+struct ColorBlockCandidate
+{
+  uint16_t c0;
+  uint16_t c1;
+  uint32_t indices;
+  float error;
+};
+
+// Puts the endpoints in the order the mode needs, and picks each pixel's index
+ColorBlockCandidate
+evaluate_color_block(const float colors[16][4], const bool transparent[16],
+  bool three_colors, bool force_four_colors, uint16_t c0, uint16_t c1)
+{
+  ColorBlockCandidate candidate = ColorBlockCandidate();
+  if ((three_colors && c0 > c1) || (!three_colors && c0 < c1))
+    std::swap(c0, c1);
+  candidate.c0 = c0;
+  candidate.c1 = c1;
+
+  int palette[4][4];
+  bc1_palette(c0, c1, force_four_colors, palette);
+  bool four_colors = force_four_colors || c0 > c1;
+  unsigned int choices = four_colors ? 4 : 3;
+
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    if (transparent != nullptr && transparent[i])
+    {
+      candidate.indices |= 3u << (2 * i);
+      continue;
+    }
+
+    unsigned int best = 0;
+    float best_error = 0.0f;
+    for (unsigned int j = 0; j < choices; ++j)
+    {
+      float error = 0.0f;
+      for (unsigned int c = 0; c < 3; ++c)
+      {
+        float difference = colors[i][c] - float(palette[j][c]);
+        error += difference * difference;
+      }
+      if (j == 0 || error < best_error)
+      {
+        best = j;
+        best_error = error;
+      }
+    }
+    candidate.indices |= best << (2 * i);
+    candidate.error += best_error;
+  }
+
+  return candidate;
+}
+
+/* BC1 color block. Pixels with alpha below half are made transparent when
+   the block allows it, which needs the three color mode. */
+void
+encode_color_block(const unsigned char block[16][4], bool allow_transparent,
+  bool force_four_colors, TextureQuality quality, unsigned char *out)
+{
+  float colors[16][4];
+  bool transparent[16];
+  bool used[16];
+  bool any_transparent = false;
+  bool any_used = false;
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    for (unsigned int c = 0; c < 4; ++c)
+      colors[i][c] = float(block[i][c]);
+    transparent[i] = allow_transparent && block[i][3] < 128;
+    used[i] = !transparent[i];
+    any_transparent = any_transparent || transparent[i];
+    any_used = any_used || used[i];
+  }
+
+  ColorBlockCandidate best = ColorBlockCandidate();
+  if (!any_used)
+  {
+    best.indices = 0xffffffff;
+  }
+  else
+  {
+    bool three_colors = any_transparent;
+    unsigned int iterations = (quality == TextureQualityFast) ? 2
+      : ((quality == TextureQualityNormal) ? 4 : 8);
+    unsigned int refinements = (quality == TextureQualityFast) ? 0
+      : ((quality == TextureQualityNormal) ? 1 : 4);
+
+    float e0[3];
+    float e1[3];
+    fit_endpoints<3>(colors, used, iterations, e0, e1);
+    best = evaluate_color_block(colors, transparent, three_colors,
+      force_four_colors, quantize_565(e0), quantize_565(e1));
+
+    // Where each index sits between the endpoints, for refitting them
+    const float four_positions[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    const float three_positions[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+    for (unsigned int refinement = 0; refinement < refinements; ++refinement)
+    {
+      bool four_colors = force_four_colors || best.c0 > best.c1;
+      float t[16];
+      for (unsigned int i = 0; i < 16; ++i)
+      {
+        unsigned int index = (best.indices >> (2 * i)) & 0x3;
+        t[i] = four_colors ? four_positions[index] : three_positions[index];
+      }
+      if (!refit_endpoints<3>(colors, used, t, e0, e1))
+        break;
+
+      ColorBlockCandidate candidate = evaluate_color_block(colors, transparent,
+        three_colors, force_four_colors, quantize_565(e0), quantize_565(e1));
+      if (candidate.error >= best.error)
+        break;
+      best = candidate;
+    }
+  }
+
+  out[0] = (unsigned char)(best.c0 & 0xff);
+  out[1] = (unsigned char)(best.c0 >> 8);
+  out[2] = (unsigned char)(best.c1 & 0xff);
+  out[3] = (unsigned char)(best.c1 >> 8);
+  for (unsigned int i = 0; i < 4; ++i)
+    out[4 + i] = (unsigned char)((best.indices >> (8 * i)) & 0xff);
+}
+
+struct ValueBlockCandidate
+{
+  int a0;
+  int a1;
+  uint64_t indices;
+  int error;
+};
+
+ValueBlockCandidate
+evaluate_value_block(const unsigned char values[16], int a0, int a1)
+{
+  ValueBlockCandidate candidate = ValueBlockCandidate();
+  candidate.a0 = a0;
+  candidate.a1 = a1;
+
+  int palette[8];
+  bc4_palette(a0, a1, palette);
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    unsigned int best = 0;
+    int best_error = 0;
+    for (unsigned int j = 0; j < 8; ++j)
+    {
+      int error = std::abs(int(values[i]) - palette[j]);
+      if (j == 0 || error < best_error)
+      {
+        best = j;
+        best_error = error;
+      }
+    }
+    candidate.indices |= uint64_t(best) << (3 * i);
+    candidate.error += best_error * best_error;
+  }
+  return candidate;
+}
+
+void
+encode_value_block(const unsigned char values[16], TextureQuality quality,
+  unsigned char *out)
+{
+  int low = 255;
+  int high = 0;
+  int inner_low = 255;
+  int inner_high = 0;
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    low = std::min(low, int(values[i]));
+    high = std::max(high, int(values[i]));
+    if (values[i] != 0 && values[i] != 255)
+    {
+      inner_low = std::min(inner_low, int(values[i]));
+      inner_high = std::max(inner_high, int(values[i]));
+    }
+  }
+
+  // Six interpolated values between the extremes
+  ValueBlockCandidate best = evaluate_value_block(values, high, low);
+
+  // Four between the values that aren't 0 or 255, which the palette has
+  if (quality != TextureQualityFast && inner_low <= inner_high)
+  {
+    ValueBlockCandidate candidate = evaluate_value_block(values, inner_low, inner_high);
+    if (candidate.error < best.error)
+      best = candidate;
+  }
+
+  // Pulling the ends in can fit the values in between better
+  if (quality == TextureQualityHigh)
+  {
+    for (int d0 = 0; d0 < 4; ++d0)
+    {
+      for (int d1 = 0; d1 < 4; ++d1)
+      {
+        if (high - d0 <= low + d1)
+          continue;
+        ValueBlockCandidate candidate = evaluate_value_block(values, high - d0, low + d1);
+        if (candidate.error < best.error)
+          best = candidate;
+      }
+    }
+  }
+
+  out[0] = (unsigned char)best.a0;
+  out[1] = (unsigned char)best.a1;
+  for (unsigned int i = 0; i < 6; ++i)
+    out[2 + i] = (unsigned char)((best.indices >> (8 * i)) & 0xff);
+}
+
+struct BC7Candidate
+{
+  int endpoints[2][4];
+  int p[2];
+  unsigned int indices[16];
+  float error;
+};
+
+// Mode 6 endpoints are 7 bits per channel plus a low bit shared by the four
+void
+quantize_bc7_endpoint(const float color[4], int p, bool opaque, int endpoint[4])
+{
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    int q = std::clamp(int(std::lround((color[c] - float(p)) / 2.0f)), 0, 127);
+    if (c == 3 && opaque)
+      q = 127;
+    endpoint[c] = (q << 1) | p;
+  }
+}
+
+BC7Candidate
+evaluate_bc7_block(const float colors[16][4], const float e0[4], const float e1[4],
+  int p0, int p1, bool opaque)
+{
+  BC7Candidate candidate = BC7Candidate();
+  candidate.p[0] = p0;
+  candidate.p[1] = p1;
+  quantize_bc7_endpoint(e0, p0, opaque, candidate.endpoints[0]);
+  quantize_bc7_endpoint(e1, p1, opaque, candidate.endpoints[1]);
+
+  int palette[16][4];
+  for (unsigned int j = 0; j < 16; ++j)
+  {
+    for (unsigned int c = 0; c < 4; ++c)
+      palette[j][c] = bc7_interpolate(candidate.endpoints[0][c],
+        candidate.endpoints[1][c], bc7_weights_4[j]);
+  }
+
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    unsigned int best = 0;
+    float best_error = 0.0f;
+    for (unsigned int j = 0; j < 16; ++j)
+    {
+      float error = 0.0f;
+      for (unsigned int c = 0; c < 4; ++c)
+      {
+        float difference = colors[i][c] - float(palette[j][c]);
+        error += difference * difference;
+      }
+      if (j == 0 || error < best_error)
+      {
+        best = j;
+        best_error = error;
+      }
+    }
+    candidate.indices[i] = best;
+    candidate.error += best_error;
+  }
+  return candidate;
+}
+
+BC7Candidate
+choose_bc7_p_bits(const float colors[16][4], const float e0[4], const float e1[4],
+  bool opaque, TextureQuality quality)
+{
+  // Opaque blocks need both low bits set to reach an alpha of 255
+  if (opaque)
+    return evaluate_bc7_block(colors, e0, e1, 1, 1, true);
+
+  BC7Candidate best = evaluate_bc7_block(colors, e0, e1, 0, 0, false);
+  for (int p = 1; p < 4; ++p)
+  {
+    // The mixed combinations are only worth trying at higher settings
+    if (quality == TextureQualityFast && p != 3)
+      continue;
+    BC7Candidate candidate = evaluate_bc7_block(colors, e0, e1, p & 1, p >> 1, false);
+    if (candidate.error < best.error)
+      best = candidate;
+  }
+  return best;
+}
+
+class BitWriter
+{
+  unsigned char *data;
+  uint32_t position;
+public:
+  BitWriter(unsigned char *_data) :
+    data(_data), position(0)
+  {
+
+  }
+
+  void
+  write(uint32_t value, uint32_t count)
+  {
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      if ((value >> i) & 1)
+        data[(position + i) >> 3] |= (unsigned char)(1 << ((position + i) & 7));
+    }
+    position += count;
+  }
+};
+
+// Only mode 6 is written, which handles color and alpha as one line
+void
+encode_bc7_block(const unsigned char block[16][4], TextureQuality quality,
+  unsigned char *out)
+{
+  float colors[16][4];
+  bool opaque = true;
+  for (unsigned int i = 0; i < 16; ++i)
+  {
+    for (unsigned int c = 0; c < 4; ++c)
+      colors[i][c] = float(block[i][c]);
+    opaque = opaque && block[i][3] == 255;
+  }
+
+  unsigned int iterations = (quality == TextureQualityFast) ? 2
+    : ((quality == TextureQualityNormal) ? 4 : 8);
+  unsigned int refinements = (quality == TextureQualityFast) ? 0
+    : ((quality == TextureQualityNormal) ? 1 : 3);
+
+  float e0[4];
+  float e1[4];
+  fit_endpoints<4>(colors, nullptr, iterations, e0, e1);
+  BC7Candidate best = choose_bc7_p_bits(colors, e0, e1, opaque, quality);
+
+  for (unsigned int refinement = 0; refinement < refinements; ++refinement)
+  {
+    float t[16];
+    for (unsigned int i = 0; i < 16; ++i)
+      t[i] = float(bc7_weights_4[best.indices[i]]) / 64.0f;
+    if (!refit_endpoints<4>(colors, nullptr, t, e0, e1))
+      break;
+
+    BC7Candidate candidate = choose_bc7_p_bits(colors, e0, e1, opaque, quality);
+    if (candidate.error >= best.error)
+      break;
+    best = candidate;
+  }
+
+  // The first index is stored without its top bit, which must be clear
+  if (best.indices[0] >= 8)
+  {
+    for (unsigned int c = 0; c < 4; ++c)
+      std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+    std::swap(best.p[0], best.p[1]);
+    for (unsigned int i = 0; i < 16; ++i)
+      best.indices[i] = 15 - best.indices[i];
+  }
+
+  memset(out, 0, 16);
+  BitWriter bits = BitWriter(out);
+  bits.write(1 << 6, 7);
+  for (unsigned int c = 0; c < 4; ++c)
+  {
+    bits.write(uint32_t(best.endpoints[0][c] >> 1), 7);
+    bits.write(uint32_t(best.endpoints[1][c] >> 1), 7);
+  }
+  bits.write(uint32_t(best.p[0]), 1);
+  bits.write(uint32_t(best.p[1]), 1);
+  for (unsigned int i = 0; i < 16; ++i)
+    bits.write(best.indices[i], i == 0 ? 3 : 4);
+}
+
+}
+
+TextureFormat
+choose_texture_format(uint32_t channels, TextureQuality quality)
+{
+  if (channels == 1)
+    return TextureFormatBC4;
+  if (channels == 3 && quality != TextureQualityHigh)
+    return TextureFormatBC1;
+  if (quality == TextureQualityFast)
+    return TextureFormatBC3;
+  return TextureFormatBC7;
+}
+
+std::vector<unsigned char>
+compress_texture(const unsigned char *pixels, uint32_t width, uint32_t height,
+  uint32_t channels, TextureFormat format, TextureQuality quality)
+{
+  std::vector<unsigned char> blocks = std::vector<unsigned char>(
+    get_texture_data_size(format, width, height, channels), 0);
+  if (!is_compressed_format(format) || width == 0 || height == 0)
+    return blocks;
+
+  uint32_t block_size = get_block_size(format);
+  uint32_t blocks_x = (width + 3) / 4;
+  uint32_t blocks_y = (height + 3) / 4;
+  bool has_alpha = (channels == 2 || channels == 4);
+  for (uint32_t by = 0; by < blocks_y; ++by)
+  {
+    for (uint32_t bx = 0; bx < blocks_x; ++bx)
+    {
+      unsigned char block[16][4];
+      fetch_block(pixels, width, height, channels, bx, by, block);
+      unsigned char *out = &blocks[((by * blocks_x) + bx) * block_size];
+
+      if (format == TextureFormatBC1)
+      {
+        encode_color_block(block, has_alpha, false, quality, out);
+      }
+      else if (format == TextureFormatBC3)
+      {
+        unsigned char alpha[16];
+        for (unsigned int i = 0; i < 16; ++i)
+          alpha[i] = block[i][3];
+        encode_value_block(alpha, quality, out);
+        encode_color_block(block, false, true, quality, out + 8);
+      }
+      else if (format == TextureFormatBC4)
+      {
+        unsigned char values[16];
+        for (unsigned int i = 0; i < 16; ++i)
+          values[i] = block[i][0];
+        encode_value_block(values, quality, out);
+      }
+      else
+      {
+        encode_bc7_block(block, quality, out);
+      }
+    }
+  }
+
+  return blocks;
+}
+#endif
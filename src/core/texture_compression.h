@@ -0,0 +1,59 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/* Block compressed pixel formats, which GPUs sample from directly. Every
+   format stores 4x4 pixel blocks, and images are padded out to whole
+   blocks. */
+enum TextureFormat
+{
+  TextureFormatRaw = 0, // 8 bits per channel, uncompressed
+  TextureFormatBC1 = 1, // RGB with 1 bit alpha, 8 bytes per block
+  TextureFormatBC3 = 2, // RGBA, BC1 color with a BC4 alpha block
+  TextureFormatBC4 = 3, // one channel, 8 bytes per block
+  TextureFormatBC7 = 4 // RGBA at a higher quality than BC3, 16 bytes per block
+};
+
+// How long the encoder spends looking for better endpoints
+enum TextureQuality
+{
+  TextureQualityFast = 0,
+  TextureQualityNormal = 1,
+  TextureQualityHigh = 2
+};
+
+bool
+is_compressed_format(TextureFormat format);
+
+/* Size of the first levels of a mip chain, where each level is half the size
+   of the one before. This is also where the level after them starts. */
+size_t
+get_texture_data_size(TextureFormat format, uint32_t width, uint32_t height,
+  uint32_t channels, uint32_t levels = 1);
+
+/* Decodes blocks back to 8 bit pixels with the given number of channels.
+   Only the single subset BC7 modes (4 to 6) are decoded, which covers
+   everything the importer writes; other modes come out transparent black. */
+void
+decompress_texture(const unsigned char *blocks, TextureFormat format,
+  uint32_t width, uint32_t height, uint32_t channels, unsigned char *pixels);
+
+// Peak signal to noise ratio between two images, in decibels
+float
+compute_psnr(const unsigned char *a, const unsigned char *b, uint32_t width,
+  uint32_t height, uint32_t channels);
+
+#ifdef RESOURCE_IMPORTER
+// Picks a format suited to the number of channels
+TextureFormat
+choose_texture_format(uint32_t channels, TextureQuality quality);
+
+std::vector<unsigned char>
+compress_texture(const unsigned char *pixels, uint32_t width, uint32_t height,
+  uint32_t channels, TextureFormat format, TextureQuality quality);
+#endif
+
+#endif
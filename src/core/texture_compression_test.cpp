@@ -0,0 +1,102 @@
+#include "core/texture_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+/* Compresses a test pattern to every format, decodes it again, and checks
+   that the result is still close to the original. The size isn't a multiple
+   of the block size, so partial blocks at the edges are covered too. */
+
+namespace
+{
+
+const uint32_t test_width = 67;
+const uint32_t test_height = 45;
+
+struct RoundTrip
+{
+  const char *name;
+  TextureFormat format;
+  uint32_t channels;
+
+  // Lowest PSNR, in decibels, that the decoded image may have
+  float min_psnr;
+};
+
+const RoundTrip round_trips[] = {
+  { "BC1", TextureFormatBC1, 3, 34.0f },
+  { "BC3", TextureFormatBC3, 4, 35.0f },
+  { "BC4", TextureFormatBC4, 1, 44.0f },
+  { "BC7", TextureFormatBC7, 4, 40.0f }
+};
+
+/* Smooth gradients with some finer detail on top, which is what textures
+   mostly look like. Alpha has hard edges as well as gradients. */
+std::vector<unsigned char>
+make_test_pattern(uint32_t channels)
+{
+  std::vector<unsigned char> pixels =
+    std::vector<unsigned char>(test_width * test_height * channels);
+  for (uint32_t y = 0; y < test_height; ++y)
+  {
+    for (uint32_t x = 0; x < test_width; ++x)
+    {
+      for (uint32_t c = 0; c < channels; ++c)
+      {
+        float value = 127.5f
+          + 90.0f * std::sin((0.05f * x) + c) * std::cos((0.04f * y) - (0.5f * c))
+          + 20.0f * std::sin(0.3f * (x + y));
+        if (c == 3)
+          value = ((x / 16) + (y / 16)) % 3 == 0 ? 0.0f : float((x * 2 + y) % 256);
+        pixels[((y * test_width) + x) * channels + c] =
+          (unsigned char)std::clamp(value, 0.0f, 255.0f);
+      }
+    }
+  }
+  return pixels;
+}
+
+}
+
+int
+main()
+{
+  int failures = 0;
+  for (const RoundTrip &round_trip : round_trips)
+  {
+    std::vector<unsigned char> pixels = make_test_pattern(round_trip.channels);
+    for (TextureQuality quality : { TextureQualityFast, TextureQualityNormal,
+      TextureQualityHigh })
+    {
+      std::vector<unsigned char> blocks = compress_texture(pixels.data(),
+        test_width, test_height, round_trip.channels, round_trip.format,
+        quality);
+      if (blocks.size() != get_texture_data_size(round_trip.format,
+        test_width, test_height, round_trip.channels))
+      {
+        std::printf("FAIL %s quality %d: %zu bytes of blocks\n",
+          round_trip.name, int(quality), blocks.size());
+        failures += 1;
+        continue;
+      }
+
+      std::vector<unsigned char> decoded =
+        std::vector<unsigned char>(pixels.size());
+      decompress_texture(blocks.data(), round_trip.format, test_width,
+        test_height, round_trip.channels, decoded.data());
+      float psnr = compute_psnr(pixels.data(), decoded.data(), test_width,
+        test_height, round_trip.channels);
+
+      bool passed = psnr >= round_trip.min_psnr;
+      std::printf("%s %s quality %d: PSNR %.2f dB (at least %.2f dB)\n",
+        passed ? "ok" : "FAIL", round_trip.name, int(quality), psnr,
+        round_trip.min_psnr);
+      if (!passed)
+        failures += 1;
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}
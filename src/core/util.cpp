@@ -57,3 +57,172 @@ local_to_absolute_path(std::string local_path)
 {
   return get_executable_dir() + "/" + local_path;
 }
+
+#ifdef _WIN32
+MappedFile::MappedFile(std::string path) :
+  data(nullptr), size(0), file_handle(INVALID_HANDLE_VALUE),
+  mapping_handle(nullptr)
+{
+  file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+    nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE)
+    return;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+    return;
+
+  mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY,
+    0, 0, nullptr);
+  if (mapping_handle == nullptr)
+    return;
+
+  data = reinterpret_cast<const char *>(MapViewOfFile(mapping_handle,
+    FILE_MAP_READ, 0, 0, 0));
+  if (data != nullptr)
+    size = size_t(file_size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data != nullptr)
+    UnmapViewOfFile(data);
+  if (mapping_handle != nullptr)
+    CloseHandle(mapping_handle);
+  if (file_handle != INVALID_HANDLE_VALUE)
+    CloseHandle(file_handle);
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(std::string path) :
+  data(nullptr), size(0)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+  {
+    void *mapped = mmap(nullptr, size_t(file_stat.st_size), PROT_READ,
+      MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED)
+    {
+      data = reinterpret_cast<const char *>(mapped);
+      size = size_t(file_stat.st_size);
+    }
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data != nullptr)
+    munmap(const_cast<char *>(data), size);
+}
+#endif
+
+bool
+MappedFile::is_open() const
+{
+  return data != nullptr;
+}
+
+const char *
+MappedFile::get_data() const
+{
+  return data;
+}
+
+size_t
+MappedFile::get_size() const
+{
+  return size;
+}
+
+uint32_t
+decode_utf8(const std::string &text, size_t &offset)
+{
+  const uint32_t replacement = 0xfffd;
+  uint8_t lead = uint8_t(text[offset]);
+  offset += 1;
+  if (lead < 0x80)
+    return lead;
+
+  uint32_t length = 0;
+  uint32_t codepoint = 0;
+  uint32_t smallest = 0;
+  if ((lead & 0xe0) == 0xc0)
+  {
+    length = 1;
+    codepoint = lead & 0x1f;
+    smallest = 0x80;
+  }
+  else if ((lead & 0xf0) == 0xe0)
+  {
+    length = 2;
+    codepoint = lead & 0x0f;
+    smallest = 0x800;
+  }
+  else if ((lead & 0xf8) == 0xf0)
+  {
+    length = 3;
+    codepoint = lead & 0x07;
+    smallest = 0x10000;
+  }
+  else
+    return replacement;
+
+  if (offset + length > text.length())
+    return replacement;
+  for (uint32_t i = 0; i < length; ++i)
+  {
+    uint8_t continuation = uint8_t(text[offset + i]);
+    if ((continuation & 0xc0) != 0x80)
+      return replacement;
+    codepoint = (codepoint << 6) | (continuation & 0x3f);
+  }
+
+  // Overlong forms, surrogates and anything past the last plane are invalid
+  if (codepoint < smallest || codepoint > 0x10ffff
+    || (codepoint >= 0xd800 && codepoint <= 0xdfff))
+    return replacement;
+  offset += length;
+  return codepoint;
+}
+
+std::string
+encode_utf8(uint32_t codepoint)
+{
+  if (codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff))
+    codepoint = 0xfffd;
+
+  std::string sequence = std::string();
+  if (codepoint < 0x80)
+    sequence += char(codepoint);
+  else if (codepoint < 0x800)
+  {
+    sequence += char(0xc0 | (codepoint >> 6));
+    sequence += char(0x80 | (codepoint & 0x3f));
+  }
+  else if (codepoint < 0x10000)
+  {
+    sequence += char(0xe0 | (codepoint >> 12));
+    sequence += char(0x80 | ((codepoint >> 6) & 0x3f));
+    sequence += char(0x80 | (codepoint & 0x3f));
+  }
+  else
+  {
+    sequence += char(0xf0 | (codepoint >> 18));
+    sequence += char(0x80 | ((codepoint >> 12) & 0x3f));
+    sequence += char(0x80 | ((codepoint >> 6) & 0x3f));
+    sequence += char(0x80 | (codepoint & 0x3f));
+  }
+  return sequence;
+}
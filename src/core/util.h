@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <iostream>
+#include <cstdint>
 
 std::string
 get_executable_path();
@@ -13,4 +14,42 @@ get_executable_dir();
 std::string
 local_to_absolute_path(std::string local_path);
 
+/* Decodes the UTF-8 sequence starting at offset and moves offset past it.
+   Malformed sequences decode to U+FFFD one byte at a time. */
+uint32_t
+decode_utf8(const std::string &text, size_t &offset);
+
+// The UTF-8 sequence for a code point, U+FFFD for ones that can't be encoded
+std::string
+encode_utf8(uint32_t codepoint);
+
+// Read-only mapping of an entire file into memory
+class MappedFile
+{
+  const char *data;
+  size_t size;
+#ifdef _WIN32
+  void *file_handle;
+  void *mapping_handle;
+#endif
+public:
+  MappedFile(std::string path);
+
+  MappedFile(const MappedFile &) = delete;
+
+  MappedFile &
+  operator=(const MappedFile &) = delete;
+
+  ~MappedFile();
+
+  bool
+  is_open() const;
+
+  const char *
+  get_data() const;
+
+  size_t
+  get_size() const;
+};
+
 #endif
@@ -0,0 +1,63 @@
+#include "core/worker_pool.h"
+
+WorkerPool::WorkerPool(unsigned int threads) :
+  workers(), jobs(), stopping(false)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned int i = 0; i < threads; ++i)
+    workers.push_back(std::thread(&WorkerPool::work, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  // Finish whatever is queued, then let the threads exit
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    stopping = true;
+  }
+  jobs_available.notify_all();
+
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void
+WorkerPool::work()
+{
+  while (true)
+  {
+    std::packaged_task<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      jobs_available.wait(lock, [this]() {
+        return stopping || !jobs.empty();
+      });
+      if (jobs.empty())
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+unsigned int
+WorkerPool::get_thread_count() const
+{
+  return workers.size();
+}
+
+std::future<void>
+WorkerPool::submit(std::function<void()> job)
+{
+  std::packaged_task<void()> task = std::packaged_task<void()>(job);
+  std::future<void> result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs.push_back(std::move(task));
+  }
+  jobs_available.notify_one();
+  return result;
+}
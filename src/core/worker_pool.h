@@ -0,0 +1,38 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+
+// A fixed set of threads that run submitted jobs in FIFO order
+class WorkerPool
+{
+  std::vector<std::thread> workers;
+
+  std::deque<std::packaged_task<void()>> jobs;
+  std::mutex jobs_mutex;
+  std::condition_variable jobs_available;
+
+  bool stopping;
+
+  void
+  work();
+public:
+  // With no thread count, one thread is started per hardware thread
+  WorkerPool(unsigned int threads = 0);
+
+  ~WorkerPool();
+
+  unsigned int
+  get_thread_count() const;
+
+  std::future<void>
+  submit(std::function<void()> job);
+};
+
+#endif
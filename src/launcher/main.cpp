@@ -4,6 +4,8 @@
 #include <core/audio.h>
 #include <core/graphics.h>
 #include <core/input.h>
+#include <core/resource_cache.h>
+#include <core/resource_loader.h>
 #include <core/state.h>
 
 #include "launcher/game_select.h"
@@ -84,6 +86,13 @@ main(int argc, const char **argv)
   InputMonitor *input = new InputMonitor(renderer->get_window());
   InputMonitor::set_instance(input);
 
+  ResourceLoader *loader = new ResourceLoader();
+  ResourceLoader::set_instance(loader);
+
+  // TODO: make the budgets a setting
+  ResourceCache *cache = new ResourceCache(256 * 1024 * 1024, 512 * 1024 * 1024);
+  ResourceCache::set_instance(cache);
+
   EngineState *state = new EngineState();
   EngineState::set_instance(state);
 
@@ -107,15 +116,22 @@ main(int argc, const char **argv)
       float(std::chrono::duration_cast<std::chrono::microseconds>(current_frame
       - last_frame).count()) / (1000 * 1000);
     last_frame = current_frame;
+    /* Finish off loaded resources, but don't hold up the frame for long. */
+    loader->update(0.004f);
     state->update(duration);
     renderer->draw();
+    cache->trim();
   }
 
   delete launcher;
 
+  // Stop loading before the state that receives the resources goes away
+  delete loader;
+
   //delete audio;
   delete renderer;
   delete state;
+  delete cache;
   delete input;
 
   return 0;
@@ -60,7 +60,8 @@ TitleScreen::~TitleScreen()
 void
 TitleScreen::handle_event(const MenuControlEvent *event)
 {
-  if (event->type == MenuControlEventTypeKey)
+  if (event->type == MenuControlEventTypeKey
+    && EngineState::get()->is_loaded())
   {
     launcher->show_game_select_screen();
   }
@@ -119,6 +120,19 @@ TitleScreen::draw()
 
   GraphicsServer::get()->draw_3d(req);
 
+  /* Show how far along loading is until the prompt can be drawn. */
+  if (!EngineState::get()->is_loaded())
+  {
+    float progress = EngineState::get()->get_loading_progress();
+    Vec2 bar_size = Vec2(0.5f * window_size.x, 4.0f);
+    Vec2 bar_origin = Vec2(0.5f * (window_size.x - bar_size.x), 70.0f);
+    GraphicsServer::get()->draw_color_rect(bar_origin, bar_size,
+      Vec4(0.25f, 0.25f, 0.25f, 1.0f));
+    GraphicsServer::get()->draw_color_rect(bar_origin,
+      Vec2(progress * bar_size.x, bar_size.y), Vec4(1.0f));
+    return;
+  }
+
   /* Also a little text prompt */
   TextRenderRequest treq = {};
   treq.bounding_box_origin = Vec2(0, 50.0f);